@@ -0,0 +1,180 @@
+// Host benchmark and fuzz check of nal_find_start() against a bytewise
+// reference. The bitstream is synthetic 4K video: four slices per picture
+// behind 4- then 3-byte start codes, with emulation prevention applied to
+// payload that is heavy in zero bytes, as CABAC output tends to be.
+//
+// Built with a cross compiler and run on a camera, the same program checks
+// the NEON path there.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "fmt/nal.h"
+
+#define BENCH_FPS 30
+#define BENCH_KBPS 20000
+#define BENCH_GOP 60
+#define BENCH_SLICES 4
+#define FUZZ_CASES 200000
+
+static unsigned int seed = 1;
+
+static unsigned int next_rand(void) {
+    seed = seed * 1103515245 + 12345;
+    return seed >> 8;
+}
+
+static uint32_t ref_find_start(const unsigned char *buf, uint32_t pos, uint32_t len,
+    unsigned char *sc_len) {
+    for (uint32_t p = pos; p + 3 <= len; p++) {
+        if (buf[p] || buf[p + 1] || buf[p + 2] != 1) continue;
+        if (p > pos && !buf[p - 1]) {
+            *sc_len = 4;
+            return p - 1;
+        }
+        *sc_len = 3;
+        return p;
+    }
+    return len;
+}
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// One slice worth of payload, escaped so that it never holds 00 00 0x
+// with x <= 3; one byte in 'zeros' is a zero before escaping
+static size_t put_payload(unsigned char *out, size_t size, unsigned int zeros) {
+    size_t n = 0;
+    int run = 0;
+
+    out[n++] = 0x65;
+    while (n < size) {
+        unsigned char b = next_rand() % zeros ? next_rand() & 0xFF : 0;
+        if (run >= 2 && b <= 3) {
+            out[n++] = 3;
+            run = 0;
+            if (n == size) break;
+        }
+        out[n++] = b;
+        run = b ? 0 : run + 1;
+    }
+    // A slice never ends on a zero, rbsp_trailing_bits sees to it
+    out[n - 1] |= 0x80;
+    return n;
+}
+
+static size_t build_stream(unsigned char *buf, size_t size, unsigned int zeros,
+    unsigned int *codes) {
+    size_t frame = (size_t)BENCH_KBPS * 125 / BENCH_FPS, n = 0;
+
+    *codes = 0;
+    for (unsigned int f = 0; ; f++) {
+        size_t bytes = f % BENCH_GOP ? frame : frame * 8;
+
+        for (int s = 0; s < BENCH_SLICES; s++) {
+            size_t slice = bytes / BENCH_SLICES;
+            if (n + 4 + slice + 4 > size) return n;
+
+            if (!s) buf[n++] = 0;
+            buf[n++] = 0;
+            buf[n++] = 0;
+            buf[n++] = 1;
+            n += put_payload(buf + n, slice, zeros);
+            (*codes)++;
+        }
+    }
+}
+
+static unsigned int count_codes(const unsigned char *buf, uint32_t len, int ref) {
+    unsigned int count = 0;
+    unsigned char sc = 0;
+
+    for (uint32_t p = 0; ; p += sc) {
+        p = ref ? ref_find_start(buf, p, len, &sc) : nal_find_start(buf, p, len, &sc);
+        if (p >= len) break;
+        count++;
+    }
+    return count;
+}
+
+static int bench(unsigned char *buf, size_t size, unsigned int zeros) {
+    unsigned int codes, found[2];
+    size_t len = build_stream(buf, size, zeros, &codes);
+    double rate[2];
+
+    for (int ref = 0; ref < 2; ref++) {
+        int rounds = 0;
+        double start = now_sec(), spent;
+
+        do {
+            found[ref] = count_codes(buf, len, ref);
+            rounds++;
+        } while ((spent = now_sec() - start) < 1.0);
+
+        rate[ref] = (double)len * rounds / spent / 1e9;
+    }
+
+    printf("zero byte in %-3u %6.1f MiB %6u codes: %5.2f GB/s, bytewise %5.2f GB/s\n",
+        zeros, len / 1048576.0, codes, rate[0], rate[1]);
+
+    if (found[0] != codes || found[1] != codes) {
+        printf("start code count mismatch: %u found, %u bytewise, %u written\n",
+            found[0], found[1], codes);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+// Short buffers drawn mostly from 00, 01 and 03 at every alignment, so
+// that the word and vector paths and their tails all get exercised
+static int fuzz(void) {
+    static const unsigned char alphabet[] = {0, 0, 0, 0, 1, 1, 3, 0x80, 0xFF};
+    unsigned char area[256 + 16];
+
+    for (int i = 0; i < FUZZ_CASES; i++) {
+        unsigned char *buf = area + next_rand() % 16, sc[2] = {0, 0};
+        uint32_t len = next_rand() % 256, pos = len ? next_rand() % (len + 1) : 0, got[2];
+
+        for (uint32_t k = 0; k < len; k++)
+            buf[k] = alphabet[next_rand() % sizeof(alphabet)];
+
+        got[0] = nal_find_start(buf, pos, len, &sc[0]);
+        got[1] = ref_find_start(buf, pos, len, &sc[1]);
+        if (got[0] != got[1] || (got[1] < len && sc[0] != sc[1])) {
+            printf("fuzz case %d mismatch: len %u pos %u, got %u/%u, expected %u/%u\n",
+                i, len, pos, got[0], sc[0], got[1], sc[1]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    printf("fuzz: %d cases match the bytewise reference\n", FUZZ_CASES);
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char **argv) {
+    size_t size = (argc > 1 ? atoi(argv[1]) : 64) << 20;
+    unsigned char *buf = malloc(size);
+    int ret = EXIT_SUCCESS;
+
+    if (!buf) return EXIT_FAILURE;
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+    printf("nal_find_start: NEON path\n");
+#else
+    printf("nal_find_start: %zu-byte word path\n", sizeof(void *));
+#endif
+
+    if (fuzz()) ret = EXIT_FAILURE;
+    // From zero-heavy CABAC output to the escapes being an exception
+    if (bench(buf, size, 8)) ret = EXIT_FAILURE;
+    if (bench(buf, size, 64)) ret = EXIT_FAILURE;
+    if (bench(buf, size, 256)) ret = EXIT_FAILURE;
+
+    free(buf);
+    return ret;
+}
@@ -0,0 +1,93 @@
+// Host benchmark of the per-frame cost of reaching an RTSP mount's
+// subscribers. Sessions play the audio track only over TCP, so that the
+// video frames timed here find no one to send to and nothing but the
+// subscriber walk is measured.
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "rtsp/rtsp_server.h"
+
+#define BENCH_PORT 18554
+#define BENCH_FRAMES 200000
+
+void request_idr(void) {}
+
+static int rtsp_request(int fd, const char *req) {
+    char reply[2048];
+    size_t got = 0;
+
+    if (send(fd, req, strlen(req), 0) < 0) return -1;
+    while (got < sizeof(reply) - 1) {
+        ssize_t n = recv(fd, reply + got, sizeof(reply) - 1 - got, 0);
+        if (n <= 0) return -1;
+        got += n;
+        reply[got] = '\0';
+        if (strstr(reply, "\r\n\r\n"))
+            return strncmp(reply, "RTSP/1.0 200", 12) ? -1 : 0;
+    }
+    return -1;
+}
+
+static int play_audio(void) {
+    struct sockaddr_in addr = { .sin_family = AF_INET,
+        .sin_port = htons(BENCH_PORT), .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+        rtsp_request(fd, "SETUP rtsp://127.0.0.1/stream=0/track=1 RTSP/1.0\r\n"
+            "CSeq: 1\r\nTransport: RTP/AVP/TCP;unicast;interleaved=2-3\r\n\r\n") ||
+        rtsp_request(fd, "PLAY rtsp://127.0.0.1/stream=0 RTSP/1.0\r\n"
+            "CSeq: 2\r\n\r\n")) {
+        fprintf(stderr, "Opening a session failed!\n");
+        exit(EXIT_FAILURE);
+    }
+    return fd;
+}
+
+int main(int argc, char **argv) {
+    static const int steps[] = {1, 16, 64};
+    static struct rtsp_stat_t stat[RTSP_MAXIMUM_CONNECTIONS * 3];
+    unsigned char data[8] = {0x41, 1, 2, 3, 4, 5, 6, 7};
+    struct rtp_nal_t nal = { .data = data, .size = sizeof(data), .type = 1 };
+    rtsp_handle h = rtsp_create(RTSP_MAXIMUM_CONNECTIONS, BENCH_PORT, 1);
+    rtsp_mount_handle m = h ? rtsp_add_mount(h, "/stream=0") : NULL;
+    int open = 0;
+
+    if (!m) return EXIT_FAILURE;
+
+    for (int s = 0; s < sizeof(steps) / sizeof(*steps); s++) {
+        double best = 0;
+
+        for (; open < steps[s]; open++)
+            play_audio();
+        while (rtsp_get_stats(h, stat, sizeof(stat) / sizeof(*stat)) < open)
+            usleep(10000);
+        usleep(300000);
+
+        for (int round = 0; round < 3; round++) {
+            struct timespec a, b;
+            double ns;
+
+            clock_gettime(CLOCK_MONOTONIC, &a);
+            for (int i = 0; i < BENCH_FRAMES; i++)
+                rtp_send_h26x_nals(m, &nal, 1, 0, 0);
+            clock_gettime(CLOCK_MONOTONIC, &b);
+
+            ns = ((b.tv_sec - a.tv_sec) * 1e9 + b.tv_nsec - a.tv_nsec) / BENCH_FRAMES;
+            if (!round || ns < best) best = ns;
+        }
+
+        printf("%3d sessions: %6.0f ns/frame\n", open, best);
+        fflush(stdout);
+    }
+
+    // Sessions are left for the process exit to tear down
+    _exit(EXIT_SUCCESS);
+}
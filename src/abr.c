@@ -0,0 +1,118 @@
+#include "abr.h"
+
+// Seconds between two looks at the network feedback
+#define ABR_INTERVAL 1
+// Loss in percent reported by a receiver over which it is congested
+#define ABR_LOSS_PCT 2
+// Unsent bytes on an HTTP client over which a growing backlog counts
+#define ABR_QUEUE_BYTES (64 * 1024)
+// Clean rounds between two upward probes, and rounds ignored after a cut
+#define ABR_PROBE_AFTER 3
+#define ABR_HOLDOFF 3
+
+char abrOn = 0;
+static unsigned int abrTarget;
+pthread_t abrPid = 0;
+
+unsigned int abr_bitrate(void) { return abrOn ? abrTarget : 0; }
+
+// Receiver reports only count once, on the round right after their arrival,
+// and jitter past a frame interval means packets are queueing up somewhere
+static bool abr_congested(unsigned int *lastQueue) {
+    bool congested = false;
+
+    if (app_config.rtsp_enable) {
+        // Too large for this thread's stack now that sessions number in hundreds
+        static struct rtsp_stat_t stat[RTSP_MAXIMUM_CONNECTIONS * 3];
+        int count = rtsp_get_stats(rtspHandle, stat, sizeof(stat) / sizeof(*stat));
+
+        for (int i = 0; i < count; i++) {
+            if (stat[i].track || stat[i].silent_ms < 0 ||
+                stat[i].silent_ms >= ABR_INTERVAL * 1000) continue;
+            if (stat[i].fraction_lost >= ABR_LOSS_PCT ||
+                stat[i].jitter_ms * app_config.mp4_fps >= 1000)
+                congested = true;
+        }
+    }
+
+    unsigned int queue = server_queue_peak();
+    if (queue >= ABR_QUEUE_BYTES && queue > *lastQueue)
+        congested = true;
+    *lastQueue = queue;
+
+    return congested;
+}
+
+void *abr_thread(void) {
+    unsigned int lastQueue = 0, clean = 0, hold = 0;
+    unsigned int step = MAX(app_config.mp4_abr_max_bitrate / 20, 8);
+
+    abrTarget = MIN(MAX(app_config.mp4_bitrate, app_config.mp4_abr_min_bitrate),
+        app_config.mp4_abr_max_bitrate);
+
+    while (keepRunning && abrOn) {
+        unsigned int target = abrTarget;
+
+        sleep(ABR_INTERVAL);
+        if (hold) hold--;
+
+        if (abr_congested(&lastQueue)) {
+            clean = 0;
+            if (hold) continue;
+            target = MAX(target * 3 / 4, app_config.mp4_abr_min_bitrate);
+            hold = ABR_HOLDOFF;
+        } else if (++clean >= ABR_PROBE_AFTER) {
+            clean = 0;
+            target = MIN(target + step, app_config.mp4_abr_max_bitrate);
+        }
+
+        if (target == abrTarget) continue;
+
+        if (set_bitrate(target)) {
+            HAL_DANGER("abr", "The encoder refused a bitrate change, "
+                "adaptation is disabled!\n");
+            break;
+        }
+        if (target < abrTarget)
+            HAL_INFO("abr", "Congestion detected, lowering the bitrate "
+                "to %u kbps\n", target);
+        abrTarget = target;
+    }
+
+    HAL_INFO("abr", "Bitrate adaptation thread is closing...\n");
+    abrOn = 0;
+    return NULL;
+}
+
+int enable_abr(void) {
+    int ret = EXIT_SUCCESS;
+
+    if (abrOn) return ret;
+
+    pthread_attr_t thread_attr;
+    pthread_attr_init(&thread_attr);
+    size_t stacksize;
+    pthread_attr_getstacksize(&thread_attr, &stacksize);
+    size_t new_stacksize = 16 * 1024;
+    if (pthread_attr_setstacksize(&thread_attr, new_stacksize))
+        HAL_DANGER("abr", "Can't set stack size %zu\n", new_stacksize);
+    abrOn = 1;
+    if (pthread_create(&abrPid, &thread_attr, (void *(*)(void *))abr_thread, NULL)) {
+        HAL_DANGER("abr", "Starting the bitrate adaptation thread failed!\n");
+        abrOn = 0;
+        ret = EXIT_FAILURE;
+    }
+    if (pthread_attr_setstacksize(&thread_attr, stacksize))
+        HAL_DANGER("abr", "Can't set stack size %zu\n", stacksize);
+    pthread_attr_destroy(&thread_attr);
+
+    return ret;
+}
+
+void disable_abr(void) {
+    if (!abrPid) return;
+
+    abrOn = 0;
+    pthread_join(abrPid, NULL);
+    abrPid = 0;
+}
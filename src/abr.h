@@ -0,0 +1,18 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "app_config.h"
+#include "hal/macros.h"
+#include "media.h"
+#include "rtsp/rtsp_server.h"
+#include "server.h"
+
+unsigned int abr_bitrate(void);
+
+void disable_abr(void);
+int enable_abr(void);
@@ -78,6 +78,12 @@ int save_app_config(void) {
     fprintf(file, "  flip: %s\n", app_config.flip ? "true" : "false");
     fprintf(file, "  antiflicker: %d\n", app_config.antiflicker);
 
+    fprintf(file, "motion:\n");
+    fprintf(file, "  enable: %s\n", app_config.motion_enable ? "true" : "false");
+    fprintf(file, "  sensitivity: %d\n", app_config.motion_sensitivity);
+    fprintf(file, "  hold: %d\n", app_config.motion_hold);
+    fprintf(file, "  record: %s\n", app_config.motion_record ? "true" : "false");
+
     fprintf(file, "mdns:\n");
     fprintf(file, "  enable: %s\n", app_config.mdns_enable ? "true" : "false");
 
@@ -93,6 +99,20 @@ int save_app_config(void) {
     fprintf(file, "  enable_auth: %s\n", app_config.rtsp_enable_auth ? "true" : "false");
     fprintf(file, "  auth_user: %s\n", app_config.rtsp_auth_user);
     fprintf(file, "  auth_pass: %s\n", app_config.rtsp_auth_pass);
+    if (app_config.rtsp_multicast_group[0]) {
+        fprintf(file, "  multicast_group: %s\n", app_config.rtsp_multicast_group);
+        fprintf(file, "  multicast_port: %d\n", app_config.rtsp_multicast_port);
+        fprintf(file, "  multicast_ttl: %d\n", app_config.rtsp_multicast_ttl);
+    }
+    fprintf(file, "  pace_burst: %d\n", app_config.rtsp_pace_burst);
+    if (app_config.rtsp_fec_ratio)
+        fprintf(file, "  fec_ratio: %d\n", app_config.rtsp_fec_ratio);
+    if (app_config.rtsp_nack_budget) {
+        fprintf(file, "  nack_budget: %d\n", app_config.rtsp_nack_budget);
+        fprintf(file, "  nack_history: %d\n", app_config.rtsp_nack_history);
+    }
+    if (app_config.rtsp_gop_cache)
+        fprintf(file, "  gop_cache: %d\n", app_config.rtsp_gop_cache);
 
     fprintf(file, "record:\n");
     fprintf(file, "  enable: %s\n", app_config.record_enable ? "true" : "false");
@@ -101,6 +121,12 @@ int save_app_config(void) {
     fprintf(file, "  filename: %s\n", app_config.record_filename);
     fprintf(file, "  segment_duration: %d\n", app_config.record_segment_duration);
     fprintf(file, "  segment_size: %d\n", app_config.record_segment_size);
+    fprintf(file, "  prealloc: %s\n", app_config.record_prealloc ? "true" : "false");
+
+    fprintf(file, "timelapse:\n");
+    fprintf(file, "  enable: %s\n", app_config.timelapse_enable ? "true" : "false");
+    fprintf(file, "  interval: %d\n", app_config.timelapse_interval);
+    fprintf(file, "  fps: %d\n", app_config.timelapse_fps);
 
     fprintf(file, "stream:\n");
     fprintf(file, "  enable: %s\n", app_config.stream_enable ? "true" : "false");
@@ -114,6 +140,8 @@ int save_app_config(void) {
 
     fprintf(file, "audio:\n");
     fprintf(file, "  enable: %s\n", app_config.audio_enable ? "true" : "false");
+    fprintf(file, "  codec: %s\n", app_config.audio_codec == HAL_AUDCODEC_G711A ? "ALAW" :
+        app_config.audio_codec == HAL_AUDCODEC_G711U ? "ULAW" : "MP3");
     fprintf(file, "  bitrate: %d\n", app_config.audio_bitrate);
     fprintf(file, "  gain: %d\n", app_config.audio_gain);
     fprintf(file, "  srate: %d\n", app_config.audio_srate);
@@ -128,6 +156,11 @@ int save_app_config(void) {
     fprintf(file, "  gop: %d\n", app_config.mp4_gop);
     fprintf(file, "  profile: %d\n", app_config.mp4_profile);
     fprintf(file, "  bitrate: %d\n", app_config.mp4_bitrate);
+    fprintf(file, "  abr_enable: %s\n", app_config.mp4_abr_enable ? "true" : "false");
+    fprintf(file, "  abr_min_bitrate: %d\n", app_config.mp4_abr_min_bitrate);
+    fprintf(file, "  abr_max_bitrate: %d\n", app_config.mp4_abr_max_bitrate);
+    fprintf(file, "  timeshift_size: %d\n", app_config.mp4_timeshift_size);
+    fprintf(file, "  timeshift_catchup: %d\n", app_config.mp4_timeshift_catchup);
 
     fprintf(file, "osd:\n");
     fprintf(file, "  enable: %s\n", app_config.osd_enable ? "true" : "false");
@@ -191,6 +224,11 @@ enum ConfigError parse_app_config(void) {
     app_config.web_server_thread_stack_size = 32 * 1024;
     app_config.watchdog = 0;
 
+    app_config.motion_enable = false;
+    app_config.motion_sensitivity = 5;
+    app_config.motion_hold = 5;
+    app_config.motion_record = false;
+
     app_config.mdns_enable = false;
 
     app_config.osd_enable = false;
@@ -205,6 +243,14 @@ enum ConfigError parse_app_config(void) {
     app_config.rtsp_enable_auth = false;
     app_config.rtsp_auth_user[0] = '\0';
     app_config.rtsp_auth_pass[0] = '\0';
+    app_config.rtsp_multicast_group[0] = '\0';
+    app_config.rtsp_multicast_port = 5000;
+    app_config.rtsp_multicast_ttl = 16;
+    app_config.rtsp_pace_burst = 150;
+    app_config.rtsp_fec_ratio = 0;
+    app_config.rtsp_nack_budget = 0;
+    app_config.rtsp_nack_history = 1000;
+    app_config.rtsp_gop_cache = 0;
 
     app_config.record_enable = false;
     app_config.record_continuous = false;
@@ -212,6 +258,11 @@ enum ConfigError parse_app_config(void) {
     strcpy(app_config.record_path, "/mnt/sdcard/recordings");
     app_config.record_segment_duration = 0;
     app_config.record_segment_size = 0;
+    app_config.record_prealloc = false;
+
+    app_config.timelapse_enable = false;
+    app_config.timelapse_interval = 10;
+    app_config.timelapse_fps = 25;
 
     app_config.stream_enable = false;
     app_config.stream_udp_srcport = 0;
@@ -219,10 +270,14 @@ enum ConfigError parse_app_config(void) {
 
     app_config.sensor_config[0] = 0;
     app_config.audio_enable = false;
+    app_config.audio_codec = HAL_AUDCODEC_MP3;
     app_config.audio_bitrate = 128;
     app_config.audio_gain = 0;
     app_config.jpeg_enable = false;
     app_config.mp4_enable = false;
+    app_config.mp4_abr_enable = false;
+    app_config.mp4_timeshift_size = 0;
+    app_config.mp4_timeshift_catchup = 100;
 
     app_config.mjpeg_enable = false;
     app_config.mjpeg_fps = 15;
@@ -340,6 +395,15 @@ enum ConfigError parse_app_config(void) {
         goto RET_ERR;
     parse_int(&ini, "isp", "antiflicker", -1, 60, &app_config.antiflicker);
 
+    parse_bool(&ini, "motion", "enable", &app_config.motion_enable);
+    if (app_config.motion_enable) {
+        parse_int(&ini, "motion", "sensitivity", 1, 10,
+            &app_config.motion_sensitivity);
+        parse_int(&ini, "motion", "hold", 0, INT_MAX,
+            &app_config.motion_hold);
+        parse_bool(&ini, "motion", "record", &app_config.motion_record);
+    }
+
     parse_bool(&ini, "mdns", "enable", &app_config.mdns_enable);
 
     parse_bool(&ini, "osd", "enable", &app_config.osd_enable);
@@ -393,6 +457,15 @@ enum ConfigError parse_app_config(void) {
         &app_config.record_segment_duration);
     parse_int(&ini, "record", "segment_size", 0, INT_MAX,
         &app_config.record_segment_size);
+    parse_bool(&ini, "record", "prealloc", &app_config.record_prealloc);
+
+    parse_bool(&ini, "timelapse", "enable", &app_config.timelapse_enable);
+    if (app_config.timelapse_enable) {
+        parse_int(&ini, "timelapse", "interval", 1, INT_MAX,
+            &app_config.timelapse_interval);
+        parse_int(&ini, "timelapse", "fps", 1, 60,
+            &app_config.timelapse_fps);
+    }
 
     parse_bool(&ini, "rtsp", "enable", &app_config.rtsp_enable);
     parse_int(&ini, "rtsp", "port", 0, USHRT_MAX, &app_config.rtsp_port);
@@ -402,6 +475,22 @@ enum ConfigError parse_app_config(void) {
             &ini, "rtsp", "auth_user", app_config.rtsp_auth_user);
         parse_param_value(
             &ini, "rtsp", "auth_pass", app_config.rtsp_auth_pass);
+        parse_param_value(
+            &ini, "rtsp", "multicast_group", app_config.rtsp_multicast_group);
+        parse_int(&ini, "rtsp", "multicast_port", 0, USHRT_MAX - 3,
+            &app_config.rtsp_multicast_port);
+        parse_int(&ini, "rtsp", "multicast_ttl", 1, 255,
+            &app_config.rtsp_multicast_ttl);
+        parse_int(&ini, "rtsp", "pace_burst", 0, 1000,
+            &app_config.rtsp_pace_burst);
+        parse_int(&ini, "rtsp", "fec_ratio", 0, 100,
+            &app_config.rtsp_fec_ratio);
+        parse_int(&ini, "rtsp", "nack_budget", 0, 100,
+            &app_config.rtsp_nack_budget);
+        parse_int(&ini, "rtsp", "nack_history", 0, 10000,
+            &app_config.rtsp_nack_history);
+        parse_int(&ini, "rtsp", "gop_cache", 0, 10000,
+            &app_config.rtsp_gop_cache);
     }
 
     parse_bool(&ini, "stream", "enable", &app_config.stream_enable);
@@ -419,6 +508,19 @@ enum ConfigError parse_app_config(void) {
 
     parse_bool(&ini, "audio", "enable", &app_config.audio_enable);
     if (app_config.audio_enable) {
+        {
+            const char *possible_values[] = {"MP3", "ULAW", "ALAW", "PCMU", "PCMA"};
+            const int count = sizeof(possible_values) / sizeof(const char *);
+            int val = 0;
+            parse_enum(&ini, "audio", "codec", (void *)&val,
+                possible_values, count, 0);
+            if (val == 1 || val == 3)
+                app_config.audio_codec = HAL_AUDCODEC_G711U;
+            else if (val == 2 || val == 4)
+                app_config.audio_codec = HAL_AUDCODEC_G711A;
+            else
+                app_config.audio_codec = HAL_AUDCODEC_MP3;
+        }
         parse_int(&ini, "audio", "bitrate", 32, 320, &app_config.audio_bitrate);
         parse_int(&ini, "audio", "gain", -60, 30, &app_config.audio_gain);
         err = parse_int(&ini, "audio", "srate", 8000, 96000, 
@@ -479,6 +581,17 @@ enum ConfigError parse_app_config(void) {
             &ini, "mp4", "bitrate", 32, INT_MAX, &app_config.mp4_bitrate);
         if (err != CONFIG_OK)
             goto RET_ERR;
+        parse_bool(&ini, "mp4", "abr_enable", &app_config.mp4_abr_enable);
+        app_config.mp4_abr_min_bitrate = MAX(32, app_config.mp4_bitrate / 4);
+        parse_int(&ini, "mp4", "abr_min_bitrate", 32, INT_MAX,
+            &app_config.mp4_abr_min_bitrate);
+        app_config.mp4_abr_max_bitrate = app_config.mp4_bitrate;
+        parse_int(&ini, "mp4", "abr_max_bitrate", app_config.mp4_abr_min_bitrate,
+            INT_MAX, &app_config.mp4_abr_max_bitrate);
+        parse_int(&ini, "mp4", "timeshift_size", 0, INT_MAX / 1024,
+            &app_config.mp4_timeshift_size);
+        parse_int(&ini, "mp4", "timeshift_catchup", 100, 400,
+            &app_config.mp4_timeshift_catchup);
     }
 
     err = parse_bool(&ini, "jpeg", "enable", &app_config.jpeg_enable);
@@ -43,6 +43,12 @@ struct AppConfig {
     // [osd]
     bool osd_enable;
 
+    // [motion]
+    bool motion_enable;
+    unsigned int motion_sensitivity;
+    unsigned int motion_hold;
+    bool motion_record;
+
     // [mdns]
     bool mdns_enable;
 
@@ -58,6 +64,14 @@ struct AppConfig {
     char rtsp_auth_user[32];
     char rtsp_auth_pass[32];
     int rtsp_port;
+    char rtsp_multicast_group[32];
+    int rtsp_multicast_port;
+    int rtsp_multicast_ttl;
+    int rtsp_pace_burst;
+    int rtsp_fec_ratio;
+    int rtsp_nack_budget;
+    int rtsp_nack_history;
+    int rtsp_gop_cache;
 
     // [record]
     bool record_enable;
@@ -66,6 +80,12 @@ struct AppConfig {
     char record_path[128];
     int record_segment_duration;
     int record_segment_size;
+    bool record_prealloc;
+
+    // [timelapse]
+    bool timelapse_enable;
+    unsigned int timelapse_interval;
+    unsigned int timelapse_fps;
 
     // [stream]
     bool stream_enable;
@@ -74,6 +94,7 @@ struct AppConfig {
 
     // [audio]
     bool audio_enable;
+    hal_audcodec audio_codec;
     unsigned int audio_bitrate;
     int audio_gain;
     unsigned int audio_srate;
@@ -88,6 +109,11 @@ struct AppConfig {
     unsigned int mp4_height;
     unsigned int mp4_profile;
     unsigned int mp4_bitrate;
+    bool mp4_abr_enable;
+    unsigned int mp4_abr_min_bitrate;
+    unsigned int mp4_abr_max_bitrate;
+    unsigned int mp4_timeshift_size;
+    unsigned int mp4_timeshift_catchup;
 
     // [jpeg]
     bool jpeg_enable;
@@ -0,0 +1,46 @@
+#include "g711.h"
+
+// Segment of a magnitude from its top seven bits, the same for both laws
+// once A-law's is taken one bit lower, so that no sample has to search
+// for it bit by bit
+static const uint8_t g711_seg[128] = {
+    0, 1, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 4, 4, 4, 4,
+    5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5,
+    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+    7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7
+};
+
+// 13-bit magnitudes, where the first two segments share the same step
+void g711_encode_alaw(const int16_t *pcm, uint8_t *out, unsigned int count) {
+    for (unsigned int i = 0; i < count; i++) {
+        int s = pcm[i] >> 3;
+        int neg = s >> 31;
+        // One's complement, so that -4096 still fits in 4095
+        int mag = s ^ neg;
+        int seg = g711_seg[mag >> 5];
+        int mant = (mag >> (seg + !seg)) & 0x0F;
+
+        out[i] = (seg << 4 | mant) ^ 0xD5 ^ (neg & 0x80);
+    }
+}
+
+// 14-bit magnitudes with the bias that lines the segments up, clipped
+// one short of the top so that the largest still has a segment
+void g711_encode_ulaw(const int16_t *pcm, uint8_t *out, unsigned int count) {
+    for (unsigned int i = 0; i < count; i++) {
+        int s = pcm[i] >> 2;
+        int neg = s >> 31;
+        int mag = (s ^ neg) - neg;
+
+        mag = (mag > 8158 ? 8158 : mag) + 33;
+
+        int seg = g711_seg[mag >> 6];
+        int mant = (mag >> (seg + 1)) & 0x0F;
+
+        out[i] = ~((neg & 0x80) | seg << 4 | mant);
+    }
+}
@@ -0,0 +1,7 @@
+#pragma once
+
+#include <stdint.h>
+
+// ITU-T G.711 from 16-bit linear PCM, one byte out per sample in
+void g711_encode_alaw(const int16_t *pcm, uint8_t *out, unsigned int count);
+void g711_encode_ulaw(const int16_t *pcm, uint8_t *out, unsigned int count);
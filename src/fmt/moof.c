@@ -6,6 +6,7 @@ uint32_t pos_sequence_number = 0;
 uint32_t pos_base_data_offset = 0;
 uint32_t pos_audio_media_decode_time = 0;
 uint32_t pos_video_media_decode_time = 0;
+uint32_t pos_video_sample_duration = 0;
 
 struct DataOffsetPos {
     bool data_offset_present;
@@ -59,6 +60,11 @@ enum BufError write_moof(
     const uint32_t samples_aud_len) {
     enum BufError err;
     uint32_t start_atom = ptr->offset;
+    // The trafs are optional, none may leave a previous moof's offsets
+    pos_base_data_offset = 0;
+    pos_audio_media_decode_time = 0;
+    pos_video_media_decode_time = 0;
+    pos_video_sample_duration = 0;
     err = put_u32_be(ptr, 0);
     chk_err;
     err = put_str4(ptr, "moof");
@@ -323,6 +329,8 @@ enum BufError write_trun(
     for (uint32_t i = 0; i < samples_info_count; ++i) {
         const struct SampleInfo sample_info = samples_info[i];
         if (sample_duration_present) {
+            if (!is_audio && !i)
+                pos_video_sample_duration = ptr->offset;
             err = put_u32_be(ptr, sample_info.duration);
             chk_err; // 4 sample_duration
         } 
@@ -6,6 +6,16 @@ extern uint32_t pos_sequence_number;
 extern uint32_t pos_base_data_offset;
 extern uint32_t pos_audio_media_decode_time;
 extern uint32_t pos_video_media_decode_time;
+extern uint32_t pos_video_sample_duration;
+
+// Where the fields rewritten for each client lie in one moof, 0 if absent
+struct MoofPos {
+    uint32_t sequence_number;
+    uint32_t base_data_offset;
+    uint32_t audio_media_decode_time;
+    uint32_t video_media_decode_time;
+    uint32_t video_sample_duration;
+};
 
 struct SampleInfo {
     uint32_t duration;
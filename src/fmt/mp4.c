@@ -8,25 +8,16 @@ char aud_channels = 0;
 short vid_width = 1920, vid_height = 1080;
 char aud_codec = 0, vid_framerate = 30;
 
-char buf_pps[128];
-uint16_t buf_pps_len = 0;
-char buf_sps[128];
-uint16_t buf_sps_len = 0;
-char buf_vps[128];
-uint16_t buf_vps_len = 0;
+struct NalParamSets params;
+bool header_stale = false;
 struct BitBuf buf_aud;
 struct BitBuf buf_header;
 struct BitBuf buf_mdat;
 struct BitBuf buf_moof;
+struct MoofPos pos_moof;
 
-enum BufError create_header(char is_h265) {
-    if (buf_header.offset > 0)
-        return BUF_OK;
-    if (buf_sps_len == 0)
-        return BUF_OK;
-    if (buf_pps_len == 0)
-        return BUF_OK;
-    if (is_h265 && buf_vps_len == 0)
+enum BufError create_header(void) {
+    if (!nal_paramset_complete(&params))
         return BUF_OK;
 
     struct MoovInfo moov_info;
@@ -35,7 +26,7 @@ enum BufError create_header(char is_h265) {
     moov_info.audio_bitrate = aud_bitrate;
     moov_info.audio_channels = aud_channels;
     moov_info.audio_samplerate = aud_samplerate;
-    moov_info.is_h265 = is_h265 & 1;
+    moov_info.is_h265 = params.isH265 & 1;
     moov_info.profile_idc = 100;
     moov_info.level_idc = 41;
     moov_info.width = vid_width;
@@ -45,12 +36,12 @@ enum BufError create_header(char is_h265) {
     moov_info.creation_time = 0;
     moov_info.timescale =
         default_sample_size * vid_framerate;
-    moov_info.sps = buf_sps;
-    moov_info.sps_length = buf_sps_len;
-    moov_info.pps = buf_pps;
-    moov_info.pps_length = buf_pps_len;
-    moov_info.vps = buf_vps;
-    moov_info.vps_length = buf_vps_len;
+    moov_info.sps = params.sps.data;
+    moov_info.sps_length = params.sps.length;
+    moov_info.pps = params.pps.data;
+    moov_info.pps_length = params.pps.length;
+    moov_info.vps = params.vps.data;
+    moov_info.vps_length = params.vps.length;
 
     buf_aud.offset = 0;
     buf_header.offset = 0;
@@ -74,24 +65,18 @@ void mp4_set_config(short width, short height, char framerate, char acodec,
             aud_samplerate;
     } else aud_framesize = 384;
 
+    header_stale = true;
 }
 
-void mp4_set_sps(const char *nal_data, const uint32_t nal_len, char is_h265) {
-    memcpy(buf_sps, nal_data, MIN(nal_len, sizeof(buf_sps)));
-    buf_sps_len = nal_len;
-    create_header(is_h265);
-}
-
-void mp4_set_pps(const char *nal_data, const uint32_t nal_len, char is_h265) {
-    memcpy(buf_pps, nal_data, MIN(nal_len, sizeof(buf_pps)));
-    buf_pps_len = nal_len;
-    create_header(is_h265);
-}
+// The init segment is only rebuilt when the parameter sets or the
+// configuration changed since it was last written
+void mp4_set_params(const struct NalParamSets *ps) {
+    if (ps->generation == params.generation && !header_stale)
+        return;
 
-void mp4_set_vps(const char *nal_data, const uint32_t nal_len) {
-    memcpy(buf_vps, nal_data, MIN(nal_len, sizeof(buf_vps)));
-    buf_vps_len = nal_len;
-    create_header(1);
+    memcpy(&params, ps, sizeof(params));
+    header_stale = false;
+    create_header();
 }
 
 enum BufError mp4_set_slice(const char *nal_data, const uint32_t nal_len,
@@ -112,6 +97,11 @@ enum BufError mp4_set_slice(const char *nal_data, const uint32_t nal_len,
         &buf_moof, 0, 0, 0, default_sample_size, samples_info,
         1, samples_info + 1, 1);
     chk_err;
+    pos_moof.sequence_number = pos_sequence_number;
+    pos_moof.base_data_offset = pos_base_data_offset;
+    pos_moof.audio_media_decode_time = pos_audio_media_decode_time;
+    pos_moof.video_media_decode_time = pos_video_media_decode_time;
+    pos_moof.video_sample_duration = pos_video_sample_duration;
 
     buf_mdat.offset = 0;
     err = write_mdat(&buf_mdat, nal_data, nal_len, 
@@ -131,25 +121,44 @@ enum BufError mp4_ingest_audio(const char *data, const uint32_t len) {
     return BUF_OK;
 }
 
-enum BufError mp4_set_state(struct Mp4State *state) {
+static enum BufError set_state_for(struct Mp4State *state, struct BitBuf *moof,
+    const struct MoofPos *pos, const uint32_t mdat_len, const uint32_t duration) {
     enum BufError err;
-    if (pos_sequence_number > 0)
+    if (pos->sequence_number > 0)
         err = put_u32_be_to_offset(
-            &buf_moof, pos_sequence_number, state->sequence_number);
-    chk_err if (pos_base_data_offset > 0) err = put_u64_be_to_offset(
-        &buf_moof, pos_base_data_offset, state->base_data_offset);
-    chk_err if (pos_audio_media_decode_time > 0) err = put_u64_be_to_offset(
-        &buf_moof, pos_audio_media_decode_time,
+            moof, pos->sequence_number, state->sequence_number);
+    chk_err if (pos->base_data_offset > 0) err = put_u64_be_to_offset(
+        moof, pos->base_data_offset, state->base_data_offset);
+    chk_err if (pos->audio_media_decode_time > 0) err = put_u64_be_to_offset(
+        moof, pos->audio_media_decode_time,
         state->base_media_decode_time);
-    chk_err if (pos_video_media_decode_time > 0) err = put_u64_be_to_offset(
-        &buf_moof, pos_video_media_decode_time,
+    chk_err if (pos->video_media_decode_time > 0) err = put_u64_be_to_offset(
+        moof, pos->video_media_decode_time,
         state->base_media_decode_time);
     chk_err state->sequence_number++;
-    state->base_data_offset += buf_moof.offset + buf_mdat.offset;
-    state->base_media_decode_time += state->default_sample_duration;
+    state->base_data_offset += moof->offset + mdat_len;
+    state->base_media_decode_time += duration;
     return BUF_OK;
 }
 
+enum BufError mp4_set_state(struct Mp4State *state) {
+    return set_state_for(state, &buf_moof, &pos_moof, buf_mdat.offset,
+        state->default_sample_duration);
+}
+
+// A replayed fragment can be made to last less than it was recorded with,
+// so that the player really plays faster instead of only buffering ahead.
+// Its offsets are the ones it was stored with, not the last moof's
+enum BufError mp4_set_state_paced(struct Mp4State *state, struct BitBuf *moof,
+    const struct MoofPos *pos, const uint32_t mdat_len, const uint32_t duration) {
+    enum BufError err;
+    if (pos->video_sample_duration > 0) {
+        err = put_u32_be_to_offset(moof, pos->video_sample_duration, duration);
+        chk_err;
+    }
+    return set_state_for(state, moof, pos, mdat_len, duration);
+}
+
 enum BufError mp4_get_header(struct BitBuf *ptr) {
     ptr->buf = buf_header.buf;
     ptr->size = buf_header.size;
@@ -164,6 +173,10 @@ enum BufError mp4_get_mdat(struct BitBuf *ptr) {
     return BUF_OK;
 }
 
+void mp4_get_moof_pos(struct MoofPos *pos) {
+    *pos = pos_moof;
+}
+
 enum BufError mp4_get_moof(struct BitBuf *ptr) {
     ptr->buf = buf_moof.buf;
     ptr->size = buf_moof.size;
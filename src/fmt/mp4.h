@@ -31,15 +31,16 @@ struct Mp4State {
 void mp4_set_config(short width, short height, char framerate, char acodec,
     unsigned short bitrate, char channels, unsigned int srate);
 
-void mp4_set_sps(const char *nal_data, const uint32_t nal_len, char is_h265);
-void mp4_set_pps(const char *nal_data, const uint32_t nal_len, char is_h265);
-void mp4_set_vps(const char *nal_data, const uint32_t nal_len);
+void mp4_set_params(const struct NalParamSets *ps);
 enum BufError mp4_set_slice(const char *nal_data, const uint32_t nal_len,
     char is_iframe);
 enum BufError mp4_ingest_audio(const char *data, const uint32_t len);
 
 enum BufError mp4_set_state(struct Mp4State *state);
+enum BufError mp4_set_state_paced(struct Mp4State *state, struct BitBuf *moof,
+    const struct MoofPos *pos, const uint32_t mdat_len, const uint32_t duration);
 
 enum BufError mp4_get_header(struct BitBuf *ptr);
 enum BufError mp4_get_moof(struct BitBuf *ptr);
+void mp4_get_moof_pos(struct MoofPos *pos);
 enum BufError mp4_get_mdat(struct BitBuf *ptr);
\ No newline at end of file
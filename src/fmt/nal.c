@@ -1,5 +1,12 @@
 #include "nal.h"
 
+#include <stddef.h>
+#include <string.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
 char *nal_type_to_str(const enum NalUnitType nal_type) {
     switch (nal_type) {
     case NalUnitType_Unspecified:
@@ -53,6 +60,71 @@ void nal_parse_header(struct NAL *nal, const char first_byte) {
     nal->unit_type = nal->isH265 ? ((first_byte & 0b01111110) >> 1) : (first_byte & 0b00011111);
 }
 
+static uint32_t nal_hash(const char *data, uint32_t len) {
+    uint32_t hash = 2166136261u;
+    while (len--) {
+        hash ^= (unsigned char)*data++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Takes one NALU without its start code; anything but a parameter set is
+// ignored. Returns true when the stored set changed.
+bool nal_paramset_update(struct NalParamSets *ps, const char *nal_data,
+    const uint32_t nal_len, char isH265) {
+    struct NalParamSet *set;
+    uint32_t hash;
+
+    if (!nal_len) return false;
+
+    switch (isH265 ? (nal_data[0] & 0x7E) >> 1 : nal_data[0] & 0x1F) {
+        case NalUnitType_SPS:
+            if (isH265) return false;
+            /* fall through */
+        case NalUnitType_SPS_HEVC:
+            set = &ps->sps; break;
+        case NalUnitType_PPS:
+            if (isH265) return false;
+            /* fall through */
+        case NalUnitType_PPS_HEVC:
+            set = &ps->pps; break;
+        case NalUnitType_VPS_HEVC:
+            if (!isH265) return false;
+            set = &ps->vps; break;
+        default:
+            return false;
+    }
+
+    // Kept out rather than truncated, the previous set stays in use
+    if (nal_len > NAL_PARAMSET_MAX) {
+        ps->oversize = nal_len;
+        return false;
+    }
+
+    if (ps->isH265 != isH265) {
+        memset(&ps->vps, 0, sizeof(ps->vps));
+        memset(&ps->sps, 0, sizeof(ps->sps));
+        memset(&ps->pps, 0, sizeof(ps->pps));
+        ps->isH265 = isH265;
+    }
+
+    hash = nal_hash(nal_data, nal_len);
+    if (set->length == nal_len && set->hash == hash) return false;
+
+    memcpy(set->data, nal_data, nal_len);
+    set->length = nal_len;
+    set->hash = hash;
+    ps->generation++;
+
+    return true;
+}
+
+bool nal_paramset_complete(const struct NalParamSets *ps) {
+    return ps->sps.length >= 4 && ps->pps.length &&
+        (!ps->isH265 || ps->vps.length);
+}
+
 bool nal_chk4(const char *buf, const unsigned int offset) {
     if (buf[offset] == 0x00 && buf[offset + 1] == 0x00 &&
         buf[offset + 2] == 0x01) {
@@ -71,4 +143,75 @@ bool nal_chk3(const char *buf, const unsigned int offset) {
         return true;
     }
     return false;
+}
+
+// Looks for 00 00 01 among the first `size` positions of p, given that two
+// more bytes past them are readable. Any start code has a zero at an odd
+// offset, so only those need a closer look; 00 00 03 never matches.
+static inline const unsigned char *nal_match_block(
+    const unsigned char *p, size_t size) {
+    for (size_t k = 1; k < size; k += 2) {
+        if (p[k]) continue;
+        if (!p[k - 1] && p[k + 1] == 1) return p + k - 1;
+        if (!p[k + 1] && p[k + 2] == 1) return p + k;
+    }
+    return NULL;
+}
+
+static inline bool nal_has_zero(uintptr_t v) {
+    const uintptr_t ones = (uintptr_t)-1 / 0xFF;
+    return ((v - ones) & ~v & (ones << 7)) != 0;
+}
+
+// Returns the offset of the next Annex-B start code in buf[pos, len), the
+// leading zero of a 4-byte code included, or len if there is none. The code
+// length (3 or 4) goes to *sc_len when given.
+uint32_t nal_find_start(const unsigned char *buf, uint32_t pos, uint32_t len,
+    unsigned char *sc_len) {
+    const unsigned char *p = buf + pos, *end = buf + len, *hit = NULL;
+
+    if (pos >= len || len - pos < 3) return len;
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+    const uint8x16_t zero = vdupq_n_u8(0);
+    for (; end - p >= 16 + 2 && !hit; p += 16) {
+        uint8x16_t z = vceqq_u8(vld1q_u8(p), zero);
+#if defined(__aarch64__)
+        if (vmaxvq_u8(z))
+#else
+        uint8x8_t m = vorr_u8(vget_low_u8(z), vget_high_u8(z));
+        m = vpmax_u8(m, m);
+        m = vpmax_u8(m, m);
+        m = vpmax_u8(m, m);
+        if (vget_lane_u8(m, 0))
+#endif
+            hit = nal_match_block(p, 16);
+    }
+    if (hit) goto found;
+#endif
+
+    // Aligned word loads only, as MIPS and older ARM cores trap or crawl
+    // on unaligned ones
+    for (; ((uintptr_t)p & (sizeof(uintptr_t) - 1)) && end - p >= 3; p++)
+        if (!p[0] && !p[1] && p[2] == 1) { hit = p; goto found; }
+
+    for (; end - p >= (ptrdiff_t)sizeof(uintptr_t) + 2; p += sizeof(uintptr_t)) {
+        uintptr_t word;
+        memcpy(&word, p, sizeof(word));
+        if (nal_has_zero(word) && (hit = nal_match_block(p, sizeof(word))))
+            goto found;
+    }
+
+    for (; end - p >= 3; p++)
+        if (!p[0] && !p[1] && p[2] == 1) { hit = p; goto found; }
+
+    return len;
+
+found:
+    if (hit > buf + pos && !hit[-1]) {
+        if (sc_len) *sc_len = 4;
+        return hit - 1 - buf;
+    }
+    if (sc_len) *sc_len = 3;
+    return hit - buf;
 }
\ No newline at end of file
@@ -49,6 +49,29 @@ struct NAL {
     enum NalUnitType unit_type;
 };
 
+#define NAL_PARAMSET_MAX 512
+
+struct NalParamSet {
+    uint16_t length;
+    uint32_t hash;
+    char data[NAL_PARAMSET_MAX];
+};
+
+// Last VPS/SPS/PPS seen on a channel; generation moves whenever one of them
+// actually changes, so consumers only rebuild what depends on them then.
+// oversize holds the length of the last set too large to be kept, if any
+struct NalParamSets {
+    char isH265;
+    uint32_t generation;
+    uint32_t oversize;
+    struct NalParamSet vps, sps, pps;
+};
+
 void nal_parse_header(struct NAL *nal, const char first_byte);
+bool nal_paramset_update(struct NalParamSets *ps, const char *nal_data,
+    const uint32_t nal_len, char isH265);
+bool nal_paramset_complete(const struct NalParamSets *ps);
 bool nal_chk4(const char *buf, const uint32_t offset);
-bool nal_chk3(const char *buf, const uint32_t offset);
\ No newline at end of file
+bool nal_chk3(const char *buf, const uint32_t offset);
+uint32_t nal_find_start(const unsigned char *buf, uint32_t pos, uint32_t len,
+    unsigned char *sc_len);
\ No newline at end of file
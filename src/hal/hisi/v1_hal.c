@@ -592,6 +592,31 @@ void v1_video_request_idr(char index)
     v1_venc.fnRequestIdr(index, 1);
 }
 
+int v1_video_set_bitrate(char index, unsigned int bitrate)
+{
+    int ret;
+    v1_venc_chn channel;
+
+    if (ret = v1_venc.fnGetChannelConfig(index, &channel))
+        return ret;
+
+    switch (channel.rate.mode) {
+        case V1_VENC_RATEMODE_H264CBR:
+        case V1_VENC_RATEMODE_H264CBRv2:
+            channel.rate.h264Cbr.bitrate = bitrate; break;
+        case V1_VENC_RATEMODE_H264VBR:
+        case V1_VENC_RATEMODE_H264VBRv2:
+            channel.rate.h264Vbr.maxBitrate = bitrate; break;
+        case V1_VENC_RATEMODE_MJPGCBR:
+            channel.rate.mjpgCbr.bitrate = bitrate; break;
+        case V1_VENC_RATEMODE_MJPGVBR:
+            channel.rate.mjpgVbr.maxBitrate = bitrate; break;
+        default: return EXIT_FAILURE;
+    }
+
+    return v1_venc.fnSetChannelConfig(index, &channel);
+}
+
 int v1_video_snapshot_grab(char index, hal_jpegdata *jpeg)
 {
     int ret;
@@ -653,6 +653,41 @@ void v3_video_request_idr(char index)
     v3_venc.fnRequestIdr(index, 1);
 }
 
+int v3_video_set_bitrate(char index, unsigned int bitrate)
+{
+    int ret;
+    v3_venc_chn channel;
+
+    if (ret = v3_venc.fnGetChannelConfig(index, &channel))
+        return ret;
+
+    switch (channel.rate.mode) {
+        case V3_VENC_RATEMODE_H264CBR:
+            channel.rate.h264Cbr.bitrate = bitrate; break;
+        case V3_VENC_RATEMODE_H264VBR:
+            channel.rate.h264Vbr.maxBitrate = bitrate; break;
+        case V3_VENC_RATEMODE_H264AVBR:
+            channel.rate.h264Avbr.bitrate = bitrate; break;
+        case V3_VENC_RATEMODE_H264QVBR:
+            channel.rate.h264Qvbr.bitrate = bitrate; break;
+        case V3_VENC_RATEMODE_MJPGCBR:
+            channel.rate.mjpgCbr.bitrate = bitrate; break;
+        case V3_VENC_RATEMODE_MJPGVBR:
+            channel.rate.mjpgVbr.maxBitrate = bitrate; break;
+        case V3_VENC_RATEMODE_H265CBR:
+            channel.rate.h265Cbr.bitrate = bitrate; break;
+        case V3_VENC_RATEMODE_H265VBR:
+            channel.rate.h265Vbr.maxBitrate = bitrate; break;
+        case V3_VENC_RATEMODE_H265AVBR:
+            channel.rate.h265Avbr.bitrate = bitrate; break;
+        case V3_VENC_RATEMODE_H265QVBR:
+            channel.rate.h265Qvbr.bitrate = bitrate; break;
+        default: return EXIT_FAILURE;
+    }
+
+    return v3_venc.fnSetChannelConfig(index, &channel);
+}
+
 int v3_video_snapshot_grab(char index, hal_jpegdata *jpeg)
 {
     int ret;
@@ -745,6 +745,41 @@ void v4_video_request_idr(char index)
     v4_venc.fnRequestIdr(index, 1);
 }
 
+int v4_video_set_bitrate(char index, unsigned int bitrate)
+{
+    int ret;
+    v4_venc_chn channel;
+
+    if (ret = v4_venc.fnGetChannelConfig(index, &channel))
+        return ret;
+
+    switch (channel.rate.mode) {
+        case V4_VENC_RATEMODE_H264CBR:
+            channel.rate.h264Cbr.maxBitrate = bitrate; break;
+        case V4_VENC_RATEMODE_H264VBR:
+            channel.rate.h264Vbr.maxBitrate = bitrate; break;
+        case V4_VENC_RATEMODE_H264AVBR:
+            channel.rate.h264Avbr.maxBitrate = bitrate; break;
+        case V4_VENC_RATEMODE_H264QVBR:
+            channel.rate.h264Qvbr.maxBitrate = bitrate; break;
+        case V4_VENC_RATEMODE_MJPGCBR:
+            channel.rate.mjpgCbr.maxBitrate = bitrate; break;
+        case V4_VENC_RATEMODE_MJPGVBR:
+            channel.rate.mjpgVbr.maxBitrate = bitrate; break;
+        case V4_VENC_RATEMODE_H265CBR:
+            channel.rate.h265Cbr.maxBitrate = bitrate; break;
+        case V4_VENC_RATEMODE_H265VBR:
+            channel.rate.h265Vbr.maxBitrate = bitrate; break;
+        case V4_VENC_RATEMODE_H265AVBR:
+            channel.rate.h265Avbr.maxBitrate = bitrate; break;
+        case V4_VENC_RATEMODE_H265QVBR:
+            channel.rate.h265Qvbr.maxBitrate = bitrate; break;
+        default: return EXIT_FAILURE;
+    }
+
+    return v4_venc.fnSetChannelConfig(index, &channel);
+}
+
 int v4_video_snapshot_grab(char index, hal_jpegdata *jpeg)
 {
     int ret;
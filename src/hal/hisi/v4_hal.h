@@ -55,6 +55,7 @@ int v4_video_create(char index, hal_vidconfig *config);
 int v4_video_destroy(char index);
 int v4_video_destroy_all(void);
 void v4_video_request_idr(char index);
+int v4_video_set_bitrate(char index, unsigned int bitrate);
 int v4_video_snapshot_grab(char index, hal_jpegdata *jpeg);
 void *v4_video_thread(void);
 
@@ -51,6 +51,7 @@ int cvi_video_create(char index, hal_vidconfig *config);
 int cvi_video_destroy(char index);
 int cvi_video_destroy_all(void);
 void cvi_video_request_idr(char index);
+int cvi_video_set_bitrate(char index, unsigned int bitrate);
 int cvi_video_snapshot_grab(char index, hal_jpegdata *jpeg);
 void *cvi_video_thread(void);
 
@@ -613,6 +613,41 @@ void rk_video_request_idr(char index)
     rk_venc.fnRequestIdr(index, 1);
 }
 
+int rk_video_set_bitrate(char index, unsigned int bitrate)
+{
+    int ret;
+    rk_venc_chn channel;
+
+    if (ret = rk_venc.fnGetChannelConfig(index, &channel))
+        return ret;
+
+    switch (channel.rate.mode) {
+        case RK_VENC_RATEMODE_H264CBR:
+            channel.rate.h264Cbr.bitrate = bitrate; break;
+        case RK_VENC_RATEMODE_H264VBR:
+        case RK_VENC_RATEMODE_H264AVBR:
+            channel.rate.h264Vbr.bitrate = channel.rate.h264Vbr.maxBitrate = bitrate;
+            channel.rate.h264Vbr.minBitrate = MIN(channel.rate.h264Vbr.minBitrate, bitrate);
+            break;
+        case RK_VENC_RATEMODE_MJPGCBR:
+            channel.rate.mjpgCbr.bitrate = bitrate; break;
+        case RK_VENC_RATEMODE_MJPGVBR:
+            channel.rate.mjpgVbr.bitrate = channel.rate.mjpgVbr.maxBitrate = bitrate;
+            channel.rate.mjpgVbr.minBitrate = MIN(channel.rate.mjpgVbr.minBitrate, bitrate);
+            break;
+        case RK_VENC_RATEMODE_H265CBR:
+            channel.rate.h265Cbr.bitrate = bitrate; break;
+        case RK_VENC_RATEMODE_H265VBR:
+        case RK_VENC_RATEMODE_H265AVBR:
+            channel.rate.h265Vbr.bitrate = channel.rate.h265Vbr.maxBitrate = bitrate;
+            channel.rate.h265Vbr.minBitrate = MIN(channel.rate.h265Vbr.minBitrate, bitrate);
+            break;
+        default: return EXIT_FAILURE;
+    }
+
+    return rk_venc.fnSetChannelConfig(index, &channel);
+}
+
 int rk_video_snapshot_grab(char index, hal_jpegdata *jpeg)
 {
     int ret;
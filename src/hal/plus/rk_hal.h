@@ -49,6 +49,7 @@ int rk_video_create(char index, hal_vidconfig *config);
 int rk_video_destroy(char index);
 int rk_video_destroy_all(void);
 void rk_video_request_idr(char index);
+int rk_video_set_bitrate(char index, unsigned int bitrate);
 int rk_video_snapshot_grab(char index, hal_jpegdata *jpeg);
 void *rk_video_thread(void);
 
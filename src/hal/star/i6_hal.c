@@ -657,6 +657,57 @@ void i6_video_request_idr(char index)
     i6_venc.fnRequestIdr(index, 1);
 }
 
+int i6_video_set_bitrate(char index, unsigned int bitrate)
+{
+    int ret;
+    i6_venc_chn channel;
+
+    if (ret = i6_venc.fnGetChannelConfig(index, &channel))
+        return ret;
+
+    bitrate <<= 10;
+    if (series == 0xEF)
+        switch (channel.rate.mode) {
+            case I6OG_VENC_RATEMODE_H264CBR:
+                channel.rate.h264Cbr.bitrate = bitrate; break;
+            case I6OG_VENC_RATEMODE_H264VBR:
+                channel.rate.h264Vbr.maxBitrate = bitrate; break;
+            case I6OG_VENC_RATEMODE_H264AVBR:
+                channel.rate.h264Avbr.maxBitrate = bitrate; break;
+            case I6OG_VENC_RATEMODE_MJPGCBR:
+                channel.rate.mjpgCbr.bitrate = bitrate; break;
+            case I6OG_VENC_RATEMODE_H265CBR:
+                channel.rate.h265Cbr.bitrate = bitrate; break;
+            case I6OG_VENC_RATEMODE_H265VBR:
+                channel.rate.h265Vbr.maxBitrate = bitrate; break;
+            case I6OG_VENC_RATEMODE_H265AVBR:
+                channel.rate.h265Avbr.maxBitrate = bitrate; break;
+            default: return EXIT_FAILURE;
+        }
+    else
+        switch (channel.rate.mode) {
+            case I6_VENC_RATEMODE_H264CBR:
+                channel.rate.h264Cbr.bitrate = bitrate; break;
+            case I6_VENC_RATEMODE_H264VBR:
+                channel.rate.h264Vbr.maxBitrate = bitrate; break;
+            case I6_VENC_RATEMODE_H264ABR:
+                channel.rate.h264Abr.avgBitrate = bitrate; break;
+            case I6_VENC_RATEMODE_H264AVBR:
+                channel.rate.h264Avbr.maxBitrate = bitrate; break;
+            case I6_VENC_RATEMODE_MJPGCBR:
+                channel.rate.mjpgCbr.bitrate = bitrate; break;
+            case I6_VENC_RATEMODE_H265CBR:
+                channel.rate.h265Cbr.bitrate = bitrate; break;
+            case I6_VENC_RATEMODE_H265VBR:
+                channel.rate.h265Vbr.maxBitrate = bitrate; break;
+            case I6_VENC_RATEMODE_H265AVBR:
+                channel.rate.h265Avbr.maxBitrate = bitrate; break;
+            default: return EXIT_FAILURE;
+        }
+
+    return i6_venc.fnSetChannelConfig(index, &channel);
+}
+
 int i6_video_snapshot_grab(char index, char quality, hal_jpegdata *jpeg)
 {
     int ret;
@@ -849,33 +900,24 @@ void *i6_video_thread(void)
                             outPack[j].naluCnt = pack->packNum;
                             if (series == 0xEF) {
                                 signed char n = 0;
-                                switch (i6_state[i].payload) {
-                                    case HAL_VIDCODEC_H264:
-                                        for (unsigned int p = 0; p < pack->length - 4; p++) {
-                                            if (outPack[j].data[p] || outPack[j].data[p + 1] ||
-                                                outPack[j].data[p + 2] || outPack[j].data[p + 3] != 1) continue;
-                                            outPack[0].nalu[n].type = outPack[j].data[p + 4] & 0x1F;
-                                            outPack[0].nalu[n++].offset = p;
-                                            if (n == (outPack[j].naluCnt)) break;
-                                        }
-                                        break;
-                                    case HAL_VIDCODEC_H265:
-                                        for (unsigned int p = 0; p < pack->length - 4; p++) {
-                                            if (outPack[j].data[p] || outPack[j].data[p + 1] ||
-                                                outPack[j].data[p + 2] || outPack[j].data[p + 3] != 1) continue;
-                                            outPack[0].nalu[n].type = (outPack[j].data[p + 4] & 0x7E) >> 1;
-                                            outPack[0].nalu[n++].offset = p;
-                                            if (n == (outPack[j].naluCnt)) break;
-                                        }
-                                        break;
+                                unsigned char sc = 0;
+                                for (unsigned int p = 0; n < outPack[j].naluCnt && 
+                                    n < sizeof(outPack[j].nalu) / sizeof(*outPack[j].nalu) &&
+                                    (p = nal_find_start(outPack[j].data, p, pack->length, &sc)) + sc < pack->length;
+                                    p += sc) {
+                                    // Consumers skip a 4-byte start code, so
+                                    // a 3-byte one stays inside the NAL before
+                                    if (sc != 4) continue;
+                                    outPack[j].nalu[n].type = i6_state[i].payload == HAL_VIDCODEC_H265 ?
+                                        (outPack[j].data[p + sc] & 0x7E) >> 1 : outPack[j].data[p + sc] & 0x1F;
+                                    outPack[j].nalu[n++].offset = p;
                                 }
 
-                                outPack[0].naluCnt = n;
-                                outPack[0].nalu[n].offset = pack->length;
-                                for (n = 0; n < outPack[0].naluCnt; n++)
-                                    outPack[0].nalu[n].length = 
-                                        outPack[0].nalu[n + 1].offset -
-                                        outPack[0].nalu[n].offset;
+                                outPack[j].naluCnt = n;
+                                for (n = 0; n < outPack[j].naluCnt; n++)
+                                    outPack[j].nalu[n].length = 
+                                        (n + 1 < outPack[j].naluCnt ? outPack[j].nalu[n + 1].offset :
+                                        pack->length) - outPack[j].nalu[n].offset;
                             } else switch (i6_state[i].payload) {
                                 case HAL_VIDCODEC_H264:
                                     for (char k = 0; k < outPack[j].naluCnt; k++) {
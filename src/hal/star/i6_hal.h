@@ -12,6 +12,7 @@
 #include "i6_vpe.h"
 
 #include "../support.h"
+#include "../../fmt/nal.h"
 
 #include <sys/select.h>
 #include <unistd.h>
@@ -49,6 +50,7 @@ int i6_video_create(char index, hal_vidconfig *config);
 int i6_video_destroy(char index);
 int i6_video_destroy_all(void);
 void i6_video_request_idr(char index);
+int i6_video_set_bitrate(char index, unsigned int bitrate);
 int i6_video_snapshot_grab(char index, char quality, hal_jpegdata *jpeg);
 void *i6_video_thread(void);
 
@@ -745,6 +745,63 @@ void i6c_video_request_idr(char index)
     i6c_venc.fnRequestIdr(I6C_VENC_DEV_H26X_0, index, 1);
 }
 
+int i6c_video_set_bitrate(char index, unsigned int bitrate)
+{
+    int ret;
+    i6c_venc_chn channel;
+
+    if (ret = i6c_venc.fnGetChannelConfig(_i6c_venc_dev[index], index, &channel))
+        return ret;
+
+    bitrate <<= 10;
+    if (i6c_ubrmode)
+        switch (channel.rate.mode) {
+            case I6C_VENC_RATEMODE_UBR_H264CBR:
+                channel.rate.h264Cbr.bitrate = bitrate; break;
+            case I6C_VENC_RATEMODE_UBR_H264VBR:
+                channel.rate.h264Vbr.maxBitrate = bitrate; break;
+            case I6C_VENC_RATEMODE_UBR_H264ABR:
+                channel.rate.h264Abr.avgBitrate = bitrate; break;
+            case I6C_VENC_RATEMODE_UBR_H264AVBR:
+                channel.rate.h264Avbr.maxBitrate = bitrate; break;
+            case I6C_VENC_RATEMODE_UBR_MJPGCBR:
+                channel.rate.mjpgCbr.bitrate = bitrate; break;
+            case I6C_VENC_RATEMODE_UBR_MJPGVBR:
+                channel.rate.mjpgVbr.bitrate = bitrate; break;
+            case I6C_VENC_RATEMODE_UBR_H265CBR:
+                channel.rate.h265Cbr.bitrate = bitrate; break;
+            case I6C_VENC_RATEMODE_UBR_H265VBR:
+                channel.rate.h265Vbr.maxBitrate = bitrate; break;
+            case I6C_VENC_RATEMODE_UBR_H265AVBR:
+                channel.rate.h265Avbr.maxBitrate = bitrate; break;
+            default: return EXIT_FAILURE;
+        }
+    else
+        switch (channel.rate.mode) {
+            case I6C_VENC_RATEMODE_H264CBR:
+                channel.rate.h264Cbr.bitrate = bitrate; break;
+            case I6C_VENC_RATEMODE_H264VBR:
+                channel.rate.h264Vbr.maxBitrate = bitrate; break;
+            case I6C_VENC_RATEMODE_H264ABR:
+                channel.rate.h264Abr.avgBitrate = bitrate; break;
+            case I6C_VENC_RATEMODE_H264AVBR:
+                channel.rate.h264Avbr.maxBitrate = bitrate; break;
+            case I6C_VENC_RATEMODE_MJPGCBR:
+                channel.rate.mjpgCbr.bitrate = bitrate; break;
+            case I6C_VENC_RATEMODE_MJPGVBR:
+                channel.rate.mjpgVbr.bitrate = bitrate; break;
+            case I6C_VENC_RATEMODE_H265CBR:
+                channel.rate.h265Cbr.bitrate = bitrate; break;
+            case I6C_VENC_RATEMODE_H265VBR:
+                channel.rate.h265Vbr.maxBitrate = bitrate; break;
+            case I6C_VENC_RATEMODE_H265AVBR:
+                channel.rate.h265Avbr.maxBitrate = bitrate; break;
+            default: return EXIT_FAILURE;
+        }
+
+    return i6c_venc.fnSetChannelConfig(_i6c_venc_dev[index], index, &channel);
+}
+
 int i6c_video_snapshot_grab(char index, char quality, hal_jpegdata *jpeg)
 {
     int ret;
@@ -47,6 +47,7 @@ int i6c_video_create(char index, hal_vidconfig *config);
 int i6c_video_destroy(char index);
 int i6c_video_destroy_all(void);
 void i6c_video_request_idr(char index);
+int i6c_video_set_bitrate(char index, unsigned int bitrate);
 int i6c_video_snapshot_grab(char index, char quality, hal_jpegdata *jpeg);
 void *i6c_video_thread(void);
 
@@ -692,6 +692,38 @@ void m6_video_request_idr(char index)
     m6_venc.fnRequestIdr(M6_VENC_DEV_H26X_0, index, 1);
 }
 
+int m6_video_set_bitrate(char index, unsigned int bitrate)
+{
+    int ret;
+    m6_venc_chn channel;
+
+    if (ret = m6_venc.fnGetChannelConfig(_m6_venc_dev[index], index, &channel))
+        return ret;
+
+    bitrate <<= 10;
+    switch (channel.rate.mode) {
+        case M6_VENC_RATEMODE_H264CBR:
+            channel.rate.h264Cbr.bitrate = bitrate; break;
+        case M6_VENC_RATEMODE_H264VBR:
+            channel.rate.h264Vbr.maxBitrate = bitrate; break;
+        case M6_VENC_RATEMODE_H264ABR:
+            channel.rate.h264Abr.avgBitrate = bitrate; break;
+        case M6_VENC_RATEMODE_H264AVBR:
+            channel.rate.h264Avbr.maxBitrate = bitrate; break;
+        case M6_VENC_RATEMODE_MJPGCBR:
+            channel.rate.mjpgCbr.bitrate = bitrate; break;
+        case M6_VENC_RATEMODE_H265CBR:
+            channel.rate.h265Cbr.bitrate = bitrate; break;
+        case M6_VENC_RATEMODE_H265VBR:
+            channel.rate.h265Vbr.maxBitrate = bitrate; break;
+        case M6_VENC_RATEMODE_H265AVBR:
+            channel.rate.h265Avbr.maxBitrate = bitrate; break;
+        default: return EXIT_FAILURE;
+    }
+
+    return m6_venc.fnSetChannelConfig(_m6_venc_dev[index], index, &channel);
+}
+
 int m6_video_snapshot_grab(char index, char quality, hal_jpegdata *jpeg)
 {
     int ret;
@@ -45,6 +45,7 @@ int m6_video_create(char index, hal_vidconfig *config);
 int m6_video_destroy(char index);
 int m6_video_destroy_all(void);
 void m6_video_request_idr(char index);
+int m6_video_set_bitrate(char index, unsigned int bitrate);
 int m6_video_snapshot_grab(char index, char quality, hal_jpegdata *jpeg);
 void *m6_video_thread(void);
 
@@ -43,6 +43,8 @@ typedef enum {
 
 typedef enum {
     HAL_AUDCODEC_UNSPEC,
+    HAL_AUDCODEC_G711A,
+    HAL_AUDCODEC_G711U,
     HAL_AUDCODEC_MP3 = 0x69,
     HAL_AUDCODEC_NONE = 0xFF
 } hal_audcodec;
@@ -1,3 +1,4 @@
+#include "abr.h"
 #include "app_config.h"
 #include "hal/macros.h"
 #include "http_post.h"
@@ -6,6 +7,7 @@
 #include "night.h"
 #include "rtsp/rtsp_server.h"
 #include "server.h"
+#include "timeshift.h"
 #include "watchdog.h"
 
 #include <getopt.h>
@@ -75,17 +77,49 @@ int main(int argc, char *argv[]) {
                 HAL_INFO("rtsp", "Authentication enabled!\n");
             }
         }
+        if (app_config.rtsp_multicast_group[0]) {
+            if (rtsp_configure_multicast(rtspHandle, app_config.rtsp_multicast_group,
+                app_config.rtsp_multicast_port, app_config.rtsp_multicast_ttl))
+                HAL_DANGER("rtsp", "Multicast group %s is unusable!\n",
+                    app_config.rtsp_multicast_group);
+            else
+                HAL_INFO("rtsp", "Multicast viewers join %s:%d\n",
+                    app_config.rtsp_multicast_group, app_config.rtsp_multicast_port);
+        }
+        if (app_config.rtsp_pace_burst &&
+            rtsp_configure_pacing(rtspHandle, app_config.rtsp_pace_burst))
+            HAL_DANGER("rtsp", "Pacing needs a burst factor of 100%% or more, "
+                "sending unpaced!\n");
+        if (app_config.rtsp_fec_ratio &&
+            rtsp_configure_fec(rtspHandle, app_config.rtsp_fec_ratio))
+            HAL_DANGER("rtsp", "FEC ratio %d%% is out of range, "
+                "sending without parity!\n", app_config.rtsp_fec_ratio);
+        if (app_config.rtsp_nack_budget &&
+            rtsp_configure_nack(rtspHandle, app_config.rtsp_nack_history,
+                app_config.rtsp_nack_budget))
+            HAL_DANGER("rtsp", "NACK budget %d%% is out of range, "
+                "losses will not be resent!\n", app_config.rtsp_nack_budget);
+        if (app_config.rtsp_gop_cache &&
+            rtsp_configure_gop_cache(rtspHandle, app_config.rtsp_gop_cache))
+            HAL_DANGER("rtsp", "Can't keep a GOP cache, new viewers "
+                "will wait for an IDR!\n");
     }
 
     if (app_config.stream_enable)
         start_streaming();
 
+    if (app_config.mp4_enable && app_config.mp4_timeshift_size)
+        timeshift_init(app_config.mp4_timeshift_size * 1024);
+
     if (start_sdk())
         HAL_ERROR("hal", "Failed to start SDK!\n");
 
     if (app_config.night_mode_enable)
         enable_night();
 
+    if (app_config.mp4_enable && app_config.mp4_abr_enable)
+        enable_abr();
+
     if (app_config.http_post_enable)
         start_http_post_send();
 
@@ -103,6 +137,9 @@ int main(int argc, char *argv[]) {
     if (app_config.record_enable && app_config.record_continuous)
         record_stop();
 
+    if (app_config.mp4_abr_enable)
+        disable_abr();
+
     if (app_config.rtsp_enable) {
         rtsp_finish(rtspHandle);
         HAL_INFO("rtsp", "Server has closed!\n");
@@ -116,6 +153,12 @@ int main(int argc, char *argv[]) {
 
     stop_sdk();
 
+    if (app_config.timelapse_enable)
+        timelapse_stop();
+
+    if (app_config.mp4_enable && app_config.mp4_timeshift_size)
+        timeshift_deinit();
+
     if (app_config.stream_enable)
         stop_streaming();
 
@@ -1,8 +1,12 @@
 #include "media.h"
 
 char audioOn = 0, udpOn = 0;
+// Set while the recording in progress is one motion started
+char motionRecord = 0;
 pthread_mutex_t aencMtx, chnMtx, mp4Mtx;
 pthread_t aencPid = 0, audPid = 0, ispPid = 0, vidPid = 0;
+struct NalParamSets *chnParams = NULL;
+rtsp_mount_handle *chnMounts = NULL;
 
 struct BitBuf mp3Buf;
 shine_config_t mp3Cnf;
@@ -10,12 +14,44 @@ shine_t mp3Enc;
 unsigned int pcmPos;
 unsigned int pcmSamp;
 short pcmSrc[SHINE_MAX_SAMPLES];
+unsigned long long g711Samples;
+
+// G.711 costs next to nothing, so the capture thread sends it on right
+// away instead of queueing it for the encoding thread
+static void save_g711_stream(hal_audframe *frame) {
+    static unsigned char g711Buf[1024];
+    char alaw = app_config.audio_codec == HAL_AUDCODEC_G711A;
+    unsigned int count = frame->length[0] / 2;
+    short *pcm = (short*)frame->data[0];
+
+    while (count) {
+        unsigned int chunk = MIN(count, sizeof(g711Buf));
+        if (alaw)
+            g711_encode_alaw(pcm, g711Buf, chunk);
+        else
+            g711_encode_ulaw(pcm, g711Buf, chunk);
+
+        send_g711_to_client(g711Buf, chunk);
+
+        if (app_config.rtsp_enable)
+            for (int i = 0; chnMounts && i < chnCount; i++)
+                if (chnMounts[i])
+                    rtp_send_g711(chnMounts[i], g711Buf, chunk, alaw,
+                        g711Samples * 1000000 / app_config.audio_srate);
+        g711Samples += chunk;
+
+        pcm += chunk;
+        count -= chunk;
+    }
+}
 
 void *aenc_thread(void) {
     const uint32_t mp3FrmSize = 
         (app_config.audio_srate >= 32000 ? 144 : 72) *
         (app_config.audio_bitrate * 1000) / 
         app_config.audio_srate;
+    const uint32_t mp3FrmSamples = app_config.audio_srate >= 32000 ? 1152 : 576;
+    unsigned long long mp3Samples = 0;
     
     while (keepRunning && audioOn) {
         pthread_mutex_lock(&aencMtx);
@@ -31,8 +67,14 @@ void *aenc_thread(void) {
         mp4_ingest_audio(mp3Buf.buf, mp3FrmSize);
         pthread_mutex_unlock(&mp4Mtx);
 
+        // Audio time follows the samples actually encoded, not the
+        // moment this thread got around to sending them
         if (app_config.rtsp_enable)
-            rtp_send_mp3(rtspHandle, mp3Buf.buf, mp3FrmSize);
+            for (int i = 0; chnMounts && i < chnCount; i++)
+                if (chnMounts[i])
+                    rtp_send_mp3(chnMounts[i], mp3Buf.buf, mp3FrmSize,
+                        mp3Samples * 1000000 / app_config.audio_srate);
+        mp3Samples += mp3FrmSamples;
 
         mp3Buf.offset -= mp3FrmSize;
         if (mp3Buf.offset);
@@ -56,6 +98,11 @@ int save_audio_stream(hal_audframe *frame) {
 
     send_pcm_to_client(frame);
 
+    if (app_config.audio_codec != HAL_AUDCODEC_MP3) {
+        save_g711_stream(frame);
+        return ret;
+    }
+
     unsigned int pcmLen = frame->length[0] / 2;
     unsigned int pcmOrig = pcmLen;
     short *pcmPack = (short*)frame->data[0];
@@ -85,24 +132,67 @@ int save_video_stream(char index, hal_vidstream *stream) {
         {
             char isH265 = chnState[index].payload == HAL_VIDCODEC_H265 ? 1 : 0;
 
+            if (app_config.motion_enable) {
+                int change = motion_feed(stream, isH265);
+                if (change && app_config.motion_record && app_config.record_enable &&
+                    !app_config.record_continuous) {
+                    // A recording started by hand is left to whoever started it
+                    pthread_mutex_lock(&mp4Mtx);
+                    if (change > 0 && !recordOn) {
+                        record_start();
+                        motionRecord = recordOn;
+                        request_idr();
+                    } else if (change < 0 && motionRecord) {
+                        record_stop();
+                        motionRecord = 0;
+                    }
+                    pthread_mutex_unlock(&mp4Mtx);
+                }
+            }
+
+            struct rtp_nal_t nals[RTP_MAXIMUM_NALS];
+            int count = 0;
+            unsigned int oversize = chnParams[index].oversize;
+
+            for (int i = 0; i < stream->count; i++) {
+                hal_vidpack *pack = &stream->pack[i];
+                unsigned char *pack_data = pack->data + pack->offset;
+
+                for (int j = 0; j < pack->naluCnt && count < RTP_MAXIMUM_NALS; j++) {
+                    if (pack->nalu[j].length <= 4) continue;
+                    nals[count].data = pack_data + pack->nalu[j].offset + 4;
+                    nals[count].size = pack->nalu[j].length - 4;
+                    nals[count].type = pack->nalu[j].type;
+                    nal_paramset_update(&chnParams[index], (char *)nals[count].data,
+                        nals[count].size, isH265);
+                    count++;
+                }
+            }
+
+            if (!oversize && chnParams[index].oversize)
+                HAL_WARNING("media", "Channel %d has a %u bytes parameter set, "
+                    "only up to %d are kept!\n", index, chnParams[index].oversize,
+                    NAL_PARAMSET_MAX);
+
             if (app_config.mp4_enable) {
                 pthread_mutex_lock(&mp4Mtx);
+                mp4_set_params(&chnParams[index]);
                 send_mp4_to_client(index, stream, isH265);
                 if (recordOn) send_mp4_to_record(stream, isH265);
+                if (app_config.timelapse_enable) send_mp4_to_timelapse(stream);
                 pthread_mutex_unlock(&mp4Mtx);
                 
                 send_h26x_to_client(index, stream);
             }
-            if (app_config.rtsp_enable)
-                for (int i = 0; i < stream->count; i++)
-                    rtp_send_h26x(rtspHandle, stream->pack[i].data + stream->pack[i].offset, 
-                        stream->pack[i].length - stream->pack[i].offset, isH265);
-
-            if (app_config.stream_enable)
-                for (int i = 0; i < stream->count; i++)
-                    udp_stream_send_nal(stream->pack[i].data + stream->pack[i].offset, 
-                        stream->pack[i].length - stream->pack[i].offset, 
-                        stream->pack[i].nalu[0].type == NalUnitType_CodedSliceIdr, isH265);
+            if (app_config.rtsp_enable && chnMounts[index]) {
+                rtsp_set_params(chnMounts[index], &chnParams[index]);
+                rtp_send_h26x_nals(chnMounts[index], nals, count, isH265,
+                    stream->count ? stream->pack[0].timestamp : 0);
+            }
+
+            if (app_config.stream_enable && udpOn)
+                udp_stream_send_nals(nals, count, isH265,
+                    stream->count ? stream->pack[0].timestamp : 0);
             
             break;
         }
@@ -121,6 +211,9 @@ int save_video_stream(char index, hal_vidstream *stream) {
                     buf_size += data->length - data->offset;
                 }
                 send_mjpeg_to_client(index, mjpeg_buf, buf_size);
+                if (app_config.rtsp_enable && chnMounts[index])
+                    rtp_send_jpeg(chnMounts[index], (unsigned char *)mjpeg_buf, buf_size,
+                        stream->count ? stream->pack[0].timestamp : 0);
             }
             break;
         case HAL_VIDCODEC_JPG:
@@ -181,20 +274,23 @@ int start_streaming(void) {
             if (!udpOn) {
                 val = strtol(hostptr, &endptr, 10);
                 if (endptr != hostptr && val >= 224 && val <= 239) {
-                    if (udp_stream_init(app_config.stream_udp_srcport, dst))
+                    if (!udp_stream_init(app_config.stream_udp_srcport, dst))
                         udpOn = 1;
                     else return EXIT_FAILURE;
                 } else {
-                    if (udp_stream_init(app_config.stream_udp_srcport, NULL))
+                    if (!udp_stream_init(app_config.stream_udp_srcport, NULL))
                         udpOn = 1;
                     else return EXIT_FAILURE;
                 }
+                udp_stream_set_bitrate(app_config.mp4_bitrate);
             }
             
             if (udp_stream_add_client(dst, port) != -1)
                 HAL_INFO("media", "Starting streaming to %s...\n", app_config.stream_dests[i]);
         }
     }
+
+    return ret;
 }
 
 void stop_streaming(void) {
@@ -236,6 +332,41 @@ void request_idr(void) {
     pthread_mutex_unlock(&chnMtx);
 }
 
+int set_bitrate(unsigned int bitrate) {
+    int ret = EXIT_FAILURE;
+    signed char index = -1;
+    pthread_mutex_lock(&chnMtx);
+    for (int i = 0; i < chnCount; i++) {
+        if (!chnState[i].enable) continue;
+        if (chnState[i].payload != HAL_VIDCODEC_H264 &&
+            chnState[i].payload != HAL_VIDCODEC_H265) continue;
+        index = i;
+        break;
+    }
+    if (index != -1) switch (plat) {
+#if defined(__ARM_PCS_VFP)
+        case HAL_PLATFORM_I6:  ret = i6_video_set_bitrate(index, bitrate); break;
+        case HAL_PLATFORM_I6C: ret = i6c_video_set_bitrate(index, bitrate); break;
+        case HAL_PLATFORM_M6:  ret = m6_video_set_bitrate(index, bitrate); break;
+        case HAL_PLATFORM_RK:  ret = rk_video_set_bitrate(index, bitrate); break;
+#elif defined(__arm__) && !defined(__ARM_PCS_VFP)
+        case HAL_PLATFORM_V1:  ret = v1_video_set_bitrate(index, bitrate); break;
+        case HAL_PLATFORM_V2:  ret = v2_video_set_bitrate(index, bitrate); break;
+        case HAL_PLATFORM_V3:  ret = v3_video_set_bitrate(index, bitrate); break;
+        case HAL_PLATFORM_V4:  ret = v4_video_set_bitrate(index, bitrate); break;
+#elif defined(__riscv) || defined(__riscv__)
+        case HAL_PLATFORM_CVI: ret = cvi_video_set_bitrate(index, bitrate); break;
+#endif
+    }
+    // Paced RTSP receivers follow the encoder wherever it goes
+    if (!ret && app_config.rtsp_enable && chnMounts && chnMounts[index])
+        rtsp_set_bitrate(chnMounts[index], bitrate);
+    if (!ret && udpOn)
+        udp_stream_set_bitrate(bitrate);
+    pthread_mutex_unlock(&chnMtx);
+    return ret;
+}
+
 void set_grayscale(bool active) {
     pthread_mutex_lock(&chnMtx);
     switch (plat) {
@@ -376,9 +507,11 @@ void disable_audio(void) {
 
     audioOn = 0;
 
-    pthread_join(aencPid, NULL);
+    if (aencPid) pthread_join(aencPid, NULL);
+    aencPid = 0;
     pthread_join(audPid, NULL);
-    shine_close(mp3Enc);
+    if (mp3Enc) shine_close(mp3Enc);
+    mp3Enc = NULL;
 
     switch (plat) {
 #if defined(__ARM_PCS_VFP)
@@ -405,6 +538,13 @@ int enable_audio(void) {
 
     if (audioOn) return ret;
 
+    // Both G.711 laws are only defined over telephone band audio
+    if (app_config.audio_codec != HAL_AUDCODEC_MP3 && app_config.audio_srate != 8000) {
+        HAL_DANGER("media", "G.711 is sampled at 8000 Hz, ignoring %d Hz!\n",
+            app_config.audio_srate);
+        app_config.audio_srate = 8000;
+    }
+
     switch (plat) {
 #if defined(__ARM_PCS_VFP)
         case HAL_PLATFORM_I6:  ret = i6_audio_init(app_config.audio_srate, app_config.audio_gain); break;
@@ -427,7 +567,9 @@ int enable_audio(void) {
         HAL_ERROR("media", "Audio initialization failed with %#x!\n%s\n",
             ret, errstr(ret));
 
-    if (shine_check_config(app_config.audio_srate, app_config.audio_bitrate) < 0)
+    if (app_config.audio_codec != HAL_AUDCODEC_MP3)
+        g711Samples = 0;
+    else if (shine_check_config(app_config.audio_srate, app_config.audio_bitrate) < 0)
         HAL_ERROR("media", "MP3 samplerate/bitrate configuration is unsupported!\n");
     else {
         mp3Cnf.mpeg.mode = MONO;
@@ -459,7 +601,7 @@ int enable_audio(void) {
         pthread_attr_destroy(&thread_attr);
     }
 
-    {
+    if (app_config.audio_codec == HAL_AUDCODEC_MP3) {
         pthread_attr_t thread_attr;
         pthread_attr_init(&thread_attr);
         size_t stacksize;
@@ -548,6 +690,18 @@ int enable_mjpeg(void) {
         HAL_ERROR("media", "Binding channel %d failed with %#x!\n%s\n",
             index, ret, errstr(ret));
 
+    // RTP carries JPEG dimensions in 8 pixel blocks on a single byte
+    if (app_config.rtsp_enable) {
+        char path[16];
+        sprintf(path, "/stream=%d", index);
+        if (app_config.mjpeg_width > 2040 || app_config.mjpeg_height > 2040)
+            HAL_DANGER("media", "MJPEG over 2040 pixels can't be served over RTSP!\n");
+        else if (!(chnMounts[index] = rtsp_add_mount(rtspHandle, path)))
+            HAL_DANGER("media", "Channel %d can't be served over RTSP!\n", index);
+        else
+            rtsp_set_bitrate(chnMounts[index], app_config.mjpeg_bitrate);
+    }
+
     return EXIT_SUCCESS;
 }
 
@@ -619,7 +773,8 @@ int enable_mp4(void) {
                 index, ret, errstr(ret));
 
         mp4_set_config(app_config.mp4_width, app_config.mp4_height, app_config.mp4_fps,
-            app_config.audio_enable ? HAL_AUDCODEC_MP3 : HAL_AUDCODEC_UNSPEC, 
+            app_config.audio_enable && app_config.audio_codec == HAL_AUDCODEC_MP3 ?
+                HAL_AUDCODEC_MP3 : HAL_AUDCODEC_UNSPEC, 
             app_config.audio_bitrate, 1, app_config.audio_srate);
     }
 
@@ -627,6 +782,16 @@ int enable_mp4(void) {
         HAL_ERROR("media", "Binding channel %d failed with %#x!\n%s\n",
             index, ret, errstr(ret));
 
+    // The first stream to be mounted also answers the bare server URL
+    if (app_config.rtsp_enable) {
+        char path[16];
+        sprintf(path, "/stream=%d", index);
+        if (!(chnMounts[index] = rtsp_add_mount(rtspHandle, path)))
+            HAL_DANGER("media", "Channel %d can't be served over RTSP!\n", index);
+        else
+            rtsp_set_bitrate(chnMounts[index], app_config.mp4_bitrate);
+    }
+
     return EXIT_SUCCESS;
 }
 
@@ -789,6 +954,14 @@ int start_sdk(void) {
         pthread_attr_destroy(&thread_attr);
     }
 
+    chnParams = calloc(chnCount, sizeof(*chnParams));
+    if (!chnParams)
+        HAL_ERROR("media", "Allocating the parameter set cache failed!\n");
+
+    chnMounts = calloc(chnCount, sizeof(*chnMounts));
+    if (!chnMounts)
+        HAL_ERROR("media", "Allocating the RTSP mount table failed!\n");
+
     if (app_config.mp4_enable && (ret = enable_mp4()))
         HAL_ERROR("media", "MP4 initialization failed with %#x!\n", ret);
 
@@ -883,6 +1056,13 @@ int stop_sdk(void) {
     if (isp_thread)
         pthread_join(ispPid, NULL);
 
+    free(chnParams);
+    chnParams = NULL;
+
+    // The mounts themselves go with the RTSP server
+    free(chnMounts);
+    chnMounts = NULL;
+
     switch (plat) {
 #if defined(__ARM_PCS_VFP)
         case HAL_PLATFORM_I3:  i3_system_deinit(); break;
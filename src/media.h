@@ -10,15 +10,18 @@
 
 #include "app_config.h"
 #include "error.h"
+#include "fmt/g711.h"
 #include "hal/types.h"
 #include "http_post.h"
 #include "lib/shine/layer3.h"
 #include "jpeg.h"
+#include "motion.h"
 #include "rtsp/rtsp_server.h"
 #include "server.h"
 #include "stream.h"
+#include "timelapse.h"
 
-extern char audioOn, recordOn, udpOn;
+extern char audioOn, motionRecord, recordOn, udpOn;
 extern rtsp_handle rtspHandle;
 
 int start_sdk(void);
@@ -28,6 +31,7 @@ int start_streaming(void);
 void stop_streaming(void);
 
 void request_idr(void);
+int set_bitrate(unsigned int bitrate);
 void set_grayscale(bool active);
 int take_next_free_channel(bool mainLoop);
 
@@ -0,0 +1,86 @@
+#include "motion.h"
+
+// Frames needed to settle the baseline, and to confirm an activity
+#define MOTION_WARMUP 30
+#define MOTION_CONFIRM 3
+
+// The baseline is kept in 1/16 byte units to make the averaging precise
+static unsigned int motionBaseline, motionFrames, motionScore, motionAbove;
+static unsigned int motionEvents;
+static time_t motionLastEvent, motionLastSeen;
+static char motionActive;
+
+void motion_reset(void) {
+    motionBaseline = motionFrames = motionScore = motionAbove = 0;
+    motionActive = 0;
+}
+
+void motion_get_status(motion_status *status) {
+    status->active = motionActive;
+    status->score = motionScore;
+    status->baseline = motionBaseline >> 4;
+    status->events = motionEvents;
+    status->lastEvent = motionLastEvent;
+}
+
+// Inter frames of a static scene shrink to almost nothing, so their
+// size against a slow moving average is enough to tell activity apart
+int motion_feed(hal_vidstream *stream, char isH265) {
+    unsigned int size = 0;
+
+    for (unsigned int i = 0; i < stream->count; i++) {
+        hal_vidpack *pack = &stream->pack[i];
+        for (char j = 0; j < pack->naluCnt; j++) {
+            char type = pack->nalu[j].type;
+            if (type == NalUnitType_CodedSliceIdr || type == NalUnitType_CodedSliceAux ||
+                (isH265 && type >= 16 && type <= 21))
+                return 0;
+            if (type == NalUnitType_CodedSliceNonIdr || (isH265 && type == 0))
+                size += pack->nalu[j].length;
+        }
+    }
+    if (!size) return 0;
+
+    if (motionFrames < MOTION_WARMUP) {
+        motionBaseline = motionFrames ?
+            motionBaseline + (((int)(size << 4) - (int)motionBaseline) / (int)(motionFrames + 1)) :
+            size << 4;
+        motionFrames++;
+        return 0;
+    }
+
+    motionScore = (size << 4) * 100 / (motionBaseline ? motionBaseline : 1);
+
+    // Lower sensitivities need a larger surge, and the activity only
+    // ends once the frames have fallen well below the trigger level
+    unsigned int onLevel = 100 + (11 - app_config.motion_sensitivity) * 50;
+    unsigned int offLevel = 100 + (11 - app_config.motion_sensitivity) * 25;
+    time_t now = time(NULL);
+
+    // Lasting changes (lighting, weather) are absorbed much slower
+    // while active so they cannot hold the detector on forever
+    motionBaseline += ((int)(size << 4) - (int)motionBaseline) /
+        (motionActive ? 512 : 32);
+
+    if (motionScore >= onLevel) {
+        if (++motionAbove < MOTION_CONFIRM) return 0;
+        motionLastSeen = now;
+        if (motionActive) return 0;
+        motionActive = 1;
+        motionEvents++;
+        motionLastEvent = now;
+        HAL_INFO("motion", "Activity detected (score %u)!\n", motionScore);
+        return 1;
+    }
+
+    motionAbove = 0;
+    if (motionScore >= offLevel) motionLastSeen = now;
+
+    if (motionActive && now - motionLastSeen >= app_config.motion_hold) {
+        motionActive = 0;
+        HAL_INFO("motion", "Activity has ended!\n");
+        return -1;
+    }
+
+    return 0;
+}
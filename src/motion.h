@@ -0,0 +1,20 @@
+#pragma once
+
+#include <time.h>
+
+#include "app_config.h"
+#include "fmt/nal.h"
+#include "hal/macros.h"
+#include "hal/types.h"
+
+typedef struct {
+    char active;
+    unsigned int score;
+    unsigned int baseline;
+    unsigned int events;
+    time_t lastEvent;
+} motion_status;
+
+int motion_feed(hal_vidstream *stream, char isH265);
+void motion_reset(void);
+void motion_get_status(motion_status *status);
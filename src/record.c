@@ -1,8 +1,22 @@
+#define _GNU_SOURCE
 #include "record.h"
 
+#define MP4_EPOCH_OFFSET 2082844800U
+#define RECORD_HEADER_MAX 8192
+
+#ifndef FALLOC_FL_KEEP_SIZE
+#define FALLOC_FL_KEEP_SIZE 0x01
+#endif
+
+typedef struct {
+    char path[256];
+    time_t start;
+} record_segment;
+
 static FILE *recordFile;
 static struct Mp4State recordState;
 static int recordSize;
+static char recordPrealloc;
 time_t recordStartTime = 0;
 char recordOn = 0, recordPath[256];
 
@@ -26,6 +40,32 @@ static void record_check_segment_duration() {
     }
 }
 
+static unsigned int read_u32_be(const unsigned char *p) {
+    return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static void write_u32_be(unsigned char *p, unsigned int val) {
+    p[0] = val >> 24; p[1] = val >> 16; p[2] = val >> 8; p[3] = val;
+}
+
+// The shared header carries no creation time, so it is stamped with
+// the segment start on its way to the file to later locate clips
+static void record_write_header(struct BitBuf *header_buf) {
+    unsigned int ftyp = read_u32_be((unsigned char*)header_buf->buf);
+    unsigned char stamp[4];
+
+    if (ftyp + 24 > header_buf->offset ||
+        memcmp(header_buf->buf + ftyp + 12, "mvhd", 4)) {
+        fwrite(header_buf->buf, 1, header_buf->offset, recordFile);
+        return;
+    }
+
+    write_u32_be(stamp, (unsigned int)recordStartTime + MP4_EPOCH_OFFSET);
+    fwrite(header_buf->buf, 1, ftyp + 20, recordFile);
+    fwrite(stamp, 1, 4, recordFile);
+    fwrite(header_buf->buf + ftyp + 24, 1, header_buf->offset - ftyp - 24, recordFile);
+}
+
 void record_start(void) {
     if (recordOn) return;
 
@@ -47,14 +87,15 @@ void record_start(void) {
     if (recordPath[strlen(recordPath) - 1] != '/')
         strncat(recordPath, "/", sizeof(recordPath) - strlen(recordPath) - 1);
 
+    size_t dirLen = strlen(recordPath);
     if (!EMPTY(app_config.record_filename)) {
-        strncpy(recordPath, app_config.record_filename, sizeof(recordPath) - 1);
+        strncpy(recordPath + dirLen, app_config.record_filename, sizeof(recordPath) - dirLen - 1);
         recordPath[sizeof(recordPath) - 1] = '\0';
     } else {
         char tempName[160];
         struct tm *tm_info = localtime(&recordStartTime);
         sprintf(tempName, "recording_%s.mp4", timefmt);
-        strftime(recordPath, sizeof(recordPath), tempName, tm_info);
+        strftime(recordPath + dirLen, sizeof(recordPath) - dirLen, tempName, tm_info);
     }
 
     if (!(recordFile = fopen(recordPath, "wb"))) {
@@ -62,6 +103,19 @@ void record_start(void) {
         return;
     }
 
+    // Reserving the whole segment at once spares the filesystem from
+    // growing the file cluster by cluster as the data comes in; the size
+    // is kept so that vfat does not zero-fill it first, and where that is
+    // not supported the segment simply grows as before
+    recordPrealloc = 0;
+    if (app_config.record_prealloc && app_config.record_segment_size > 0) {
+        if (!fallocate(fileno(recordFile), FALLOC_FL_KEEP_SIZE, 0,
+            app_config.record_segment_size))
+            recordPrealloc = 1;
+        else if (errno != EOPNOTSUPP && errno != ENOSYS)
+            HAL_WARNING("record", "Preallocating the segment failed with %s!\n", strerror(errno));
+    }
+
     recordOn = 1;
 }
 
@@ -73,10 +127,18 @@ void record_stop(void) {
         return;
     }
 
+    // The blocks reserved past the data are given back to the card
+    if (recordPrealloc) {
+        fflush(recordFile);
+        if (ftruncate(fileno(recordFile), recordSize))
+            HAL_WARNING("record", "Trimming the segment to its final size failed!\n");
+    }
+
     fclose(recordFile);
     recordFile = NULL;
 
     recordOn = 0;
+    recordPrealloc = 0;
     recordStartTime = 0;
 }
 
@@ -94,15 +156,7 @@ void send_mp4_to_record(hal_vidstream *stream, char isH265) {
         unsigned char *pack_data = pack->data + pack->offset;
 
         for (char j = 0; j < pack->naluCnt; j++) {
-            if ((pack->nalu[j].type == NalUnitType_SPS || pack->nalu[j].type == NalUnitType_SPS_HEVC) 
-                && pack->nalu[j].length >= 4 && pack->nalu[j].length <= UINT16_MAX)
-                mp4_set_sps(pack_data + pack->nalu[j].offset + 4, pack->nalu[j].length - 4, isH265);
-            else if ((pack->nalu[j].type == NalUnitType_PPS || pack->nalu[j].type == NalUnitType_PPS_HEVC)
-                && pack->nalu[j].length <= UINT16_MAX)
-                mp4_set_pps(pack_data + pack->nalu[j].offset + 4, pack->nalu[j].length - 4, isH265);
-            else if (pack->nalu[j].type == NalUnitType_VPS_HEVC && pack->nalu[j].length <= UINT16_MAX)
-                mp4_set_vps(pack_data + pack->nalu[j].offset + 4, pack->nalu[j].length - 4);
-            else if (pack->nalu[j].type == NalUnitType_CodedSliceIdr || pack->nalu[j].type == NalUnitType_CodedSliceAux)
+            if (pack->nalu[j].type == NalUnitType_CodedSliceIdr || pack->nalu[j].type == NalUnitType_CodedSliceAux)
                 mp4_set_slice(pack_data + pack->nalu[j].offset + 4, pack->nalu[j].length - 4, 1);
             else if (pack->nalu[j].type == NalUnitType_CodedSliceNonIdr)
                 mp4_set_slice(pack_data + pack->nalu[j].offset + 4, pack->nalu[j].length - 4, 0);
@@ -115,7 +169,7 @@ void send_mp4_to_record(hal_vidstream *stream, char isH265) {
             err = mp4_get_header(&header_buf); chk_err_continue
             record_check_segment_size(header_buf.offset);
             recordSize += header_buf.offset;
-            fwrite(header_buf.buf, 1, header_buf.offset, recordFile);
+            record_write_header(&header_buf);
 
             recordState.sequence_number = 0;
             recordState.base_data_offset = header_buf.offset;
@@ -145,4 +199,319 @@ void send_mp4_to_record(hal_vidstream *stream, char isH265) {
     }
 
     record_check_segment_duration();
+}
+
+static int record_send_chunk(int fd, const void *buf, size_t size) {
+    char len_buf[16];
+    int len_size = sprintf(len_buf, "%zX\r\n", size);
+
+    if (send(fd, len_buf, len_size, MSG_NOSIGNAL) != len_size)
+        return EXIT_FAILURE;
+    if (size && send(fd, buf, size, MSG_NOSIGNAL) != size)
+        return EXIT_FAILURE;
+    if (send(fd, "\r\n", 2, MSG_NOSIGNAL) != 2)
+        return EXIT_FAILURE;
+
+    return EXIT_SUCCESS;
+}
+
+static int record_send_file_chunk(int fd, int file, off_t offset, size_t size) {
+    char len_buf[16];
+    int len_size = sprintf(len_buf, "%zX\r\n", size);
+
+    if (send(fd, len_buf, len_size, MSG_NOSIGNAL) != len_size)
+        return EXIT_FAILURE;
+    while (size > 0) {
+        ssize_t sent = sendfile(fd, file, &offset, size);
+        if (sent <= 0) return EXIT_FAILURE;
+        size -= sent;
+    }
+    if (send(fd, "\r\n", 2, MSG_NOSIGNAL) != 2)
+        return EXIT_FAILURE;
+
+    return EXIT_SUCCESS;
+}
+
+static int record_read_header(int file, unsigned char *buf, unsigned int *len,
+    time_t *start, unsigned int *timescale) {
+    if (pread(file, buf, 8, 0) != 8 || memcmp(buf + 4, "ftyp", 4))
+        return EXIT_FAILURE;
+    unsigned int ftyp = read_u32_be(buf);
+    if (ftyp + 32 > RECORD_HEADER_MAX ||
+        pread(file, buf, ftyp + 32, 0) != ftyp + 32 ||
+        memcmp(buf + ftyp + 4, "moov", 4) || memcmp(buf + ftyp + 12, "mvhd", 4))
+        return EXIT_FAILURE;
+
+    *len = ftyp + read_u32_be(buf + ftyp);
+    if (*len > RECORD_HEADER_MAX || pread(file, buf, *len, 0) != *len)
+        return EXIT_FAILURE;
+
+    // Files recorded without a start stamp cannot be placed in time
+    unsigned int created = read_u32_be(buf + ftyp + 20);
+    if (created <= MP4_EPOCH_OFFSET)
+        return EXIT_FAILURE;
+    *start = created - MP4_EPOCH_OFFSET;
+    *timescale = read_u32_be(buf + ftyp + 28);
+
+    return *timescale ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// Decode time of the video track in a fragment header, which dates it
+static unsigned long long record_moof_time(const unsigned char *moof, unsigned int len) {
+    for (unsigned int pos = 8; pos + 8 <= len;) {
+        unsigned int size = read_u32_be(moof + pos);
+        if (size < 8 || pos + size > len) break;
+
+        if (!memcmp(moof + pos + 4, "traf", 4)) {
+            unsigned int track = 0;
+            for (unsigned int sub = pos + 8; sub + 8 <= pos + size;) {
+                unsigned int sub_size = read_u32_be(moof + sub);
+                if (sub_size < 8 || sub + sub_size > pos + size) break;
+
+                if (!memcmp(moof + sub + 4, "tfhd", 4) && sub_size >= 16)
+                    track = read_u32_be(moof + sub + 12);
+                else if (!memcmp(moof + sub + 4, "tfdt", 4) && sub_size >= 20 &&
+                    moof[sub + 8] == 1 && track == 1)
+                    return ((unsigned long long)read_u32_be(moof + sub + 12) << 32) |
+                        read_u32_be(moof + sub + 16);
+                sub += sub_size;
+            }
+        }
+        pos += size;
+    }
+
+    return 0;
+}
+
+// Renumbers a fragment header and rebases the decode times of every track
+static void record_patch_moof(unsigned char *moof, unsigned int len,
+    unsigned int sequence, long long shift) {
+    for (unsigned int pos = 8; pos + 8 <= len;) {
+        unsigned int size = read_u32_be(moof + pos);
+        if (size < 8 || pos + size > len) break;
+
+        if (!memcmp(moof + pos + 4, "mfhd", 4) && size >= 16)
+            write_u32_be(moof + pos + 12, sequence);
+        else if (!memcmp(moof + pos + 4, "traf", 4)) {
+            for (unsigned int sub = pos + 8; sub + 8 <= pos + size;) {
+                unsigned int sub_size = read_u32_be(moof + sub);
+                if (sub_size < 8 || sub + sub_size > pos + size) break;
+
+                if (!memcmp(moof + sub + 4, "tfdt", 4) && sub_size >= 20 &&
+                    moof[sub + 8] == 1) {
+                    unsigned long long time =
+                        ((unsigned long long)read_u32_be(moof + sub + 12) << 32) |
+                        read_u32_be(moof + sub + 16);
+                    time += shift;
+                    write_u32_be(moof + sub + 12, time >> 32);
+                    write_u32_be(moof + sub + 16, time);
+                }
+                sub += sub_size;
+            }
+        }
+        pos += size;
+    }
+}
+
+static int record_compare_segments(const void *a, const void *b) {
+    time_t diff = ((record_segment*)a)->start - ((record_segment*)b)->start;
+    return diff < 0 ? -1 : diff > 0;
+}
+
+static record_segment *record_list_segments(int *count) {
+    record_segment *list = NULL, *grown;
+    unsigned char *header = malloc(RECORD_HEADER_MAX);
+    struct dirent *entry;
+    int size = 0;
+    DIR *dir;
+
+    *count = 0;
+    if (!header) return NULL;
+    if (!(dir = opendir(app_config.record_path))) {
+        free(header);
+        return NULL;
+    }
+
+    while ((entry = readdir(dir))) {
+        int name_len = strlen(entry->d_name);
+        if (name_len < 4 || strcasecmp(entry->d_name + name_len - 4, ".mp4"))
+            continue;
+
+        if (*count == size) {
+            if (!(grown = realloc(list, (size += 32) * sizeof(record_segment))))
+                break;
+            list = grown;
+        }
+
+        record_segment *seg = &list[*count];
+        unsigned int header_len, timescale;
+        // A truncated path could name another file, leave those out
+        if (snprintf(seg->path, sizeof(seg->path), "%s/%s",
+            app_config.record_path, entry->d_name) >= sizeof(seg->path))
+            continue;
+        int file = open(seg->path, O_RDONLY);
+        if (file < 0) continue;
+        if (!record_read_header(file, header, &header_len, &seg->start, &timescale))
+            (*count)++;
+        close(file);
+    }
+
+    closedir(dir);
+    free(header);
+
+    qsort(list, *count, sizeof(record_segment), record_compare_segments);
+    return list;
+}
+
+static int record_read_box(int file, off_t pos, unsigned int size,
+    unsigned char **buf, unsigned int *buf_size) {
+    if (size > *buf_size) {
+        unsigned char *grown = realloc(*buf, size);
+        if (!grown) return EXIT_FAILURE;
+        *buf = grown;
+        *buf_size = size;
+    }
+
+    return pread(file, *buf, size, pos) == size ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// Looks for the keyframe preceding the given instant, or the next one
+// if there is none, by reading box headers and leading NAL bytes only
+static off_t record_find_keyframe(int file, off_t pos, off_t file_size,
+    time_t start, unsigned int timescale, char isH265, time_t from,
+    unsigned char **moof, unsigned int *moof_size) {
+    off_t moof_pos = 0, found = 0;
+    unsigned char box[13];
+    char past = 0;
+
+    while (pos + 8 <= file_size) {
+        if (pread(file, box, 8, pos) != 8) break;
+        unsigned int size = read_u32_be(box);
+        if (size < 8 || pos + size > file_size) break;
+
+        if (!memcmp(box + 4, "moof", 4)) {
+            if (record_read_box(file, pos, size, moof, moof_size)) break;
+            moof_pos = pos;
+            if (start + record_moof_time(*moof, size) / timescale > from) {
+                if (found) break;
+                past = 1;
+            }
+        } else if (!memcmp(box + 4, "mdat", 4) && moof_pos && size >= 13) {
+            if (pread(file, box, 13, pos) != 13) break;
+            char type = isH265 ? (box[12] >> 1) & 0x3F : box[12] & 0x1F;
+            if (isH265 ? (type >= 16 && type <= 21) : type == NalUnitType_CodedSliceIdr) {
+                found = moof_pos;
+                if (past) break;
+            }
+        }
+        pos += size;
+    }
+
+    return found;
+}
+
+int record_send_clip(int fd, time_t from, time_t to) {
+    unsigned char *header = NULL, *moof = NULL;
+    unsigned int header_len, moof_size = 0, timescale, sequence = 0;
+    unsigned long long last_time = 0, last_step = 0;
+    int count, first = -1, ret = EXIT_FAILURE;
+    record_segment *list;
+
+    if (from >= to) return EXIT_FAILURE;
+    if (!(list = record_list_segments(&count))) return EXIT_FAILURE;
+
+    // Segments follow each other, so the clip opens in the latest one
+    // started before it, or in the first one started during it
+    for (int i = 0; i < count && list[i].start < to; i++) {
+        if (list[i].start > from) {
+            if (first < 0) first = i;
+            break;
+        }
+        first = i;
+    }
+    if (first < 0 || !(header = malloc(RECORD_HEADER_MAX))) {
+        free(list);
+        return EXIT_FAILURE;
+    }
+
+    for (int i = first; i < count && list[i].start < to; i++) {
+        int file = open(list[i].path, O_RDONLY);
+        char failed = 0, rebased = 0;
+        long long shift = 0;
+        struct stat st;
+        time_t start;
+        off_t pos;
+
+        if (file < 0) continue;
+        if (fstat(file, &st) ||
+            record_read_header(file, header, &header_len, &start, &timescale)) {
+            close(file);
+            continue;
+        }
+
+        if (ret) {
+            unsigned int ftyp = read_u32_be(header);
+            char isH265 = memstr((char*)header + 8, "hvc1", ftyp - 8, 4) != NULL;
+            pos = record_find_keyframe(file, header_len, st.st_size, start,
+                timescale, isH265, from, &moof, &moof_size);
+            if (!pos) {
+                close(file);
+                continue;
+            }
+
+            char response[256];
+            int len = sprintf(response,
+                "HTTP/1.1 200 OK\r\n"
+                "Content-Type: video/mp4\r\n"
+                "Content-Disposition: attachment; filename=\"clip_%lld.mp4\"\r\n"
+                "Transfer-Encoding: chunked\r\n"
+                "Connection: close\r\n\r\n", (long long)from);
+            ret = EXIT_SUCCESS;
+            if (send(fd, response, len, MSG_NOSIGNAL) != len ||
+                record_send_chunk(fd, header, header_len)) {
+                close(file);
+                break;
+            }
+        } else pos = header_len;
+
+        // Only the fragment headers are read and rewritten, the payloads
+        // go straight from the card to the socket
+        while (!failed && pos + 8 <= st.st_size) {
+            unsigned char box[8];
+            if (pread(file, box, 8, pos) != 8) break;
+            unsigned int size = read_u32_be(box);
+            if (size < 8 || pos + size > st.st_size) break;
+
+            if (!memcmp(box + 4, "moof", 4)) {
+                if (record_read_box(file, pos, size, &moof, &moof_size)) break;
+                unsigned long long time = record_moof_time(moof, size);
+                if (start + time / timescale >= to) break;
+
+                // Decode times restart with every segment, carry them on
+                if (!rebased) {
+                    shift = (long long)(sequence ? last_time + last_step : 0) - time;
+                    rebased = 1;
+                }
+                record_patch_moof(moof, size, sequence, shift);
+                if (sequence) last_step = time + shift - last_time;
+                last_time = time + shift;
+                sequence++;
+
+                failed = record_send_chunk(fd, moof, size);
+            } else if (!memcmp(box + 4, "mdat", 4))
+                failed = record_send_file_chunk(fd, file, pos, size);
+            pos += size;
+        }
+
+        close(file);
+        if (failed) break;
+    }
+
+    if (!ret)
+        send(fd, "0\r\n\r\n", 5, MSG_NOSIGNAL);
+
+    free(moof);
+    free(header);
+    free(list);
+    return ret;
 }
\ No newline at end of file
@@ -1,5 +1,10 @@
 #pragma once
 
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
 #include <time.h>
 
 #include "app_config.h"
@@ -9,4 +14,5 @@
 
 void record_start(void);
 void record_stop(void);
-void send_mp4_to_record(hal_vidstream *stream, char isH265);
\ No newline at end of file
+void send_mp4_to_record(hal_vidstream *stream, char isH265);
+int record_send_clip(int fd, time_t from, time_t to);
\ No newline at end of file
@@ -22,12 +22,22 @@ struct __bufpool_elem_t {
     struct list_t list_entry; // free list entry
 };
 
+/* elements come in chunks so that the pool can grow while in use */
+struct __bufpool_chunk_t {
+    struct __bufpool_chunk_t *next;
+    unsigned int num;
+    struct __bufpool_elem_t elems[];
+};
+
 struct __bufpool_t {
     pthread_mutex_t mutex;
     struct list_head_t free_list;
-    struct __bufpool_elem_t *elems;
+    struct __bufpool_chunk_t *chunks;
+    void * (*bufgetter)(struct __bufpool_t *h, int i);
+    int (*reset)(void *buf);
     hash_handle buf_table;
     unsigned int num;
+    unsigned int max;
 };
 
 typedef struct __bufpool_t *bufpool_handle;
@@ -35,7 +45,9 @@ typedef struct __bufpool_t *bufpool_handle;
 /******************************************************************************
  *              FUNCTION DECLARATIONS
  ******************************************************************************/
-static inline bufpool_handle bufpool_create(int num, void * (*bufgetter_fxn)(int i), int (*reset)(void *buf), size_t each_size);
+static inline bufpool_handle bufpool_create(int num, int max, void * (*bufgetter_fxn)(bufpool_handle h, int i), int (*reset)(void *buf), size_t each_size);
+static inline int bufpool_grow(bufpool_handle h, int num);
+static inline int bufpool_has_free(bufpool_handle h);
 static void bufpool_delete(bufpool_handle h);
 
 //static inline int bufpool_get_free(bufpool_handle h,void **p_buf);
@@ -69,7 +81,7 @@ static inline int __bufpool_ref_manipulate(bufpool_handle h, void *buf, int val)
 {
     struct __bufpool_elem_t *p;
     
-    DASSERT(h->elems,return FAILURE);
+    DASSERT(h->chunks,return FAILURE);
     DASSERT(h->num > 0,return FAILURE);
 
     ASSERT(p = hash_lookup(h->buf_table,(hash_key_t) buf), return FAILURE);
@@ -157,59 +169,115 @@ static inline int bufpool_detach(bufpool_handle h, void *buf)
     return ret;
 }
 
-static inline bufpool_handle bufpool_create(int num, void * (*bufgetter_fxn)(int i), int (*reset)(void *buf), size_t each_size)
+/* append up to 'num' elements, never past the maximum given at creation.
+   the getter is called with the running index of each new element */
+static inline int bufpool_grow(bufpool_handle h, int num)
 {
-    int i;
-    bufpool_handle nh = NULL;
-
-
-    DASSERT(bufgetter_fxn, return NULL);
-
-
-    TALLOC(nh,return NULL);
-
-
-    pthread_mutex_init(&nh->mutex,NULL);
-
+    struct __bufpool_chunk_t *chunk = NULL;
+    int i, ret = FAILURE;
 
-    ASSERT(nh->elems = calloc(num,sizeof(struct __bufpool_elem_t)), goto error);
+    DASSERT(h, return FAILURE);
 
+    pthread_mutex_lock(&h->mutex);
 
-    ASSERT(nh->buf_table = hash_create(num, each_size),
-        goto error);
-
+    /* a full pool is the caller's business to report */
+    num = min(num, (int)(h->max - h->num));
+    if (num <= 0) goto unlock;
 
-    for(i = 0; i< num; i++) {
+    ASSERT(chunk = calloc(1, sizeof(*chunk) + num * sizeof(struct __bufpool_elem_t)),
+        goto unlock);
 
-        nh->elems[i].magic = MAGIC_BUFPOOL_ELEM;
+    for(i = 0; i < num; i++) {
 
-        nh->elems[i].pos = i;
-        nh->elems[i].reset = reset;
+        chunk->elems[i].magic = MAGIC_BUFPOOL_ELEM;
 
-        ASSERT(nh->elems[i].buf = bufgetter_fxn(i),
-            goto error);
+        chunk->elems[i].pos = h->num + i;
+        chunk->elems[i].reset = h->reset;
 
-        ASSERT(hash_add(nh->buf_table, (hash_key_t)nh->elems[i].buf,
-            &(nh->elems[i])) == SUCCESS,
+        ASSERT(chunk->elems[i].buf = h->bufgetter(h, h->num + i),
             goto error);
 
-        MUST(list_push(&nh->free_list, &(nh->elems[i].list_entry)) == SUCCESS,
+        ASSERT(hash_add(h->buf_table, (hash_key_t)chunk->elems[i].buf,
+            &(chunk->elems[i])) == SUCCESS,
             goto error);
 
 #ifdef __DEBUG
         struct __bufpool_elem_t *p;
 
         /* hash health check */
-        ASSERT(p = hash_lookup(nh->buf_table,(hash_key_t)(nh->elems[i].buf)), goto error);
+        ASSERT(p = hash_lookup(h->buf_table,(hash_key_t)(chunk->elems[i].buf)), goto error);
 
         ASSERT(CHECK_MAGIC(MAGIC_BUFPOOL_ELEM,&p),goto error);
 
-        ASSERT(p == &nh->elems[i], goto error);
+        ASSERT(p == &chunk->elems[i], goto error);
 #endif
     }
-    
 
-    nh->num = num;
+    /* only published once every element is ready */
+    for(i = 0; i < num; i++) {
+        MUST(list_push(&h->free_list, &(chunk->elems[i].list_entry)) == SUCCESS,
+            goto unlock);
+    }
+
+    chunk->num = num;
+    chunk->next = h->chunks;
+    h->chunks = chunk;
+    h->num += num;
+    ret = SUCCESS;
+
+unlock:
+    pthread_mutex_unlock(&h->mutex);
+
+    return ret;
+error:
+    while (i-- > 0)
+        hash_del(h->buf_table, (hash_key_t)chunk->elems[i].buf);
+    FREE(chunk);
+    pthread_mutex_unlock(&h->mutex);
+
+    return FAILURE;
+}
+
+static inline int bufpool_has_free(bufpool_handle h)
+{
+    int ret;
+    DASSERT(h,return FALSE);
+
+    pthread_mutex_lock(&h->mutex);
+
+    ret = h->free_list.list != NULL;
+
+    pthread_mutex_unlock(&h->mutex);
+
+    return ret;
+}
+
+static inline bufpool_handle bufpool_create(int num, int max, void * (*bufgetter_fxn)(bufpool_handle h, int i), int (*reset)(void *buf), size_t each_size)
+{
+    bufpool_handle nh = NULL;
+
+
+    DASSERT(bufgetter_fxn, return NULL);
+    DASSERT(num <= max, return NULL);
+
+
+    TALLOC(nh,return NULL);
+
+
+    pthread_mutex_init(&nh->mutex,NULL);
+
+    nh->bufgetter = bufgetter_fxn;
+    nh->reset = reset;
+    nh->max = max;
+
+
+    /* buckets are sized for the largest the pool may get */
+    ASSERT(nh->buf_table = hash_create(max, each_size),
+        goto error);
+
+
+    ASSERT(bufpool_grow(nh, num) == SUCCESS,
+        goto error);
 
 
     return nh;
@@ -220,15 +288,17 @@ error:
 
 static void bufpool_delete(bufpool_handle h)
 {
+    struct __bufpool_chunk_t *chunk;
     int i;
     if (h) {
-        if (h->elems) {
-            for(i = 0;i < h->num; i++) {
-                if(h->elems[i].reset) {
-                    h->elems[i].reset(h->elems[i].buf);
+        while ((chunk = h->chunks)) {
+            for(i = 0;i < chunk->num; i++) {
+                if(chunk->elems[i].reset) {
+                    chunk->elems[i].reset(chunk->elems[i].buf);
                 }
             }
-            FREE(h->elems);
+            h->chunks = chunk->next;
+            FREE(chunk);
         }
 
         hash_destroy(h->buf_table);
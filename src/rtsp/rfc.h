@@ -10,9 +10,12 @@
 #define RTP_SEQ_MOD (1<<16)
 #define RTP_MAX_SDES 255      /* maximum text length for SDES */
 
+#define H264_NAL_TYPE_IDR 5
 #define H264_NAL_TYPE_SEI 6
 #define H264_NAL_TYPE_SPS 7
 #define H264_NAL_TYPE_PPS 8
+#define H265_NAL_TYPE_IDR_W_RADL 19
+#define H265_NAL_TYPE_IDR_N_LP 20
 #define H265_NAL_TYPE_VPS 32
 #define H265_NAL_TYPE_SPS 33
 #define H265_NAL_TYPE_PPS 34
@@ -24,9 +27,13 @@ typedef enum {
     RTCP_RR   = 201,
     RTCP_SDES = 202,
     RTCP_BYE  = 203,
-    RTCP_APP  = 204
+    RTCP_APP  = 204,
+    RTCP_RTPFB = 205  /* RFC 4585 transport layer feedback */
 } rtcp_type_t;
 
+/* FMT of a generic NACK in RTCP_RTPFB */
+#define RTCP_FB_NACK 1
+
 typedef enum {
     RTCP_SDES_END   = 0,
     RTCP_SDES_CNAME = 1,
@@ -7,50 +7,232 @@
 #include "rfc.h"
 #include "rtsp.h"
 #include "common.h"
+/******************************************************************************
+ *              DEFINITIONS
+ ******************************************************************************/
+/* header, sender SSRC and sender information, without report blocks */
+#define __RTCP_SR_SIZE 28
+
 /******************************************************************************
  *              DECLARATIONS
  ******************************************************************************/
 
-static inline int __rtcp_send_sr(struct connection_item_t *con);
+static inline int __rtcp_send_sr(struct connection_item_t *con, int track_id);
+static inline unsigned int __rtcp_u32(const unsigned char *p);
+static inline void __rtcp_recv(struct connection_item_t *con, int track_id, const unsigned char *buf, size_t len);
+static inline void __rtcp_resend(struct connection_item_t *con, unsigned short seq);
+static inline void __rtcp_nack(struct connection_item_t *con, const unsigned char *buf, size_t size);
 
 
 /******************************************************************************
  *              INLINE FUNCTIONS
  ******************************************************************************/
-static inline int __rtcp_send_sr(struct connection_item_t *con)
+static inline int __rtcp_send_sr(struct connection_item_t *con, int track_id)
 {
     struct timeval tv;
     unsigned int ts_h; 
     unsigned int ts_l; 
+    unsigned int now;
     int send_bytes;
-    struct sockaddr_in to_addr;
 
     ASSERT(gettimeofday(&tv,NULL) == 0, return FAILURE);
 
     ts_h = (unsigned int)tv.tv_sec + 2208988800U;
     ts_l = (((double)tv.tv_usec) / 1e6) * 4294967296.0;
 
+    /* sender statistics are cumulative over the session */
+    con->trans[track_id].stat.packets += con->trans[track_id].rtcp_packet_cnt;
+    con->trans[track_id].stat.octets += con->trans[track_id].rtcp_octet;
+
     rtcp_t rtcp = { common: {version: 2, length: htons(6), p:0, count: 0, pt:RTCP_SR},
         r: { sr: { ssrc: htonl(con->ssrc),
             ntp_sec: htonl(ts_h),
             ntp_frac: htonl(ts_l),
-            rtp_ts: htonl(con->trans[con->track_id].rtp_timestamp),
-            psent: htonl(con->trans[con->track_id].rtcp_packet_cnt),
-            osent: htonl(con->trans[con->track_id].rtcp_octet)}}};
+            rtp_ts: htonl(con->trans[track_id].rtp_timestamp),
+            psent: htonl(con->trans[track_id].stat.packets),
+            osent: htonl(con->trans[track_id].stat.octets)}}};
+
+    if (con->trans[track_id].transport == __TRANSPORT_TCP) {
+        unsigned char frame[4] = { '$', con->trans[track_id].channel_rtcp, 0, __RTCP_SR_SIZE };
+
+        /* a report lost to a congested reader is not worth stalling for */
+        struct iovec iov[2] = {
+            { .iov_base = frame, .iov_len = sizeof(frame) },
+            { .iov_base = &(rtcp), .iov_len = __RTCP_SR_SIZE } };
 
-    to_addr = con->addr;
-    to_addr.sin_port = con->trans[con->track_id].client_port_rtcp;
+        __con_out_write(con, iov, 2, TRUE);
+    } else {
+        /* RTCP sockets are shared by sessions, or left unconnected on a
+           group to hear every receiver, so reports are always addressed */
+        struct sockaddr_in to = con->addr;
 
-    ASSERT((send_bytes = send(con->trans[con->track_id].server_rtcp_fd,
-        &(rtcp),36,0)) == 36, ({
-                ERR("send:%d:%s¥n",send_bytes,strerror(errno));
-                return FAILURE;}));
+        to.sin_port = htons(con->trans[track_id].client_port_rtcp);
 
-    con->trans[con->track_id].rtcp_packet_cnt = 0;
-    con->trans[con->track_id].rtcp_octet = 0;
-    con->trans[con->track_id].rtcp_tick = con->trans[con->track_id].rtcp_tick_org;
+        ASSERT((send_bytes = sendto(con->trans[track_id].server_rtcp_fd,
+            &(rtcp), __RTCP_SR_SIZE, 0, (struct sockaddr *)&to,
+            sizeof(to))) == __RTCP_SR_SIZE, ({
+                    ERR("send:%d:%s¥n",send_bytes,strerror(errno));
+                    return FAILURE;}));
+    }
+
+    /* the receiver echoes these back in LSR, which gives us the round trip */
+    now = millis();
+    con->trans[track_id].stat.lsr = (ts_h << 16) | (ts_l >> 16);
+    if (con->trans[track_id].stat.sr_ms && now != con->trans[track_id].stat.sr_ms)
+        con->trans[track_id].stat.kbps = (unsigned long long)con->trans[track_id].rtcp_octet * 8 /
+            (now - con->trans[track_id].stat.sr_ms);
+    con->trans[track_id].stat.sr_ms = now;
+
+    con->trans[track_id].rtcp_packet_cnt = 0;
+    con->trans[track_id].rtcp_octet = 0;
+    con->trans[track_id].rtcp_tick = con->trans[track_id].rtcp_tick_org;
 
     return SUCCESS;
 }
 
-#endif
\ No newline at end of file
+/* report blocks are not necessarily aligned in the receive buffer */
+static inline unsigned int __rtcp_u32(const unsigned char *p)
+{
+    return (unsigned int)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+/* one video packet again, as it first went out, if the mount's ring still
+   holds it and the session's budget allows */
+static inline void __rtcp_resend(struct connection_item_t *con, unsigned short seq)
+{
+    struct __rtp_pace_t *p = __atomic_load_n(&con->mount->pace, __ATOMIC_ACQUIRE);
+    struct sockaddr_in to = con->addr;
+    struct __rtp_slot_t slot;
+    unsigned int e, head, pos;
+    rtp_hdr_t *hdr;
+
+    if (!p) return;
+
+    /* never sent, or long enough ago for the entry to be reused */
+    e = __atomic_load_n(&con->nack.hist[seq & (__RTP_NACK_HISTORY - 1)], __ATOMIC_RELAXED);
+    if (e >> 16 != seq) return;
+
+    head = __atomic_load_n(&p->head, __ATOMIC_ACQUIRE);
+    pos = head - ((head - e) & 0xFFFF);
+    if (pos == head || head - pos > p->size) return;
+
+    memcpy(&slot, &p->slot[pos & (p->size - 1)], sizeof(slot));
+
+    /* the encoder may have come round to this slot while it was copied */
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&p->wr, __ATOMIC_RELAXED) - pos > p->size) return;
+
+    if (con->nack.tokens < slot.len) return;
+    con->nack.tokens -= slot.len;
+
+    hdr = (rtp_hdr_t *)slot.data;
+    hdr->seq = htons(seq);
+    hdr->ts = htonl(slot.ts);
+    hdr->ssrc = htonl(con->ssrc);
+
+    to.sin_port = htons(con->trans[0].client_port_rtp);
+    if (sendto(con->trans[0].server_rtp_fd, slot.data, slot.len, 0,
+        (struct sockaddr *)&to, sizeof(to)) == slot.len)
+        con->trans[0].stat.resent += 1;
+}
+
+/* RFC 4585 generic NACK on the video. the budget refills at a share of the
+   target bitrate, so a storm of them cannot add more than that */
+static inline void __rtcp_nack(struct connection_item_t *con, const unsigned char *buf, size_t size)
+{
+    unsigned long long now = __rtp_now(), tokens;
+    unsigned int kbps, rate, depth;
+    unsigned short pid, blp;
+
+    if (!con->nack.budget || !con->mount ||
+        con->trans[0].transport != __TRANSPORT_UDP) return;
+    if (size < 12 || __rtcp_u32(buf + 8) != con->ssrc) return;
+
+    kbps = __atomic_load_n(&con->mount->kbps, __ATOMIC_RELAXED);
+    rate = (unsigned long long)(kbps ? kbps : __RTP_NACK_KBPS) * 125 * con->nack.budget / 100;
+
+    /* a tenth of a second's worth at once, and never less than one packet */
+    depth = rate / 10 + sizeof(((struct __rtp_slot_t *)0)->data);
+    tokens = con->nack.tokens + (unsigned long long)rate * (now - con->nack.refill_us) / 1000000;
+    con->nack.tokens = min(tokens, (unsigned long long)depth);
+    con->nack.refill_us = now;
+
+    for (size_t off = 12; off + 4 <= size; off += 4) {
+        pid = buf[off] << 8 | buf[off + 1];
+        blp = buf[off + 2] << 8 | buf[off + 3];
+
+        __rtcp_resend(con, pid);
+        for (int i = 0; i < 16; i++)
+            if (blp & (1 << i))
+                __rtcp_resend(con, pid + i + 1);
+    }
+}
+
+/* one compound RTCP packet from the receiver of 'track_id' */
+static inline void __rtcp_recv(struct connection_item_t *con, int track_id, const unsigned char *buf, size_t len)
+{
+    struct timeval tv;
+    unsigned int arrival, lsr, dlsr;
+    size_t size, off;
+
+    /* a group loops our own sender reports back to us */
+    if (len >= 8 && __rtcp_u32(buf + 4) == con->ssrc) return;
+
+    gettimeofday(&tv, NULL);
+    arrival = (((unsigned int)tv.tv_sec + 2208988800U) << 16) |
+        (unsigned int)(((unsigned long long)tv.tv_usec << 16) / 1000000);
+
+    while (len >= 4) {
+        size = ((buf[2] << 8 | buf[3]) + 1) * 4;
+        if ((buf[0] >> 6) != RTP_VERSION || size > len) {
+            DBG("malformed rtcp packet\n");
+            return;
+        }
+
+        switch (buf[1]) {
+            case RTCP_SR:
+            case RTCP_RR:
+                /* report blocks follow the reporter's SSRC and, for a
+                   sender report, its sender information */
+                off = buf[1] == RTCP_SR ? 28 : 8;
+                for (int i = 0; i < (buf[0] & 0x1F) && off + 24 <= size; i++, off += 24) {
+                    const unsigned char *rb = buf + off;
+
+                    if (__rtcp_u32(rb) != con->ssrc) continue;
+
+                    con->trans[track_id].stat.fraction = rb[4];
+                    con->trans[track_id].stat.lost = (int)((unsigned int)rb[5] << 24 |
+                        rb[6] << 16 | rb[7] << 8) >> 8;
+                    con->trans[track_id].stat.jitter = __rtcp_u32(rb + 12);
+
+                    /* RFC 3550 6.4.1, in 1/65536 s */
+                    lsr = __rtcp_u32(rb + 16);
+                    dlsr = __rtcp_u32(rb + 20);
+                    if (lsr && arrival - lsr - dlsr < 0x80000000U)
+                        con->trans[track_id].stat.rtt_ms =
+                            ((unsigned long long)(arrival - lsr - dlsr) * 1000) >> 16;
+                }
+                break;
+            case RTCP_RTPFB:
+                if (track_id == 0 && (buf[0] & 0x1F) == RTCP_FB_NACK)
+                    __rtcp_nack(con, buf, size);
+                break;
+            case RTCP_BYE:
+                /* the receiver left without a TEARDOWN, stop feeding it;
+                   one member leaving a group says nothing about the others */
+                DBG("rtcp bye on track %d\n", track_id);
+                if (con->con_state == __CON_S_PLAYING &&
+                    con->trans[track_id].transport != __TRANSPORT_MULTICAST)
+                    __con_set_state(con, __CON_S_INIT);
+                break;
+        }
+
+        buf += size;
+        len -= size;
+    }
+
+    /* zero is kept for "never reported" */
+    con->trans[track_id].stat.heard_ms = millis() | 1;
+}
+
+#endif
@@ -5,6 +5,7 @@
 #include <netdb.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <stddef.h>
 
 #include "rtsp_server.h"
 #include "common.h"
@@ -21,346 +22,935 @@
 /******************************************************************************
  *              PRIVATE DEFINITIONS
  ******************************************************************************/
-//static void *rtpThrFxn(void *v);
-static inline int __rtp_send(struct nal_rtp_t *rtp, struct list_head_t *trans_list);
-static inline int __rtp_send_eachconnection(struct list_t *e, void *v);
-static inline int __rtp_setup_transfer(struct list_t *e, void *v);
-static inline int __transfer_nal_h26x(struct list_head_t *trans_list, unsigned char *nalptr, size_t nalsize, char isH265);
-static inline int __transfer_nal_mpga(struct list_head_t *trans_list, unsigned char *ptr, size_t size);
-static inline int __retrieve_sprop(rtsp_handle h, unsigned char *buf, size_t len);
-
-struct __transfer_set_t {
-    struct list_head_t list_head;
-    rtsp_handle h;
-};
+static inline int __rtp_send(struct __rtsp_mount_t *m, struct __rtsp_subs_t *s, int track_id, struct __rtp_batch_t *b);
+static inline int __rtp_send_eachconnection(struct __rtsp_mount_t *m, struct connection_item_t *con, int track_id, struct __rtp_batch_t *b);
+static inline int __rtp_send_interleaved(struct connection_item_t *con, int track_id, struct __rtp_batch_t *b);
+static inline int __rtp_send_udp(struct connection_item_t *con, int track_id, struct __rtp_batch_t *b);
+static inline void __rtp_prime(struct __rtsp_mount_t *m, struct connection_item_t *con, struct __rtp_batch_t *b);
+static inline int __rtp_send_group(struct __rtsp_mount_t *m, int track_id, struct __rtp_batch_t *b);
+static inline void __rtp_stamp(struct connection_item_t *con, int track_id, struct nal_rtp_t *rtp, unsigned int ts);
+static inline int __rtcp_poll(struct __rtsp_mount_t *m, struct __rtsp_subs_t *s, int track_id, char paced);
+static inline struct __rtp_pace_t *__rtp_pace_create(unsigned int kbps, unsigned int window_ms);
+static inline int __rtp_pace_put(struct __rtsp_mount_t *m, struct __rtp_batch_t *b);
+static int __rtp_pace_con(struct __rtsp_mount_t *m, struct __rtp_pace_t *p, struct __rtp_pacer_t *w,
+    struct connection_item_t *con, int track_id, unsigned int burst, unsigned long long now);
+static int __rtp_pace_mount(struct __rtsp_mount_t *m, struct __rtp_pacer_t *w,
+    unsigned int burst, unsigned long long now);
+static inline void __rtp_fec_reset(struct __rtp_fec_t *f);
+static inline void __rtp_fec_add(struct connection_item_t *con, const struct iovec *iov, int iovcnt, char keyframe, char last);
+static inline void __rtp_fec_send(struct connection_item_t *con);
+static inline int __transfer_nal_h26x(struct __rtp_batch_t *b, unsigned char *nalptr, size_t nalsize, char isH265);
+static inline int __transfer_nal_mpga(struct __rtp_batch_t *b, unsigned char *ptr, size_t size);
+static inline int __transfer_g711(struct __rtp_batch_t *b, unsigned int pt, unsigned char *ptr, size_t size);
+static inline int __jpeg_parse(const unsigned char *buf, size_t len, struct __rtp_jpeg_t *j);
+static inline int __transfer_jpeg(struct __rtp_batch_t *b, const struct __rtp_jpeg_t *j, unsigned char *first);
+static inline void __rtp_video_clock(struct __rtsp_mount_t *m, unsigned long long timestamp);
+static inline int __rtp_send_video(struct __rtsp_mount_t *m, struct __rtsp_subs_t *s, struct __rtp_batch_t *b);
 
 /******************************************************************************
  *              PRIVATE FUNCTIONS
  ******************************************************************************/
+static inline struct nal_rtp_t *__rtp_packet(struct __rtp_batch_t *b, unsigned int pt)
+{
+    struct nal_rtp_t *rtp;
+
+    if (!(rtp = __rtp_batch_next(b))) return NULL;
+
+    rtp->packet.header.version = 2;
+    rtp->packet.header.p = 0;
+    rtp->packet.header.x = 0;
+    rtp->packet.header.cc = 0;
+    rtp->packet.header.pt = pt & 0x7F;
+    rtp->headsize = 0;
+    rtp->keyframe = 0;
+
+    return rtp;
+}
 
-static inline int __transfer_nal_h26x(struct list_head_t *trans_list, unsigned char *nalptr, size_t nalsize, char isH265)
+static inline int __transfer_nal_h26x(struct __rtp_batch_t *b, unsigned char *nalptr, size_t nalsize, char isH265)
 {
-    struct nal_rtp_t rtp;
+    struct nal_rtp_t *rtp;
     unsigned int nri = isH265 ? (nalptr[0] & 0x81) : (nalptr[0] & 0x60);
     unsigned int pt  = isH265 ? (nalptr[0] >> 1 & 0x3F) : (nalptr[0] & 0x1F);
     unsigned int ids = isH265 ? nalptr[1] : 0;
     char head = isH265 ? 3 : 2;
-
-    rtp_hdr_t *p_header = &(rtp.packet.header);
-    unsigned char *payload = rtp.packet.payload;
-
-    p_header->version = 2;
-    p_header->p = 0;
-    p_header->x = 0;
-    p_header->cc = 0;
-    p_header->pt = 96 & 0x7F;
+    unsigned char fu[3];
+    size_t chunk;
+    char keyframe;
 
     if (nalsize < 4) return SUCCESS;
 
+    keyframe = isH265 ?
+        (pt == H265_NAL_TYPE_VPS || pt == H265_NAL_TYPE_IDR_W_RADL || pt == H265_NAL_TYPE_IDR_N_LP) :
+        (pt == H264_NAL_TYPE_SPS || pt == H264_NAL_TYPE_IDR);
+
     if (nalsize <= __RTP_MAXPAYLOADSIZE) {
-        /* single packet */
-        /* SPS, PPS, SEI is not marked */
-        if ((isH265 && pt < H265_NAL_TYPE_VPS) ||
-            (!isH265 &&
-                pt != H264_NAL_TYPE_SPS && 
-                pt != H264_NAL_TYPE_PPS &&
-                pt != H264_NAL_TYPE_SEI)) { 
-            p_header->m = 1;
-        } else {
-            p_header->m = 0;
-        }
+        /* single packet, the caller marks the end of the access unit */
+        ASSERT(rtp = __rtp_packet(b, 96), return FAILURE);
 
-        memcpy(payload, nalptr, nalsize);
+        rtp->packet.header.m = 0;
+        rtp->keyframe = keyframe;
 
-        rtp.rtpsize = nalsize + sizeof(rtp_hdr_t);
+        rtp->payload = nalptr;
+        rtp->payloadsize = nalsize;
+        rtp->rtpsize = nalsize + sizeof(rtp_hdr_t);
 
-        ASSERT(__rtp_send(&rtp, trans_list) == SUCCESS, return FAILURE);
-    } else {
-        nalptr += isH265 ? 2 : 1;
-        nalsize -= isH265 ? 2 : 1;
-
-        if (isH265) {
-            payload[0] = 49 << 1;
-            payload[0] |= nri;
-            payload[1] = ids;
-            payload[2] = pt;
-        } else {
-            payload[0] = 28;
-            payload[0] |= nri;
-            payload[1] = pt;
-        }
-        payload[head - 1] |= 1 << 7;
+        return SUCCESS;
+    }
 
-        /* send fragmented nal */
-        while (nalsize > __RTP_MAXPAYLOADSIZE - head) {
-            p_header->m = 0;
+    nalptr += isH265 ? 2 : 1;
+    nalsize -= isH265 ? 2 : 1;
 
-            memcpy(&(payload[head]), nalptr, __RTP_MAXPAYLOADSIZE - head);
+    if (isH265) {
+        fu[0] = 49 << 1;
+        fu[0] |= nri;
+        fu[1] = ids;
+        fu[2] = pt;
+    } else {
+        fu[0] = 28;
+        fu[0] |= nri;
+        fu[1] = pt;
+    }
+    fu[head - 1] |= 1 << 7;
 
-            rtp.rtpsize = sizeof(rtp_hdr_t) + __RTP_MAXPAYLOADSIZE;
+    /* fragmented nal, the trailing fragment carries the end bit */
+    while (nalsize) {
+        chunk = min(nalsize, (size_t)(__RTP_MAXPAYLOADSIZE - head));
 
-            nalptr += __RTP_MAXPAYLOADSIZE - head;
-            nalsize -= __RTP_MAXPAYLOADSIZE - head;
+        ASSERT(rtp = __rtp_packet(b, 96), return FAILURE);
 
-            ASSERT(__rtp_send(&rtp, trans_list) == SUCCESS, return FAILURE);
+        rtp->keyframe = keyframe;
+        keyframe = 0;
 
-            /* intended xor. blame vim :( */
-            payload[head - 1] &= 0xFF ^ (1<<7); 
-        }
+        if (chunk == nalsize)
+            fu[head - 1] |= 1 << 6;
+        rtp->packet.header.m = 0;
 
-        /* send trailing nal */
-        p_header->m = 1;
+        memcpy(rtp->packet.head, fu, head);
+        rtp->headsize = head;
+        rtp->payload = nalptr;
+        rtp->payloadsize = chunk;
+        rtp->rtpsize = sizeof(rtp_hdr_t) + head + chunk;
 
-        payload[head - 1] |= 1 << 6;
+        nalptr += chunk;
+        nalsize -= chunk;
 
         /* intended xor. blame vim :( */
-        payload[head - 1] &= 0xFF ^ (1<<7);
+        fu[head - 1] &= 0xFF ^ (1<<7); 
+    }
+
+    return SUCCESS;
+}
 
-        rtp.rtpsize = nalsize + sizeof(rtp_hdr_t) + head;
+static inline int __transfer_nal_mpga(struct __rtp_batch_t *b, unsigned char *ptr, size_t size)
+{
+    struct nal_rtp_t *rtp;
 
-        memcpy(&(payload[head]), nalptr, nalsize);
+    ASSERT(rtp = __rtp_packet(b, 14), return FAILURE);
 
-        ASSERT(__rtp_send(&rtp, trans_list) == SUCCESS, return FAILURE);
-    }
+    rtp->packet.header.m = 1;
+    rtp->keyframe = 1;
+
+    /* MBZ and fragment offset */
+    memset(rtp->packet.head, 0, 4);
+    rtp->headsize = 4;
+    rtp->payload = ptr;
+    rtp->payloadsize = size;
+    rtp->rtpsize = size + 4 + sizeof(rtp_hdr_t);
 
     return SUCCESS;
 }
 
-static inline int __transfer_nal_mpga(struct list_head_t *trans_list, unsigned char *ptr, size_t size)
+/* the markers up to the scan of a baseline frame. the Huffman tables are
+   left out as RFC 2435 has the receiver assume the standard ones */
+static inline int __jpeg_parse(const unsigned char *buf, size_t len, struct __rtp_jpeg_t *j)
 {
-    struct nal_rtp_t rtp;
+    const unsigned char *seg;
+    unsigned int width = 0, height = 0;
+    size_t pos = 2, seglen;
 
-    rtp_hdr_t *p_header = &(rtp.packet.header);
-    unsigned char *payload = rtp.packet.payload;
+    memset(j, 0, sizeof(*j));
 
-    p_header->version = 2;
-    p_header->p = 0;
-    p_header->x = 0;
-    p_header->cc = 0;
-    p_header->pt = 14;
-    p_header->m = 1;
+    if (len < 4 || buf[0] != 0xFF || buf[1] != 0xD8) return FAILURE;
 
-    payload[0] = payload[1] = payload[2] = payload[3] = 0;
-    memcpy(payload + 4, ptr, size);
-    size += 4;
+    while (pos + 4 <= len) {
+        if (buf[pos] != 0xFF) return FAILURE;
+        /* fill bytes may pad a marker */
+        if (buf[pos + 1] == 0xFF) {
+            pos++;
+            continue;
+        }
 
-    rtp.rtpsize = size + sizeof(rtp_hdr_t);
+        seglen = buf[pos + 2] << 8 | buf[pos + 3];
+        seg = buf + pos + 4;
+        if (seglen < 2 || pos + 2 + seglen > len) return FAILURE;
+
+        switch (buf[pos + 1]) {
+            case 0xDB:
+                for (size_t i = 0; i + 65 <= seglen - 2; i += 65) {
+                    /* only 8 bit precision fits in the fixed table length */
+                    if (seg[i] >> 4) return FAILURE;
+                    if ((seg[i] & 0x0F) < 2)
+                        j->qt[seg[i] & 0x0F] = seg + i + 1;
+                }
+                break;
+            case 0xC0:
+            case 0xC1:
+                if (seglen < 17 || seg[5] != 3) return FAILURE;
+                height = seg[1] << 8 | seg[2];
+                width = seg[3] << 8 | seg[4];
+                /* the luma sampling factors, chroma being 1x1 */
+                if (seg[7] == 0x21) j->type = 0;
+                else if (seg[7] == 0x22) j->type = 1;
+                else return FAILURE;
+                break;
+            case 0xC2:
+            case 0xC3:
+                /* progressive and lossless have no RTP type */
+                return FAILURE;
+            case 0xDD:
+                if (seglen < 4) return FAILURE;
+                j->dri = seg[0] << 8 | seg[1];
+                break;
+            case 0xDA:
+                j->scan = buf + pos + 2 + seglen;
+                j->scansize = len - (pos + 2 + seglen);
+                /* the end of image is implied by the marker bit */
+                if (j->scansize >= 2 && j->scan[j->scansize - 2] == 0xFF &&
+                    j->scan[j->scansize - 1] == 0xD9)
+                    j->scansize -= 2;
+
+                if (!width || !height || !j->qt[0] || !j->qt[1] ||
+                    width > __RTP_JPEG_SIZE_MAX || height > __RTP_JPEG_SIZE_MAX)
+                    return FAILURE;
+                j->width = (width + 7) >> 3;
+                j->height = (height + 7) >> 3;
+                if (j->dri)
+                    j->type += 64;
+
+                return SUCCESS;
+        }
 
-    ASSERT(__rtp_send(&rtp, trans_list) == SUCCESS, return FAILURE);
+        pos += 2 + seglen;
+    }
+
+    return FAILURE;
+}
+
+/* one frame, the tables going ahead of the scan in the first packet out of
+   'first', which lasts until the frame is sent like the encoder's buffer */
+static inline int __transfer_jpeg(struct __rtp_batch_t *b, const struct __rtp_jpeg_t *j, unsigned char *first)
+{
+    struct nal_rtp_t *rtp;
+    unsigned char head[__RTP_JPEG_HEADER + __RTP_JPEG_RESTART];
+    char headsize = __RTP_JPEG_HEADER;
+    size_t offset = 0, chunk;
+
+    head[0] = 0;
+    head[4] = j->type;
+    head[5] = __RTP_JPEG_Q;
+    head[6] = j->width;
+    head[7] = j->height;
+
+    /* packets need not start on an interval, so F, L and the count are set */
+    if (j->dri) {
+        head[8] = j->dri >> 8;
+        head[9] = j->dri & 0xFF;
+        head[10] = 0xFF;
+        head[11] = 0xFF;
+        headsize += __RTP_JPEG_RESTART;
+    }
+
+    do {
+        ASSERT(rtp = __rtp_packet(b, __RTP_JPEG_PT), return FAILURE);
+
+        head[1] = offset >> 16;
+        head[2] = offset >> 8;
+        head[3] = offset;
+        memcpy(rtp->packet.head, head, headsize);
+        rtp->headsize = headsize;
+
+        if (!offset) {
+            chunk = min(j->scansize, (size_t)(__RTP_MAXPAYLOADSIZE - headsize - __RTP_JPEG_QTABLES));
+
+            /* MBZ, precision and length, then both tables */
+            first[0] = 0;
+            first[1] = 0;
+            first[2] = 0;
+            first[3] = 2 * 64;
+            memcpy(first + 4, j->qt[0], 64);
+            memcpy(first + 4 + 64, j->qt[1], 64);
+            memcpy(first + __RTP_JPEG_QTABLES, j->scan, chunk);
+
+            rtp->keyframe = 1;
+            rtp->payload = first;
+            rtp->payloadsize = __RTP_JPEG_QTABLES + chunk;
+        } else {
+            chunk = min(j->scansize - offset, (size_t)(__RTP_MAXPAYLOADSIZE - headsize));
+
+            rtp->payload = (unsigned char *)j->scan + offset;
+            rtp->payloadsize = chunk;
+        }
+
+        rtp->rtpsize = sizeof(rtp_hdr_t) + headsize + rtp->payloadsize;
+        offset += chunk;
+        rtp->packet.header.m = offset == j->scansize;
+    } while (offset < j->scansize);
 
     return SUCCESS;
 }
 
-static inline int __rtp_send_eachconnection(struct list_t *e, void *v)
+/* one sample a byte, nothing ahead of them */
+static inline int __transfer_g711(struct __rtp_batch_t *b, unsigned int pt, unsigned char *ptr, size_t size)
 {
-    int send_bytes;
-    struct connection_item_t *con;
-    struct transfer_item_t *trans;
-    struct nal_rtp_t *rtp = v;
-    int track_id = rtp->packet.header.pt == 96 ? 0 : 1;
-    char attempts = 0;
+    struct nal_rtp_t *rtp;
+
+    ASSERT(rtp = __rtp_packet(b, pt), return FAILURE);
+
+    /* a continuous stream, no talkspurt ever starts */
+    rtp->packet.header.m = 0;
+    rtp->keyframe = 1;
 
-    list_upcast(trans,e); 
+    rtp->payload = ptr;
+    rtp->payloadsize = size;
+    rtp->rtpsize = size + sizeof(rtp_hdr_t);
 
-    MUST(con = trans->con, return FAILURE);
-    if (!con->trans[track_id].server_port_rtp) return SUCCESS;
+    return SUCCESS;
+}
 
+static inline void __rtp_stamp(struct connection_item_t *con, int track_id, struct nal_rtp_t *rtp, unsigned int ts)
+{
     rtp->packet.header.seq = htons(con->trans[track_id].rtp_seq);
-    if (rtp->packet.header.m)
-        con->trans[track_id].rtp_timestamp = (millis() * 90) & UINT32_MAX;
-    rtp->packet.header.ts = htonl(con->trans[track_id].rtp_timestamp);
+    con->trans[track_id].rtp_timestamp = ts;
+    rtp->packet.header.ts = htonl(ts);
     rtp->packet.header.ssrc = htonl(con->ssrc);
     con->trans[track_id].rtp_seq += 1;
+}
 
-    do  {
-        send_bytes = send(con->trans[track_id].server_rtp_fd,
-            &(rtp->packet),rtp->rtpsize,0);
+/* the group size is kept, everything it protected is forgotten */
+static inline void __rtp_fec_reset(struct __rtp_fec_t *f)
+{
+    memset(f->payload, 0, f->size);
+    f->count = 0;
+    f->size = 0;
+    f->length = 0;
+    memset(f->head, 0, sizeof(f->head));
+    memset(f->ts, 0, sizeof(f->ts));
+}
 
-        if (send_bytes == rtp->rtpsize) {
-            con->trans[track_id].rtcp_packet_cnt += 1;
-            con->trans[track_id].rtcp_octet += rtp->rtpsize;
-            return SUCCESS;
-        } else if(con->con_state != __CON_S_PLAYING) {
+/* fold one video packet, as it went out, into the session's parity */
+static inline void __rtp_fec_add(struct connection_item_t *con, const struct iovec *iov, int iovcnt, char keyframe, char last)
+{
+    struct __rtp_fec_t *f = &con->fec;
+    const unsigned char *hdr = iov[0].iov_base;
+    unsigned short seq = hdr[2] << 8 | hdr[3];
+    unsigned int limit;
+    size_t off = 0;
+
+    /* the mask only spans consecutive packets, a gap starts over */
+    if (f->count && seq != (unsigned short)(f->base + f->count))
+        __rtp_fec_reset(f);
+    if (!f->count)
+        f->base = seq;
+
+    f->head[0] ^= hdr[0];
+    f->head[1] ^= hdr[1];
+    for (int i = 0; i < 4; i++) {
+        f->ts[i] ^= hdr[4 + i];
+        f->stamp[i] = hdr[4 + i];
+    }
+
+    /* the header sits in the first vector, whatever follows it is payload */
+    for (int i = 0; i < iovcnt; i++) {
+        const unsigned char *p = iov[i].iov_base;
+        size_t len = iov[i].iov_len;
+
+        if (!i) {
+            p += sizeof(rtp_hdr_t);
+            len -= sizeof(rtp_hdr_t);
+        }
+        for (size_t j = 0; j < len; j++)
+            f->payload[off + j] ^= p[j];
+        off += len;
+    }
+
+    f->length ^= off;
+    f->size = max(f->size, (unsigned short)off);
+    f->idr |= keyframe;
+    f->count++;
+
+    /* a lost IDR packet costs a whole GOP, so those get twice the parity */
+    limit = f->idr ? max(f->group / 2, 1U) : f->group;
+    if (f->count >= limit || last)
+        __rtp_fec_send(con);
+    if (last)
+        f->idr = 0;
+}
+
+/* RFC 5109 with a level 0 header and the short mask, on its own track */
+static inline void __rtp_fec_send(struct connection_item_t *con)
+{
+    struct __rtp_fec_t *f = &con->fec;
+    unsigned char hdr[sizeof(rtp_hdr_t) + __RTP_FEC_HEADER + __RTP_FEC_LEVEL] = {0};
+    unsigned char *fec = hdr + sizeof(rtp_hdr_t);
+    rtp_hdr_t *rtp = (rtp_hdr_t *)hdr;
+    unsigned short mask = 0xFFFF << (16 - f->count);
+    struct sockaddr_in to = con->addr;
+    struct iovec iov[2] = {
+        { .iov_base = hdr, .iov_len = sizeof(hdr) },
+        { .iov_base = f->payload, .iov_len = f->size } };
+    struct __rtp_mmsghdr msg = { .msg_hdr = {
+        .msg_name = &to, .msg_namelen = sizeof(to),
+        .msg_iov = iov, .msg_iovlen = 2 } };
+
+    to.sin_port = htons(con->trans[__RTSP_TRACK_FEC].client_port_rtp);
+
+    rtp->version = RTP_VERSION;
+    rtp->pt = __RTP_FEC_PT;
+    rtp->seq = htons(con->trans[__RTSP_TRACK_FEC].rtp_seq);
+    memcpy(&rtp->ts, f->stamp, sizeof(f->stamp));
+    rtp->ssrc = htonl(con->ssrc);
+
+    /* E and L clear, then the P, X and CC recovery bits */
+    fec[0] = f->head[0] & 0x3F;
+    fec[1] = f->head[1];
+    fec[2] = f->base >> 8;
+    fec[3] = f->base & 0xFF;
+    memcpy(fec + 4, f->ts, sizeof(f->ts));
+    fec[8] = f->length >> 8;
+    fec[9] = f->length & 0xFF;
+    fec[10] = f->size >> 8;
+    fec[11] = f->size & 0xFF;
+    fec[12] = mask >> 8;
+    fec[13] = mask & 0xFF;
+
+    /* parity is only worth anything on time, a full socket just skips it */
+    if (__rtp_sendmmsg(con->trans[__RTSP_TRACK_FEC].server_rtp_fd, &msg, 1) == 1) {
+        con->trans[__RTSP_TRACK_FEC].rtp_seq += 1;
+        con->trans[__RTSP_TRACK_FEC].rtp_timestamp = ntohl(rtp->ts);
+        con->trans[__RTSP_TRACK_FEC].rtcp_packet_cnt += 1;
+        con->trans[__RTSP_TRACK_FEC].rtcp_octet += sizeof(hdr) + f->size;
+
+        if ((con->trans[__RTSP_TRACK_FEC].rtcp_tick)-- == 0)
+            __rtcp_send_sr(con, __RTSP_TRACK_FEC);
+    }
+
+    __rtp_fec_reset(f);
+}
+
+static inline int __rtp_send_interleaved(struct connection_item_t *con, int track_id, struct __rtp_batch_t *b)
+{
+    struct nal_rtp_t *rtp;
+
+    for (int i = 0; i < b->count; i++) {
+        rtp = &b->pkt[i];
+
+        /* after a drop, hold the track back until the decoder can resync */
+        if (con->trans[track_id].wait_key) {
+            if (!rtp->keyframe) continue;
+            con->trans[track_id].wait_key = 0;
+        }
+
+        __rtp_stamp(con, track_id, rtp, b->ts);
+
+        unsigned char frame[4] = { '$', con->trans[track_id].channel_rtp,
+            rtp->rtpsize >> 8, rtp->rtpsize & 0xFF };
+        struct iovec iov[3] = {
+            { .iov_base = frame, .iov_len = sizeof(frame) },
+            b->iov[i * 2], b->iov[i * 2 + 1] };
+
+        if (__con_out_write(con, iov, 3, TRUE) != SUCCESS) {
+            DBG("interleaved backlog full, dropping to the next keyframe\n");
+            con->trans[track_id].stat.dropped += 1;
+            con->trans[track_id].wait_key = 1;
+            continue;
+        }
+
+        con->trans[track_id].rtcp_packet_cnt += 1;
+        con->trans[track_id].rtcp_octet += rtp->rtpsize;
+    }
+
+    return SUCCESS;
+}
+
+static inline int __rtp_send_udp(struct connection_item_t *con, int track_id, struct __rtp_batch_t *b)
+{
+    struct sockaddr_in to = con->addr;
+    int ret, sent = 0;
+    char fec = track_id == 0 && con->fec.group &&
+        con->trans[__RTSP_TRACK_FEC].transport == __TRANSPORT_UDP;
+
+    /* after a drop, hold the track back until the decoder can resync */
+    if (con->trans[track_id].wait_key) {
+        while (sent < b->count && !b->pkt[sent].keyframe) sent++;
+        if (sent == b->count) return SUCCESS;
+        con->trans[track_id].wait_key = 0;
+    }
+
+    to.sin_port = htons(con->trans[track_id].client_port_rtp);
+
+    /* the kernel copies the datagrams out, so the shared headers can be
+       restamped and readdressed for every connection */
+    for (int i = sent; i < b->count; i++) {
+        if (track_id == 0 && b->kept)
+            __rtp_nack_keep(&con->nack, con->trans[track_id].rtp_seq, b->pos + i);
+        __rtp_stamp(con, track_id, &b->pkt[i], b->ts);
+        b->msg[i].msg_hdr.msg_name = &to;
+        b->msg[i].msg_hdr.msg_namelen = sizeof(to);
+    }
+
+    while (sent < b->count) {
+        ret = __rtp_sendmmsg(con->trans[track_id].server_rtp_fd,
+            b->msg + sent, b->count - sent);
+
+        if (ret > 0) {
+            for (int i = sent; i < sent + ret; i++) {
+                con->trans[track_id].rtcp_packet_cnt += 1;
+                con->trans[track_id].rtcp_octet += b->pkt[i].rtpsize;
+                if (fec)
+                    __rtp_fec_add(con, &b->iov[i * 2], 2, b->pkt[i].keyframe, i == b->count - 1);
+            }
+            sent += ret;
+            continue;
+        } else if (con->con_state != __CON_S_PLAYING) {
             DBG("connection state changed before send\n");
             return SUCCESS;
-        } else
-            usleep(5000);
-    } while (++attempts < 10 && 
-        send_bytes == -1 && (errno == EAGAIN || errno == EWOULDBLOCK));
-    
-    ERR("send:%d:%s\n", send_bytes, strerror(errno));
+        } else if (!ret || errno == EAGAIN || errno == EWOULDBLOCK) {
+            /* this is the encoder's thread, a full socket buffer costs the
+               rest of the unit rather than a wait */
+            DBG("socket buffer full, dropping to the next keyframe\n");
+            con->trans[track_id].stat.dropped += b->count - sent;
+            con->trans[track_id].wait_key = 1;
+            return SUCCESS;
+        }
+
+        break;
+    }
+
+    if (sent == b->count)
+        return SUCCESS;
+
+    ERR("send:%d/%d:%s\n", sent, b->count, strerror(errno));
     return FAILURE;
 }
 
-static inline int __rtp_send(struct nal_rtp_t *rtp, struct list_head_t *trans_list)
+/* the GOP cache up to the access unit in 'b', straight out of the ring:
+   this thread is the one that writes it, so nothing can move underneath */
+static inline void __rtp_prime(struct __rtsp_mount_t *m, struct connection_item_t *con, struct __rtp_batch_t *b)
 {
-    return list_map_inline(trans_list, (__rtp_send_eachconnection), rtp);
+    struct __rtp_pace_t *p = m->pace;
+    struct sockaddr_in to = con->addr;
+    struct __rtp_slot_t *slot;
+    rtp_hdr_t hdr;
+    unsigned char frame[4] = { '$', con->trans[0].channel_rtp };
+    struct iovec iov[3] = {
+        { .iov_base = frame, .iov_len = sizeof(frame) },
+        { .iov_base = &hdr, .iov_len = sizeof(hdr) } };
+    struct msghdr msg = {
+        .msg_name = &to, .msg_namelen = sizeof(to),
+        .msg_iov = iov + 1, .msg_iovlen = 2 };
+    int ret, count = 0;
+
+    con->trans[0].prime = 0;
+
+    /* an IDR of its own needs no priming, nor can a GOP the ring lost */
+    if (!b->kept || !p->keyed || (int)(b->pos - p->key) <= 0 || b->pos - p->key > p->size)
+        return;
+
+    to.sin_port = htons(con->trans[0].client_port_rtp);
+
+    for (unsigned int pos = p->key; pos != b->pos; pos++) {
+        slot = &p->slot[pos & (p->size - 1)];
+
+        /* the slot is shared with the pacer, only a copy of the header is
+           stamped for this session */
+        memcpy(&hdr, slot->data, sizeof(hdr));
+        hdr.seq = htons(con->trans[0].rtp_seq);
+        hdr.ts = htonl(slot->ts);
+        hdr.ssrc = htonl(con->ssrc);
+        iov[2].iov_base = slot->data + sizeof(hdr);
+        iov[2].iov_len = slot->len - sizeof(hdr);
+
+        if (con->trans[0].transport == __TRANSPORT_TCP) {
+            frame[2] = slot->len >> 8;
+            frame[3] = slot->len & 0xFF;
+            ret = __con_out_write(con, iov, 3, TRUE);
+            if (ret != SUCCESS) {
+                DBG("GOP cache larger than the backlog, waiting for a keyframe\n");
+                con->trans[0].wait_key = 1;
+                break;
+            }
+        } else if (sendmsg(con->trans[0].server_rtp_fd, &msg, 0) < 0) {
+            DBG("priming cut short:%s, waiting for a keyframe\n", strerror(errno));
+            con->trans[0].wait_key = 1;
+            break;
+        }
+
+        __rtp_nack_keep(&con->nack, con->trans[0].rtp_seq, pos);
+        con->trans[0].rtp_seq += 1;
+        con->trans[0].rtp_timestamp = slot->ts;
+        con->trans[0].rtcp_packet_cnt += 1;
+        con->trans[0].rtcp_octet += slot->len;
+        count++;
+    }
+
+    con->trans[0].stat.dropped += b->pos - p->key - count;
+    DBG("primed with %d cached packets\n", count);
 }
 
+static inline int __rtp_send_eachconnection(struct __rtsp_mount_t *m, struct connection_item_t *con, int track_id, struct __rtp_batch_t *b)
+{
+    /* the set may be older than the session's last request */
+    if (con->con_state != __CON_S_PLAYING || con->mount != m) return SUCCESS;
+    if (con->trans[track_id].transport == __TRANSPORT_NONE ||
+        con->trans[track_id].transport == __TRANSPORT_MULTICAST) return SUCCESS;
+
+    /* paced receivers are primed by the pacer */
+    if (con->trans[track_id].prime &&
+        (con->trans[track_id].transport == __TRANSPORT_TCP || !b->paced))
+        __rtp_prime(m, con, b);
+
+    if (con->trans[track_id].transport == __TRANSPORT_TCP)
+        return __rtp_send_interleaved(con, track_id, b);
+    if (b->paced)
+        return SUCCESS;
+
+    return __rtp_send_udp(con, track_id, b);
+}
+
+static inline int __rtp_send(struct __rtsp_mount_t *m, struct __rtsp_subs_t *s, int track_id, struct __rtp_batch_t *b)
+{
+    for (int i = 0; i < b->count; i++) {
+        b->iov[i * 2].iov_base = &(b->pkt[i].packet);
+        b->iov[i * 2].iov_len = sizeof(rtp_hdr_t) + b->pkt[i].headsize;
+        b->iov[i * 2 + 1].iov_base = b->pkt[i].payload;
+        b->iov[i * 2 + 1].iov_len = b->pkt[i].payloadsize;
+        memset(&b->msg[i], 0, sizeof(b->msg[i]));
+        b->msg[i].msg_hdr.msg_iov = &b->iov[i * 2];
+        b->msg[i].msg_hdr.msg_iovlen = 2;
+    }
+
+    for (int i = 0; i < s->count; i++)
+        ASSERT(__rtp_send_eachconnection(m, s->con[i], track_id, b) == SUCCESS, return FAILURE);
+
+    return SUCCESS;
+}
 
-static inline int __rtp_setup_transfer(struct list_t *e, void *v)
+/* a single copy, whatever the number of viewers on the group */
+static inline int __rtp_send_group(struct __rtsp_mount_t *m, int track_id, struct __rtp_batch_t *b)
+{
+    struct connection_item_t *g = m->mcast;
+
+    ASSERT(__rtp_send_udp(g, track_id, b) == SUCCESS, return FAILURE);
+
+    if ((g->trans[track_id].rtcp_tick)-- == 0)
+        ASSERT(__rtcp_send_sr(g, track_id) == SUCCESS, return FAILURE);
+
+    return SUCCESS;
+}
+
+/* the pacer sends the reports of the receivers it serves */
+static inline int __rtcp_poll(struct __rtsp_mount_t *m, struct __rtsp_subs_t *s, int track_id, char paced)
 {
     struct connection_item_t *con;
-    struct __transfer_set_t *trans_set = v;
-    struct transfer_item_t *trans;
-    unsigned int timestamp_offset;
-    int ret = FAILURE;
 
-    list_upcast(con,e);
+    for (int i = 0; i < s->count; i++) {
+        con = s->con[i];
+        if (con->con_state != __CON_S_PLAYING || con->mount != m ||
+            con->trans[track_id].transport == __TRANSPORT_NONE ||
+            con->trans[track_id].transport == __TRANSPORT_MULTICAST) continue;
+        if (paced && con->trans[track_id].transport == __TRANSPORT_UDP) continue;
+
+        if ((con->trans[track_id].rtcp_tick)-- == 0) {
+            ASSERT(__rtcp_send_sr(con, track_id) == SUCCESS, return FAILURE);
+
+            /* postcondition check */
+            DASSERT(con->trans[track_id].rtcp_tick == 
+                con->trans[track_id].rtcp_tick_org, return FAILURE);
+            DASSERT(con->trans[track_id].rtcp_packet_cnt == 0, return FAILURE);
+            DASSERT(con->trans[track_id].rtcp_octet == 0, return FAILURE);
+        }
+    }
 
-    MUST(bufpool_attach(con->pool, con) == SUCCESS,
-        return FAILURE);
+    return SUCCESS;
+}
+
+/* enough slots for 'window_ms' of the stream at 'kbps' */
+static inline struct __rtp_pace_t *__rtp_pace_create(unsigned int kbps, unsigned int window_ms)
+{
+    struct __rtp_pace_t *p;
+    unsigned int size = __RTP_PACE_SLOTS_MIN;
+    unsigned long long want = kbps ?
+        (unsigned long long)kbps * 125 * window_ms / 1000 / __RTP_MAXPAYLOADSIZE :
+        __RTP_PACE_SLOTS_MAX;
 
-    if (con->con_state == __CON_S_PLAYING) {
+    while (size < want && size < __RTP_PACE_SLOTS_MAX)
+        size *= 2;
 
-        ASSERT(bufpool_get_free(trans_set->h->transfer_pool, &trans) == SUCCESS, ({
-            ERR("transfer object resouce starvation detected. possibly connection limits are wrongfully setup\n");
-            goto error;}));
+    ASSERT(p = calloc(1, sizeof(*p) + size * sizeof(*p->slot)), return NULL);
+    p->size = size;
 
-        MUST(bufpool_attach(con->pool, con) == SUCCESS,
+    return p;
+}
+
+/* copy the access unit in for the pacer and NACKs. nothing here waits on
+   them: the slots of a session that fell a whole ring behind are reused */
+static inline int __rtp_pace_put(struct __rtsp_mount_t *m, struct __rtp_batch_t *b)
+{
+    struct __rtp_pace_t *p = m->pace;
+    struct __rtp_slot_t *slot;
+    unsigned int head;
+    size_t hsize;
+
+    if (!p) {
+        ASSERT(p = __rtp_pace_create(__atomic_load_n(&m->kbps, __ATOMIC_RELAXED),
+            max(max(m->h->nack_ms, m->h->gop_ms), (unsigned int)__RTP_PACE_WINDOW_MS)),
             return FAILURE);
+        DBG("%s: pacing through %u slots\n", m->path, p->size);
+        __atomic_store_n(&m->pace, p, __ATOMIC_RELEASE);
+    }
 
-        trans->con = con;
+    head = p->head;
+    __atomic_store_n(&p->wr, head + b->count, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
 
-        MUST(list_push(&trans_set->list_head, &trans->list_entry) == SUCCESS,
-            goto error);
+    for (int i = 0; i < b->count; i++) {
+        /* the first keyframe packet of the unit, its parameter sets */
+        if (b->pkt[i].keyframe && (!p->keyed || (int)(p->key - head) < 0)) {
+            __atomic_store_n(&p->key, head + i, __ATOMIC_RELAXED);
+            p->keyed = 1;
+        }
 
-        timestamp_offset = trans_set->h->stat.ts_offset;
+        slot = &p->slot[(head + i) & (p->size - 1)];
+        hsize = sizeof(rtp_hdr_t) + b->pkt[i].headsize;
 
-        con->trans[con->track_id].rtp_timestamp = 
-            ((unsigned int)con->trans[con->track_id].rtp_timestamp + timestamp_offset);
+        memcpy(slot->data, &b->pkt[i].packet, hsize);
+        memcpy(slot->data + hsize, b->pkt[i].payload, b->pkt[i].payloadsize);
+        slot->len = hsize + b->pkt[i].payloadsize;
+        slot->keyframe = b->pkt[i].keyframe;
+        slot->last = i == b->count - 1;
+        slot->ts = b->ts;
     }
 
-    ret = SUCCESS;
+    __atomic_store_n(&p->frames, p->frames + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&p->head, head + b->count, __ATOMIC_RELEASE);
+    b->kept = 1;
+    b->pos = head;
 
-error:
-    ASSERT(bufpool_detach(con->pool, con) == SUCCESS, ret = FAILURE);
+    /* only an idle pacer needs waking */
+    if (b->paced && __atomic_exchange_n(&m->h->pace_idle, 0, __ATOMIC_SEQ_CST))
+        sem_post(&m->h->pace_sem);
 
-    return ret;
+    return SUCCESS;
 }
 
-static inline int __retrieve_sprop(rtsp_handle h, unsigned char *buf, size_t len)
+/* the pacer spreads each access unit over the time to the next one */
+static inline void __rtp_video_clock(struct __rtsp_mount_t *m, unsigned long long timestamp)
 {
-    unsigned char *nalptr;
-    size_t single_len;
-    mime_encoded_handle base64 = NULL;
-    mime_encoded_handle base16 = NULL;
-
-    /* check VPS is set */
-    if (h->isH265 && !(h->sprop_vps_b64)) {
-        nalptr = buf;
-        single_len = 0;
-        while (__split_nal(buf, &nalptr, &single_len, len) == SUCCESS) {
-            if (nalptr[0] >> 1 & 0x3F == H265_NAL_TYPE_VPS) {
-                ASSERT(base64 = mime_base64_create((char *)&(nalptr[0]), single_len), return FAILURE);
-
-                DASSERT(base64->base == 64, return FAILURE);
-
-                /* optimistic lock */
-                rtsp_lock(h);
-                if (h->sprop_vps_b64) {
-                    DBG("vps is set by another thread?\n");
-                    mime_encoded_delete(base64);
-                } else {
-                    h->sprop_vps_b64 = base64;
-                }
-                rtsp_unlock(h);
-            }
+    if (m->frame_us && timestamp > m->frame_us && timestamp - m->frame_us <= 1000000)
+        __atomic_store_n(&m->interval_us, (unsigned int)(timestamp - m->frame_us), __ATOMIC_RELAXED);
+    else if (!m->interval_us)
+        m->interval_us = __RTP_PACE_INTERVAL_US;
+    m->frame_us = timestamp;
+}
+
+/* one packetized access unit of the video to the ring and every viewer */
+static inline int __rtp_send_video(struct __rtsp_mount_t *m, struct __rtsp_subs_t *s, struct __rtp_batch_t *b)
+{
+    int track_id = 0;
+
+    if (b->count) {
+        /* unpaced, the ring is still where NACKs are answered from, and
+           with a GOP cache it follows the stream even with no viewer */
+        if ((b->paced && (s->udp[track_id] || s->mcast[track_id])) ||
+            (s->udp[track_id] && __atomic_load_n(&m->h->nack_budget, __ATOMIC_RELAXED)) ||
+            __atomic_load_n(&m->h->gop_ms, __ATOMIC_RELAXED))
+            ASSERT(__rtp_pace_put(m, b) == SUCCESS, return FAILURE);
+        ASSERT(__rtp_send(m, s, track_id, b) == SUCCESS, return FAILURE);
+        if (s->mcast[track_id] && !b->paced)
+            ASSERT(__rtp_send_group(m, track_id, b) == SUCCESS, return FAILURE);
+    }
+
+    return __rtcp_poll(m, s, track_id, b->paced);
+}
+
+/* refill the session's bucket for the time gone by and send what it
+   allows. TRUE while packets are left waiting */
+static int __rtp_pace_con(struct __rtsp_mount_t *m, struct __rtp_pace_t *p, struct __rtp_pacer_t *w,
+    struct connection_item_t *con, int track_id, unsigned int burst, unsigned long long now)
+{
+    unsigned int head = __atomic_load_n(&p->head, __ATOMIC_ACQUIRE);
+    unsigned int frames = __atomic_load_n(&p->frames, __ATOMIC_RELAXED);
+    unsigned long long tokens;
+    struct sockaddr_in to = con->addr;
+    struct __rtp_slot_t *slot;
+    unsigned int pos, depth;
+    char lagging = 0;
+    char fec = track_id == 0 && con->fec.group &&
+        con->trans[__RTSP_TRACK_FEC].transport == __TRANSPORT_UDP;
+    int n = 0, ret;
+
+    if (!__atomic_load_n(&con->trans[track_id].pace.live, __ATOMIC_ACQUIRE)) {
+        unsigned int key = __atomic_load_n(&p->key, __ATOMIC_RELAXED);
+
+        con->trans[track_id].pace.next = head;
+        con->trans[track_id].pace.frames = frames;
+        con->trans[track_id].pace.rate = 0;
+        con->trans[track_id].pace.tokens = 0;
+        con->trans[track_id].pace.refill_us = now;
+        con->trans[track_id].wait_key = 1;
+
+        /* a new viewer gets the GOP cache at once, the rate being worked
+           out right away for the backlog */
+        if (con->trans[track_id].prime && p->keyed &&
+            (int)(head - key) >= 0 && head - key <= p->size) {
+            con->trans[track_id].pace.next = key;
+            con->trans[track_id].pace.frames = frames - 1;
         }
-        rtsp_lock(h);
-        rtsp_unlock(h);
-        base64 = NULL;
-    }
-
-    /* check SPS is set */
-    if (!(h->sprop_sps_b64)) {
-        nalptr = buf;
-        single_len = 0;
-
-        while (__split_nal(buf, &nalptr, &single_len, len) == SUCCESS) {
-            if ((!(h->isH265) && nalptr[0] & 0x1F == H264_NAL_TYPE_SPS) ||
-                (h->isH265 && nalptr[0] >> 1 & 0x3F == H265_NAL_TYPE_SPS)) {
-                ASSERT(base64 = mime_base64_create((char *)&(nalptr[0]), single_len), return FAILURE);
-                ASSERT(base16 = mime_base16_create((char *)&(nalptr[1]), 3), return FAILURE);
-
-                DASSERT(base16->base == 16, return FAILURE);
-                DASSERT(base64->base == 64, return FAILURE);
-
-                /* optimistic lock */
-                rtsp_lock(h);
-                if (h->sprop_sps_b64) {
-                    DBG("sps is set by another thread?\n");
-                    mime_encoded_delete(base64);
-                } else {
-                    h->sprop_sps_b64 = base64;
-                }
-                
-                if (h->sprop_sps_b16) {
-                    DBG("sps is set by another thread?\n");
-                    mime_encoded_delete(base16);
-                } else {
-                    h->sprop_sps_b16 = base16;
-                }
-                rtsp_unlock(h);
-            }
+        con->trans[track_id].prime = 0;
+        __atomic_store_n(&con->trans[track_id].pace.live, 1, __ATOMIC_RELAXED);
+    }
+
+    if (head - con->trans[track_id].pace.next > p->size) {
+        DBG("pacer fell a ring behind, waiting for a keyframe\n");
+        con->trans[track_id].pace.next = head;
+        con->trans[track_id].wait_key = 1;
+    }
+
+    /* each access unit resets the rate so that whatever is queued goes out
+       within one frame interval, and never slower than the burst factor
+       allows above the target bitrate */
+    if (frames != con->trans[track_id].pace.frames) {
+        unsigned long long backlog = 0, rate;
+        unsigned int interval = __atomic_load_n(&m->interval_us, __ATOMIC_RELAXED);
+        unsigned int kbps = __atomic_load_n(&m->kbps, __ATOMIC_RELAXED);
+
+        for (pos = con->trans[track_id].pace.next; pos != head; pos++)
+            backlog += p->slot[pos & (p->size - 1)].len;
+
+        rate = backlog * 1000000 / max(interval, 1U);
+        rate = max(rate, (unsigned long long)kbps * 125 * burst / 100);
+        con->trans[track_id].pace.rate = min(rate, 0x7FFFFFFFULL);
+        con->trans[track_id].pace.frames = frames;
+    }
+
+    /* a couple of ticks' worth, and never less than one full packet */
+    depth = (unsigned long long)con->trans[track_id].pace.rate * __RTP_PACE_TICK_US * 2 / 1000000 +
+        sizeof(slot->data);
+    tokens = con->trans[track_id].pace.tokens + (unsigned long long)con->trans[track_id].pace.rate *
+        (now - con->trans[track_id].pace.refill_us) / 1000000;
+    con->trans[track_id].pace.tokens = min(tokens, (unsigned long long)depth);
+    con->trans[track_id].pace.refill_us = now;
+
+    to.sin_port = htons(con->trans[track_id].client_port_rtp);
+
+    for (pos = con->trans[track_id].pace.next; pos != head && n < __RTP_PACE_BURST; pos++) {
+        slot = &p->slot[pos & (p->size - 1)];
+
+        if (con->trans[track_id].wait_key && !slot->keyframe) continue;
+        if (con->trans[track_id].pace.tokens < slot->len) break;
+
+        memcpy(&w->pkt[n], slot, offsetof(struct __rtp_slot_t, data) + slot->len);
+
+        /* the encoder may have come round to this slot while it was copied */
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&p->wr, __ATOMIC_RELAXED) - pos > p->size) {
+            lagging = 1;
+            break;
         }
 
-        base64 = NULL;
-        base16 = NULL;
-    }
-
-    /* check PPS is set */
-    if (!(h->sprop_pps_b64)) {
-        nalptr = buf;
-        single_len = 0;
-        while (__split_nal(buf, &nalptr, &single_len, len) == SUCCESS) {
-            if ((!(h->isH265) && nalptr[0] & 0x1F == H264_NAL_TYPE_PPS) ||
-                (h->isH265 && nalptr[0] >> 1 & 0x3F == H265_NAL_TYPE_PPS)) {
-                ASSERT(single_len >= 4, return FAILURE);
-                ASSERT(base64 = mime_base64_create((char *)&(nalptr[0]), single_len), return FAILURE);
-
-                DASSERT(base64->base == 64, return FAILURE);
-
-                /* optimistic lock */
-                rtsp_lock(h);
-                if (h->sprop_pps_b64) {
-                    DBG("pps is set by another thread?\n");
-                    mime_encoded_delete(base64);
-                } else {
-                    h->sprop_pps_b64 = base64;
-                }
-                rtsp_unlock(h);
-            }
+        con->trans[track_id].wait_key = 0;
+        con->trans[track_id].pace.tokens -= w->pkt[n].len;
+
+        rtp_hdr_t *hdr = (rtp_hdr_t *)w->pkt[n].data;
+        hdr->seq = htons((unsigned short)(con->trans[track_id].rtp_seq + n));
+        hdr->ts = htonl(w->pkt[n].ts);
+        hdr->ssrc = htonl(con->ssrc);
+
+        w->iov[n].iov_base = w->pkt[n].data;
+        w->iov[n].iov_len = w->pkt[n].len;
+        memset(&w->msg[n], 0, sizeof(w->msg[n]));
+        w->msg[n].msg_hdr.msg_iov = &w->iov[n];
+        w->msg[n].msg_hdr.msg_iovlen = 1;
+        w->msg[n].msg_hdr.msg_name = &to;
+        w->msg[n].msg_hdr.msg_namelen = sizeof(to);
+        w->pos[n++] = pos;
+    }
+
+    ret = n ? __rtp_sendmmsg(con->trans[track_id].server_rtp_fd, w->msg, n) : 0;
+    if (ret < 0) {
+        /* a full socket is retried on the next tick, anything else is
+           as good as lost on the way */
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR || errno == ENOBUFS) {
+            ret = 0;
+        } else {
+            DBG("send:%s\n", strerror(errno));
+            ret = n;
         }
-        rtsp_lock(h);
-        rtsp_unlock(h);
-        base64 = NULL;
     }
 
-    return SUCCESS;
+    for (int i = 0; i < ret; i++) {
+        con->trans[track_id].rtcp_packet_cnt += 1;
+        con->trans[track_id].rtcp_octet += w->pkt[i].len;
+        con->trans[track_id].rtp_timestamp = w->pkt[i].ts;
+        __rtp_nack_keep(&con->nack, con->trans[track_id].rtp_seq + i, w->pos[i]);
+        if (fec)
+            __rtp_fec_add(con, &w->iov[i], 1, w->pkt[i].keyframe, w->pkt[i].last);
+
+        if (w->pkt[i].last && (con->trans[track_id].rtcp_tick)-- == 0)
+            __rtcp_send_sr(con, track_id);
+    }
+    con->trans[track_id].rtp_seq += ret;
+
+    /* what the socket did not take is paid back and tried again */
+    for (int i = ret; i < n; i++)
+        con->trans[track_id].pace.tokens += w->pkt[i].len;
+    con->trans[track_id].pace.next = ret < n ? w->pos[ret] : pos;
+
+    if (lagging) {
+        DBG("pacer overrun while copying, waiting for a keyframe\n");
+        con->trans[track_id].pace.next = head;
+        con->trans[track_id].wait_key = 1;
+    }
+
+    return con->trans[track_id].pace.next != head;
 }
 
-static inline int __rtcp_poll(struct list_t *e, void *v)
+/* every paced viewer of the mount's video, TRUE while one has a backlog */
+static int __rtp_pace_mount(struct __rtsp_mount_t *m, struct __rtp_pacer_t *w,
+    unsigned int burst, unsigned long long now)
 {
+    struct __rtp_pace_t *p = __atomic_load_n(&m->pace, __ATOMIC_ACQUIRE);
     struct connection_item_t *con;
-    struct transfer_item_t *trans;
-    int *track_id = v;
+    struct __rtsp_subs_t *s;
+    int busy = FALSE;
+    int slot;
+
+    if (!p) return FALSE;
 
-    list_upcast(trans, e);
-    MUST(con = trans->con, return FAILURE);
+    s = __subs_enter(m, &slot);
 
-    if ((con->trans[*track_id].rtcp_tick)-- == 0) {
-        ASSERT(__rtcp_send_sr(con) == SUCCESS, return FAILURE);
+    for (int i = 0; i < s->count; i++) {
+        con = s->con[i];
+        if (con->con_state != __CON_S_PLAYING || con->mount != m ||
+            con->trans[0].transport != __TRANSPORT_UDP) continue;
 
-        /* postcondition check */
-        DASSERT(con->trans[*track_id].rtcp_tick == 
-            con->trans[*track_id].rtcp_tick_org, return FAILURE);
-        DASSERT(con->trans[*track_id].rtcp_packet_cnt == 0, return FAILURE);
-        DASSERT(con->trans[*track_id].rtcp_octet == 0, return FAILURE);
+        busy |= __rtp_pace_con(m, p, w, con, 0, burst, now);
     }
 
-    return SUCCESS;
+    /* the group starts over from the live edge once it had no one left */
+    if (m->mcast) {
+        if (s->mcast[0])
+            busy |= __rtp_pace_con(m, p, w, m->mcast, 0, burst, now);
+        else
+            m->mcast->trans[0].pace.live = 0;
+    }
+
+    __subs_leave(m, slot);
+
+    return busy;
 }
+
 /******************************************************************************
  *              PUBLIC FUNCTIONS
  ******************************************************************************/
@@ -369,80 +959,270 @@ void rtp_disable_audio(rtsp_handle h)
     h->audioPt = 255;
 }
 
-int rtp_send_h26x(rtsp_handle h, unsigned char *buf, size_t len, char isH265)
+int rtp_send_h26x_nals(rtsp_mount_handle m, const struct rtp_nal_t *nal, int count, char isH265,
+    unsigned long long timestamp)
 {
-    unsigned char *nalptr = buf;
-    size_t single_len = 0;
     int ret = FAILURE;
     int track_id = 0;
-    struct __transfer_set_t trans = {};
+    struct __rtsp_subs_t *s;
+    int slot;
 
     /* checkout RTP packet */
-    DASSERT(h, return FAILURE);
+    DASSERT(m, return FAILURE);
 
-    if (gbl_get_quit(h->pool->sharedp->gbl)) {
+    if (gbl_get_quit(m->h->pool->sharedp->gbl)) {
 #ifdef DEBUG_RTSP
         ERR("server threads have gone already. call rtsp_finish()\n");
 #endif
         return FAILURE;
     }
 
-    h->isH265 = isH265;
-
-    ASSERT(__retrieve_sprop(h, buf, len) == SUCCESS, goto error);
+    m->isH265 = isH265;
+    m->isJpeg = 0;
+    __rtp_video_clock(m, timestamp);
 
-    trans.h = h;
-
-    /* setup transmission objecl t*/
-    ASSERT(list_map_inline(&h->con_list, (__rtp_setup_transfer), &trans) == SUCCESS, goto error);
+    /* nothing to allocate nor to lock, whatever the number of viewers */
+    s = __subs_enter(m, &slot);
     
-    if (trans.list_head.list) {
-        while (__split_nal(buf, &nalptr, &single_len, len) == SUCCESS) {
-            ASSERT(__transfer_nal_h26x(&(trans.list_head), nalptr, single_len, h->isH265) == SUCCESS, goto error);
+    /* with a GOP cache, the ring follows the stream even with no viewer */
+    if (s->count || s->mcast[track_id] || __atomic_load_n(&m->h->gop_ms, __ATOMIC_RELAXED)) {
+        char has_vcl = 0;
+
+        m->batch->count = 0;
+        m->batch->ts = __rtp_clock(timestamp, __RTP_CLOCK_VIDEO);
+        m->batch->paced = __atomic_load_n(&m->h->pace_burst, __ATOMIC_RELAXED) != 0;
+        m->batch->kept = 0;
+        for (int i = 0; i < count; i++) {
+            ASSERT(__transfer_nal_h26x(m->batch, nal[i].data, nal[i].size, m->isH265) == SUCCESS, goto error);
+            has_vcl |= m->isH265 ? nal[i].type < H265_NAL_TYPE_VPS :
+                (nal[i].type >= 1 && nal[i].type <= H264_NAL_TYPE_IDR);
         }
-        ASSERT(list_map_inline(&(trans.list_head), (__rtcp_poll), &track_id) == SUCCESS, goto error);
+        /* one marker per picture, however many slices it was coded in */
+        if (has_vcl && m->batch->count)
+            m->batch->pkt[m->batch->count - 1].packet.header.m = 1;
+        ASSERT(__rtp_send_video(m, s, m->batch) == SUCCESS, goto error);
     } 
 
     ret = SUCCESS;
 
 error:
-    list_destroy(&(trans.list_head));
+    __subs_leave(m, slot);
 
     return ret;
 }
 
-int rtp_send_mp3(rtsp_handle h, unsigned char *buf, size_t len)
+int rtp_send_h26x(rtsp_mount_handle m, unsigned char *buf, size_t len, char isH265)
+{
+    struct rtp_nal_t nal[RTP_MAXIMUM_NALS];
+    unsigned char *nalptr = buf;
+    size_t single_len = 0;
+    int count = 0;
+
+    while (count < RTP_MAXIMUM_NALS &&
+        __split_nal(buf, &nalptr, &single_len, len) == SUCCESS) {
+        nal[count].data = nalptr;
+        nal[count].size = single_len;
+        nal[count].type = isH265 ? (nalptr[0] >> 1 & 0x3F) : (nalptr[0] & 0x1F);
+        nal_paramset_update(&m->raw_params, (char *)nalptr, single_len, isH265);
+        count++;
+    }
+
+    rtsp_set_params(m, &m->raw_params);
+
+    return rtp_send_h26x_nals(m, nal, count, isH265, __rtp_now());
+}
+
+int rtp_send_jpeg(rtsp_mount_handle m, const unsigned char *buf, size_t len,
+    unsigned long long timestamp)
+{
+    int ret = FAILURE;
+    int track_id = 0;
+    struct __rtsp_subs_t *s;
+    struct __rtp_jpeg_t j;
+    int slot;
+
+    DASSERT(m, return FAILURE);
+
+    if (gbl_get_quit(m->h->pool->sharedp->gbl)) {
+#ifdef DEBUG_RTSP
+        ERR("server threads have gone already. call rtsp_finish()\n");
+#endif
+        return FAILURE;
+    }
+
+    /* nothing a receiver could decode, the frame is not worth sending */
+    if (__jpeg_parse(buf, len, &j) != SUCCESS) {
+        DBG("%s: not a baseline JPEG RTP can carry\n", m->path);
+        return FAILURE;
+    }
+
+    m->isJpeg = 1;
+    __rtp_video_clock(m, timestamp);
+
+    s = __subs_enter(m, &slot);
+
+    /* every frame is a keyframe, the cache holds the last one */
+    if (s->count || s->mcast[track_id] || __atomic_load_n(&m->h->gop_ms, __ATOMIC_RELAXED)) {
+        m->batch->count = 0;
+        m->batch->ts = __rtp_clock(timestamp, __RTP_CLOCK_VIDEO);
+        m->batch->paced = __atomic_load_n(&m->h->pace_burst, __ATOMIC_RELAXED) != 0;
+        m->batch->kept = 0;
+        ASSERT(__transfer_jpeg(m->batch, &j, m->jpeg_first) == SUCCESS, goto error);
+        ASSERT(__rtp_send_video(m, s, m->batch) == SUCCESS, goto error);
+    }
+
+    ret = SUCCESS;
+
+error:
+    __subs_leave(m, slot);
+
+    return ret;
+}
+
+int rtp_send_mp3(rtsp_mount_handle m, unsigned char *buf, size_t len, unsigned long long timestamp)
 {
     int ret = FAILURE;
     int track_id = 1;
-    struct __transfer_set_t trans = {};
+    struct __rtsp_subs_t *s;
+    int slot;
+    struct nal_rtp_t rtp;
+    struct __rtp_mmsghdr msg;
+    struct iovec iov[2];
+    struct __rtp_batch_t batch = { .pkt = &rtp, .msg = &msg, .iov = iov, .size = 1,
+        .ts = __rtp_clock(timestamp, __RTP_CLOCK_MPA) };
 
     /* checkout RTP packet */
-    DASSERT(h, return FAILURE);
+    DASSERT(m, return FAILURE);
 
-    if (gbl_get_quit(h->pool->sharedp->gbl)) {
+    if (gbl_get_quit(m->h->pool->sharedp->gbl)) {
 #ifdef DEBUG_RTSP
         ERR("server threads have gone already. call rtsp_finish()\n");
 #endif
         return FAILURE;
     }
 
-    h->audioPt = 14;
+    m->h->audioPt = 14;
 
-    trans.h = h;
-
-    /* setup transmission objecl t*/
-    ASSERT(list_map_inline(&h->con_list, (__rtp_setup_transfer), &trans) == SUCCESS, goto error);
+    s = __subs_enter(m, &slot);
     
-    if (trans.list_head.list) {
-        ASSERT(__transfer_nal_mpga(&(trans.list_head), buf, len) == SUCCESS, goto error);
-        ASSERT(list_map_inline(&(trans.list_head), (__rtcp_poll), &track_id) == SUCCESS, goto error);
+    if (s->count || s->mcast[track_id]) {
+        ASSERT(__transfer_nal_mpga(&batch, buf, len) == SUCCESS, goto error);
+        ASSERT(__rtp_send(m, s, track_id, &batch) == SUCCESS, goto error);
+        if (s->mcast[track_id])
+            ASSERT(__rtp_send_group(m, track_id, &batch) == SUCCESS, goto error);
+        ASSERT(__rtcp_poll(m, s, track_id, FALSE) == SUCCESS, goto error);
     } 
 
     ret = SUCCESS;
 
 error:
-    list_destroy(&(trans.list_head));
+    __subs_leave(m, slot);
+
+    return ret;
+}
+
+int rtp_send_g711(rtsp_mount_handle m, unsigned char *buf, size_t len, char alaw,
+    unsigned long long timestamp)
+{
+    int ret = FAILURE;
+    int track_id = 1;
+    unsigned int pt = alaw ? 8 : 0;
+    struct __rtsp_subs_t *s;
+    int slot;
+    struct nal_rtp_t rtp;
+    struct __rtp_mmsghdr msg;
+    struct iovec iov[2];
+    struct __rtp_batch_t batch = { .pkt = &rtp, .msg = &msg, .iov = iov, .size = 1 };
+    size_t chunk;
+
+    DASSERT(m, return FAILURE);
+
+    if (gbl_get_quit(m->h->pool->sharedp->gbl)) {
+#ifdef DEBUG_RTSP
+        ERR("server threads have gone already. call rtsp_finish()\n");
+#endif
+        return FAILURE;
+    }
+
+    m->h->audioPt = pt;
+
+    s = __subs_enter(m, &slot);
+
+    if (s->count || s->mcast[track_id]) {
+        /* however the capture is framed, receivers get their usual ptime,
+           each packet stamped with its first sample */
+        for (size_t off = 0; off < len; off += chunk) {
+            chunk = min(len - off, (size_t)__RTP_G711_SAMPLES);
+            batch.count = 0;
+            batch.ts = __rtp_clock(timestamp, __RTP_CLOCK_G711) + off;
+            ASSERT(__transfer_g711(&batch, pt, buf + off, chunk) == SUCCESS, goto error);
+            ASSERT(__rtp_send(m, s, track_id, &batch) == SUCCESS, goto error);
+            if (s->mcast[track_id])
+                ASSERT(__rtp_send_group(m, track_id, &batch) == SUCCESS, goto error);
+        }
+        ASSERT(__rtcp_poll(m, s, track_id, FALSE) == SUCCESS, goto error);
+    }
+
+    ret = SUCCESS;
+
+error:
+    __subs_leave(m, slot);
 
     return ret;
-}
\ No newline at end of file
+}
+
+/******************************************************************************
+ *              THREAD CALLBACKS
+ ******************************************************************************/
+/* spreads the video of every mount over time for its UDP receivers, so that
+   an IDR no longer leaves as one burst of back-to-back datagrams */
+void *rtpThrFxn(void *v)
+{
+    thread_handle           h = v;
+    rtsp_handle             rh = h->sharedp->param_shared;
+    void                    *status = THREAD_FAILURE;
+    struct __rtp_pacer_t    *w = NULL;
+    struct timespec         ts;
+    unsigned int burst;
+    int busy, mounts;
+
+    DASSERT(thread_check_isoleted_job(h) == SUCCESS, goto error);
+    TALLOC(w, goto error);
+
+    thread_sync_init(h);
+
+    while (!gbl_get_quit(h->sharedp->gbl)) {
+        burst = __atomic_load_n(&rh->pace_burst, __ATOMIC_RELAXED);
+        mounts = __atomic_load_n(&rh->mount_num, __ATOMIC_ACQUIRE);
+        busy = FALSE;
+
+        if (burst)
+            for (int i = 0; i < mounts; i++)
+                busy |= __rtp_pace_mount(rh->mount[i], w, burst, __rtp_now());
+
+        if (busy) {
+            usleep(__RTP_PACE_TICK_US);
+            continue;
+        }
+
+        /* a frame put in before the flag went up was not signalled, so
+           one more pass is made with it up before going to sleep */
+        if (!__atomic_load_n(&rh->pace_idle, __ATOMIC_SEQ_CST)) {
+            __atomic_store_n(&rh->pace_idle, 1, __ATOMIC_SEQ_CST);
+            continue;
+        }
+
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += 1;
+        while (sem_timedwait(&rh->pace_sem, &ts) < 0 && errno == EINTR);
+    }
+
+    status = THREAD_SUCCESS;
+error:
+    /* Make sure the other threads aren't waiting for us */
+    thread_sync_cleanup(h);
+
+    FREE(w);
+
+    return status;
+}
@@ -5,12 +5,54 @@
 extern "C" {
 #endif
 
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../fmt/nal.h"
 #include "../hal/tools.h"
 
 /******************************************************************************
  *              DEFINITIONS 
  ******************************************************************************/
 #define __RTP_MAXPAYLOADSIZE 1460
+#define __RTP_BATCH_INITIAL 64
+#define __RTP_CLOCK_VIDEO 90000
+#define __RTP_CLOCK_MPA 90000
+#define __RTP_CLOCK_G711 8000
+/* G.711 samples per packet, 20 ms as RFC 3551 has it by default */
+#define __RTP_G711_SAMPLES 160
+/* the pacer wakes this often while a session has packets left to send */
+#define __RTP_PACE_TICK_US 1000
+/* at most this many datagrams per session and wakeup */
+#define __RTP_PACE_BURST 32
+/* the ring keeps about this much of the stream at its target bitrate */
+#define __RTP_PACE_WINDOW_MS 1000
+#define __RTP_PACE_SLOTS_MIN 128
+#define __RTP_PACE_SLOTS_MAX 2048
+/* assumed before two frames have given the actual interval */
+#define __RTP_PACE_INTERVAL_US 40000
+/* RFC 5109 parity, on a track of its own */
+#define __RTP_FEC_PT 127
+#define __RTP_FEC_HEADER 10
+#define __RTP_FEC_LEVEL 4   /* level 0 with the short mask */
+#define __RTP_FEC_GROUP_MAX 16
+/* packets of a session that a NACK can still get resent, a power of two */
+#define __RTP_NACK_HISTORY 512
+/* assumed for the resend budget of a mount that was given no bitrate */
+#define __RTP_NACK_KBPS 2000
+/* RFC 2435, with the quantization tables sent along with every frame */
+#define __RTP_JPEG_PT 26
+#define __RTP_JPEG_HEADER 8
+#define __RTP_JPEG_RESTART 4
+#define __RTP_JPEG_QTABLES (4 + 2 * 64)
+#define __RTP_JPEG_Q 255
+/* dimensions are carried in 8 pixel blocks, on a byte */
+#define __RTP_JPEG_SIZE_MAX 2040
 
 /******************************************************************************
  *              DATA STRUCTURES
@@ -40,58 +82,238 @@ typedef struct {
     //unsigned int csrc[1];     /* optional CSRC list */
 } rtp_hdr_t;
 
+/*
+ * Only the header bytes live here; the payload is sent straight out of
+ * the encoder's buffer, which stays valid until rtp_send_*() returns
+ */
 struct nal_rtp_t {
     struct {
         rtp_hdr_t header;
-        unsigned char payload[__RTP_MAXPAYLOADSIZE];
+        /* FU, MPA or JPEG header, ahead of the payload */
+        unsigned char head[__RTP_JPEG_HEADER + __RTP_JPEG_RESTART];
     } packet;
+    unsigned char headsize;
+    unsigned char *payload;
+    int    payloadsize;
     int    rtpsize;
-    struct list_t list_entry;
+    /* first packet a decoder can resume from after drops */
+    char   keyframe;
+};
+
+/* same layout as the kernel's struct mmsghdr, which older libcs lack */
+struct __rtp_mmsghdr {
+    struct msghdr msg_hdr;
+    unsigned int msg_len;
+};
+
+/*
+ * Every packet of one access unit, packetized once and then handed to each
+ * connection in as few syscalls as the transport allows
+ */
+struct __rtp_batch_t {
+    struct nal_rtp_t *pkt;
+    struct __rtp_mmsghdr *msg;
+    struct iovec *iov;
+    int count;
+    int size;
+    unsigned int ts; /* media clock of the access unit, same for every packet */
+    char paced;      /* UDP receivers are left to the pacer */
+    char kept;       /* copied into the ring as well, from 'pos' on */
+    unsigned int pos;
+};
+
+/* one packet as the pacer sends it, the header stamped per session */
+struct __rtp_slot_t {
+    unsigned short len;
+    char keyframe;
+    char last;       /* ends the access unit */
+    unsigned int ts;
+    unsigned char data[sizeof(rtp_hdr_t) + 4 + __RTP_MAXPAYLOADSIZE];
+};
+
+/*
+ * The video of one mount as it is yet to be paced out. The encoder thread
+ * copies each access unit in once and moves 'head' on, and every UDP
+ * session follows with its own cursor. Slots are overwritten without
+ * waiting for anyone, so a reader checks 'wr' after its copy to know
+ * whether the slot was still the packet it wanted
+ */
+struct __rtp_pace_t {
+    unsigned int size;        /* slots, a power of two */
+    unsigned int head;        /* packets published */
+    unsigned int wr;          /* packets published or being written */
+    unsigned int frames;      /* access units published */
+    unsigned int key;         /* first packet of the newest IDR, the GOP cache */
+    char keyed;               /* once there is one */
+    struct __rtp_slot_t slot[];
+};
+
+/*
+ * The parity of a session's video packets as they went out, stamped, so
+ * that a receiver can rebuild any one of a group it lost. A group never
+ * spans two access units, and those holding an IDR are cut half as long
+ */
+struct __rtp_fec_t {
+    unsigned int group;      /* packets per parity packet, 0 for none */
+    unsigned short base;     /* sequence number of the first one */
+    int count;
+    char idr;                /* inside an access unit that holds one */
+    unsigned char head[2];   /* P, X, CC, M and PT, xored */
+    unsigned char ts[4];     /* and so are the timestamps */
+    unsigned char stamp[4];  /* timestamp of the last one, as is */
+    unsigned short length;   /* and the payload lengths */
+    unsigned short size;     /* longest payload so far */
+    unsigned char payload[4 + __RTP_MAXPAYLOADSIZE];
+};
+
+/*
+ * The last packets a session was sent, as positions in its mount's ring so
+ * that no bytes are kept twice. Each entry carries the sequence number in
+ * its top half and the low half of the position below, one word that the
+ * sender stores and the control thread loads without any lock between
+ */
+struct __rtp_nack_t {
+    unsigned int budget;     /* percent of the target bitrate, 0 for none */
+    unsigned int tokens;     /* bytes that may be resent right now */
+    unsigned long long refill_us;
+    unsigned int hist[__RTP_NACK_HISTORY];
+};
+
+/* what the headers of one baseline JPEG frame tell its packetizer */
+struct __rtp_jpeg_t {
+    unsigned char type;       /* 0 for 4:2:2, 1 for 4:2:0, +64 with restarts */
+    unsigned char width;      /* in blocks of 8 pixels */
+    unsigned char height;
+    unsigned short dri;       /* restart interval in MCUs, 0 for none */
+    const unsigned char *qt[2]; /* luma and chroma tables, zigzag order */
+    const unsigned char *scan;  /* entropy-coded data, markers excluded */
+    size_t scansize;
+};
+
+/* what the pacer thread hands to one sendmmsg() call */
+struct __rtp_pacer_t {
+    struct __rtp_slot_t pkt[__RTP_PACE_BURST];
+    unsigned int pos[__RTP_PACE_BURST];
+    struct __rtp_mmsghdr msg[__RTP_PACE_BURST];
+    struct iovec iov[__RTP_PACE_BURST];
 };
 
 /******************************************************************************
  *              DECLARATIONS
  ******************************************************************************/
 static inline int __split_nal(unsigned char *buf, unsigned char **nalptr, size_t *p_len, size_t max_len);
+static inline struct nal_rtp_t *__rtp_batch_next(struct __rtp_batch_t *b);
+static inline void __rtp_batch_delete(struct __rtp_batch_t *b);
+static inline int __rtp_sendmmsg(int fd, struct __rtp_mmsghdr *msg, unsigned int count);
+static inline unsigned int __rtp_clock(unsigned long long usec, unsigned int rate);
+static inline unsigned long long __rtp_now(void);
+static inline void __rtp_nack_keep(struct __rtp_nack_t *n, unsigned short seq, unsigned int pos);
 
 /******************************************************************************
  *              INLINE FUNCTIONS
  ******************************************************************************/
 static inline int __split_nal(unsigned char *buf, unsigned char **nalptr, size_t *p_len, size_t max_len)
 {
-    int i;
-    int start = -1;
-
-    for(i = (*nalptr) - buf + *p_len;i<max_len-5;i++) {
-        if(buf[i] == 0x00 &&
-                buf[i+1] == 0x00 &&
-                buf[i+2] == 0x00 &&
-                buf[i+3] == 0x01) {
-            if(start == -1){
-                i += 4;
-                start = i;
-            } else {
-                *nalptr = &(buf[start]);
-                while(buf[i-1] == 0) i--;
-                *p_len = i - start;
-                return SUCCESS;
-            }
-        }
-    }
+    unsigned char sc_len;
+    uint32_t start, end;
 
-    if(start == -1) {
-        /* malformed NAL */
+    start = nal_find_start(buf, (*nalptr) - buf + *p_len, max_len, &sc_len);
+    if (start >= max_len) {
+        /* no more NAL */
         return FAILURE;
     }
+    start += sc_len;
+
+    /* the NAL runs up to the next start code, minus trailing zero bytes */
+    end = nal_find_start(buf, start, max_len, NULL);
+    while (end > start && buf[end - 1] == 0) end--;
 
     *nalptr = &(buf[start]);
-    *p_len = max_len + 2 - start;
+    *p_len = end - start;
 
     return SUCCESS;
 }
 
+static inline struct nal_rtp_t *__rtp_batch_next(struct __rtp_batch_t *b)
+{
+    if (b->count == b->size) {
+        int size = b->size ? b->size * 2 : __RTP_BATCH_INITIAL;
+        struct nal_rtp_t *pkt = realloc(b->pkt, size * sizeof(*pkt));
+        struct __rtp_mmsghdr *msg;
+        struct iovec *iov;
+
+        if (!pkt) return NULL;
+        b->pkt = pkt;
+        if (!(msg = realloc(b->msg, size * sizeof(*msg)))) return NULL;
+        b->msg = msg;
+        if (!(iov = realloc(b->iov, size * 2 * sizeof(*iov)))) return NULL;
+        b->iov = iov;
+        b->size = size;
+    }
+
+    return &b->pkt[b->count++];
+}
+
+static inline void __rtp_batch_delete(struct __rtp_batch_t *b)
+{
+    if (!b) return;
+
+    FREE(b->pkt);
+    FREE(b->msg);
+    FREE(b->iov);
+    free(b);
+}
+
+/* returns the number of datagrams sent, or -1 when none went out */
+static inline int __rtp_sendmmsg(int fd, struct __rtp_mmsghdr *msg, unsigned int count)
+{
+#ifdef RTSP_SIMULATE_LOSS
+    /* a lossy link on the bench: datagrams vanish as if on the way */
+    for (unsigned int i = 0; i < count; i++) {
+        int ret = rand() % 100 < RTSP_SIMULATE_LOSS ? 0 : sendmsg(fd, &msg[i].msg_hdr, 0);
+        if (ret < 0) return i ? (int)i : -1;
+        msg[i].msg_len = ret;
+    }
+
+    return count;
+#endif
+#ifdef __NR_sendmmsg
+    int ret = syscall(__NR_sendmmsg, fd, msg, count, 0);
+    if (ret >= 0 || errno != ENOSYS) return ret;
+#endif
+    /* kernels before 3.0 */
+    for (unsigned int i = 0; i < count; i++) {
+        int ret = sendmsg(fd, &msg[i].msg_hdr, 0);
+        if (ret < 0) return i ? (int)i : -1;
+        msg[i].msg_len = ret;
+    }
+
+    return count;
+}
+
+/* microseconds to a media clock, split so long uptimes cannot overflow */
+static inline unsigned int __rtp_clock(unsigned long long usec, unsigned int rate)
+{
+    return (unsigned int)((usec / 1000000) * rate + (usec % 1000000) * rate / 1000000);
+}
+
+static inline unsigned long long __rtp_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static inline void __rtp_nack_keep(struct __rtp_nack_t *n, unsigned short seq, unsigned int pos)
+{
+    if (n->budget)
+        __atomic_store_n(&n->hist[seq & (__RTP_NACK_HISTORY - 1)],
+            (unsigned int)seq << 16 | (pos & 0xFFFF), __ATOMIC_RELAXED);
+}
+
 #if defined (__cplusplus)
 }
 #endif
 
-#endif
\ No newline at end of file
+#endif
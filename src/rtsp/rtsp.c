@@ -17,6 +17,8 @@
 #include "bufpool.h"
 #include <netinet/in.h>
 #include <sys/ioctl.h>
+#include <sys/epoll.h>
+#include <stdarg.h>
 
 extern void request_idr();
 
@@ -32,6 +34,9 @@ extern void request_idr();
 #define __STR_TEARDOWN  "TEARDOWN"
 #define __STR_TRANSPORT  "TRANSPORT"
 #define __STR_CLIENTPORT  "client_port"
+#define __STR_INTERLEAVED  "interleaved"
+#define __STR_MULTICAST  "multicast"
+#define __STR_TRANSPORT_TCP  "RTP/AVP/TCP"
 #define __STR_SESSION  "SESSION"
 #define __STR_PAUSE "PAUSE"
 #define __STR_RECORDING "RECORDING"
@@ -45,15 +50,27 @@ extern void request_idr();
 #define __RESPONCE_STR_MOVEDPERM "301 Moved Permanently"
 #define __RESPONCE_STR_SERVERERROR "500 Internal Server Error"
 #define __RESPONCE_STR_OPTIONUNSUPPORTED "551 Option not supported"
+#define __RESPONCE_STR_TRANSUNSUPPORTED "461 Unsupported Transport"
+#define __RESPONCE_STR_NOTFOUND "404 Not Found"
 
 #define __PARSE_ERROR(p) do {ERR("cannot parse '%s' in %s\n", buf, __FUNCTION__); p->parser_state = __PARSER_S_ERROR;}while(0)
 
 /******************************************************************************
  *              PRIVATE DECLARATION
  ******************************************************************************/
-static inline int __bind_rtp(struct connection_item_t *con );
-static inline int __bind_rtcp(struct connection_item_t *con );
+static inline int __bind_udp(rtsp_handle h, int track_id);
 static inline int __bind_tcp(unsigned short port);
+static inline int __bind_mcast(rtsp_handle h, struct __rtsp_mount_t *m, int track_id);
+static struct __rtsp_mount_t *__mount_find(rtsp_handle h, const char *line);
+static struct connection_item_t *__mcast_create(rtsp_handle h, struct __rtsp_mount_t *m);
+static void __mount_delete(struct __rtsp_mount_t *m);
+static void __subs_publish(rtsp_handle h, struct __rtsp_mount_t *m);
+static int __subs_reclaim(struct __rtsp_mount_t *m);
+static inline int __watch(rtsp_handle h, int fd, unsigned int events, struct __watch_t *w);
+
+static void __con_printf(struct connection_item_t *p, const char *fmt, ...);
+static int __interleaved_proc_sock(struct connection_item_t *p);
+static int __con_in_fill(struct connection_item_t *p);
 
 static void __method_auth(struct connection_item_t *p, rtsp_handle h);
 static void __method_options(struct connection_item_t *p, rtsp_handle h);
@@ -63,75 +80,89 @@ static void __method_play(struct connection_item_t *p, rtsp_handle h);
 static void __method_pause(struct connection_item_t *p, rtsp_handle h);
 static void __method_record(struct connection_item_t *p, rtsp_handle h);
 static void __method_error(struct connection_item_t *p, rtsp_handle h);
+static void __method_notfound(struct connection_item_t *p, rtsp_handle h);
+static inline int __gop_cached(rtsp_handle h, struct __rtsp_mount_t *m);
 
 static void *rtspThrFxn(void *v);
 
-static inline int __connection_list_add(bufpool_handle con_pool, struct list_head_t *head,int fd, struct sockaddr_in addr);
+static inline int __connection_list_add(rtsp_handle h, int fd, struct sockaddr_in addr);
 static int __connection_reset(void *v);
-static inline int __accept_proc_sock(rtsp_handle h, int server_fd, struct sock_select_t *p_socks);
-static int __message_proc_sock(struct list_t *e, void *p);
-static inline int __set_select_sock(struct list_t *p, void *param);
-static inline int __find_fd_max(struct list_head_t *head);
+static inline int __accept_proc_sock(rtsp_handle h, int server_fd);
+static int __message_proc_sock(struct connection_item_t *con, rtsp_handle h, unsigned int events);
+static int __request_proc_sock(struct connection_item_t *con, rtsp_handle h);
+static void __rtcp_proc_sock(rtsp_handle h, int track_id);
 
-static inline bufpool_handle __connectionpool_create(int num);
+static inline bufpool_handle __connectionpool_create(int num, int max);
+static inline void __connectionpool_free(void);
 static int __connection_is_dead(struct list_t *l);
+static int __rtcp_timeout_sock(struct list_t *e, void *v);
 
 /******************************************************************************
  *              PRIVATE DATA
  ******************************************************************************/
-static struct connection_item_t __connection_pool[RTSP_MAXIMUM_CONNECTIONS] = {};
-
-static struct transfer_item_t __transfer_pool[RTSP_MAXIMUM_CONNECTIONS] = {};
+/* allocated a chunk at a time as the pool grows, then kept for reuse */
+static struct connection_item_t *__connection_pool[
+    (RTSP_MAXIMUM_CONNECTIONS + __RTSP_POOL_CHUNK - 1) / __RTSP_POOL_CHUNK] = {};
 
 /******************************************************************************
  *              PRIVATE FUNCTIONS
  ******************************************************************************/
-static void *__bufgetter_connection(int i)
+static void *__bufgetter_connection(bufpool_handle h, int i)
 {
-    return (void *)&(__connection_pool[i]);
-}
+    struct connection_item_t **chunk = &__connection_pool[i / __RTSP_POOL_CHUNK];
+    struct connection_item_t *p;
 
-static inline bufpool_handle __connectionpool_create(int num)
-{
-    bufpool_handle h = bufpool_create(num, (__bufgetter_connection), (__connection_reset), sizeof(struct connection_item_t));
+    if (!*chunk && !(*chunk = calloc(__RTSP_POOL_CHUNK, sizeof(**chunk))))
+        return NULL;
 
-    if (h) {
-        int i;
-        for(i = 0; i < num; i++) {
-            __connection_pool[i].pool = h;
-            __connection_pool[i].con_state = __CON_S_DISCONNECTED;
-        }
-    }
+    p = &(*chunk)[i % __RTSP_POOL_CHUNK];
+    p->pool = h;
+    p->con_state = __CON_S_DISCONNECTED;
+    p->watch.kind = __WATCH_CLIENT;
+    pthread_mutex_init(&p->out.mutex, NULL);
 
-    return h;
+    return (void *)p;
 }
 
-static void *__bufgetter_trans(int i)
+static inline bufpool_handle __connectionpool_create(int num, int max)
 {
-    return (void *)&(__transfer_pool[i]);
+    return bufpool_create(num, max, (__bufgetter_connection), (__connection_reset), sizeof(struct connection_item_t));
 }
 
-static inline bufpool_handle __transpool_create(int num)
+/* once the pool is deleted */
+static inline void __connectionpool_free(void)
 {
-    bufpool_handle h = bufpool_create(num, (__bufgetter_trans), NULL, sizeof(struct transfer_item_t));
-
-    if (h) {
-        int i;
-        for(i = 0; i < num; i++) {
-            __transfer_pool[i].pool = h;
-            __transfer_pool[i].list_entry.cleaner = (__transfer_item_cleaner);
-        }
+    for (int i = 0; i < sizeof(__connection_pool) / sizeof(*__connection_pool); i++) {
+        for (int j = 0; __connection_pool[i] && j < __RTSP_POOL_CHUNK; j++)
+            FREE(__connection_pool[i][j].out.buf);
+        FREE(__connection_pool[i]);
     }
-
-    return h;
 }
 
 /******************************************************************************
  *              RESPONSE IMPLEMENTATIONS
  ******************************************************************************/
+static void __con_printf(struct connection_item_t *p, const char *fmt, ...)
+{
+    char buf[__RTSP_TCP_BUF_SIZE * 2];
+    va_list ap;
+    int len;
+
+    va_start(ap, fmt);
+    len = vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+
+    ASSERT(len >= 0, return);
+    len = min(len, (int)sizeof(buf) - 1);
+
+    struct iovec iov = { .iov_base = buf, .iov_len = len };
+    ASSERT(__con_out_write(p, &iov, 1, FALSE) == SUCCESS,
+        ERR("response lost\n"));
+}
+
 static void __method_auth(struct connection_item_t *p, rtsp_handle h)
 {
-    fprintf(p->fp_tcp_write, "RTSP/1.0 401 Unauthorized\r\n"
+    __con_printf(p, "RTSP/1.0 401 Unauthorized\r\n"
             "CSeq: %d\r\n"
             "WWW-Authenticate: Basic realm=\"Access the camera streams\"\r\n"
             "\r\n", p->cseq);
@@ -139,16 +170,15 @@ static void __method_auth(struct connection_item_t *p, rtsp_handle h)
 
 static void __method_options(struct connection_item_t *p, rtsp_handle h)
 {
-    fprintf(p->fp_tcp_write, "RTSP/1.0 200 OK\r\n"
+    __con_printf(p, "RTSP/1.0 200 OK\r\n"
             "CSeq: %d\r\n"
             "Public: OPTIONS, DESCRIBE, SETUP, TEARDOWN, PLAY, PAUSE\r\n"
             "\r\n", p->cseq);
 }
 
-static void __method_describe(struct connection_item_t *p, rtsp_handle h)
+/* rebuild the cached SDP, the control thread holds the handle lock */
+static void __sdp_build(rtsp_handle h, struct __rtsp_mount_t *m)
 {
-    char sdp[__RTSP_TCP_BUF_SIZE];
-
     const char baseRtp[] =
         "v=0\r\n"
         "o=- 0 0 IN IP4 127.0.0.1\r\n"
@@ -156,8 +186,15 @@ static void __method_describe(struct connection_item_t *p, rtsp_handle h)
         "c=IN IP4 0.0.0.0\r\n"
         "t=0 0\r\n"
         "a=range:npt=0-\r\n";
-    char audioRtp[256] = "\r\n";
+    char sessionRtp[sizeof(baseRtp) + 32];
+    char audioRtp[256] = "";
     char audioRtpfmt[16];
+    char tracksRtp[512];
+    char nackRtp[32] = "";
+    char fec = __atomic_load_n(&h->fec_group, __ATOMIC_RELAXED) != 0;
+    char nack = __atomic_load_n(&h->nack_budget, __ATOMIC_RELAXED) != 0;
+    int pt = m->isJpeg ? __RTP_JPEG_PT : 96;
+    struct NalParamSets *ps = &m->params;
 
     if (h->audioPt != 255) {
         switch (h->audioPt) {
@@ -168,161 +205,336 @@ static void __method_describe(struct connection_item_t *p, rtsp_handle h)
             case 96: strncpy(audioRtpfmt, "MPEG4-GENERIC", 16 - 1); break;
             default: strncpy(audioRtpfmt, "UNKNOWN", 16 - 1); break;
         }
+        /* the telephony codecs run on their own 8 kHz clock */
         sprintf(audioRtp, 
-            "\r\n"
             "m=audio 0 RTP/AVP %d\r\n"
             "a=control:track=1\r\n"
-            "a=rtpmap:%d %s/90000\r\n",
-            h->audioPt, h->audioPt, audioRtpfmt, h->audioPt);
+            "a=rtpmap:%d %s/%d\r\n",
+            h->audioPt, h->audioPt, audioRtpfmt,
+            h->audioPt == 0 || h->audioPt == 8 || h->audioPt == 18 ? 8000 : 90000);
     }
 
-    if (h->isH265 && 
-        h->sprop_vps_b64 && h->sprop_sps_b64 && h->sprop_sps_b16 && h->sprop_pps_b64) {
-        DASSERT(h->sprop_vps_b64->result, return);
-        DASSERT(h->sprop_sps_b64->result, return);
-        DASSERT(h->sprop_sps_b16->result, return);
-        DASSERT(h->sprop_pps_b64->result, return);
-
-        DBG("VPS BASE64:%s\n", h->sprop_vps_b64->result);
-        DBG("SPS BASE64:%s\n", h->sprop_sps_b64->result);
-        DBG("SPS BASE16:%s\n", h->sprop_sps_b16->result);
-        DBG("PPS BASE64:%s\n", h->sprop_pps_b64->result);
+    if (nack)
+        sprintf(nackRtp, "a=rtcp-fb:%d nack\r\n", pt);
+
+    /* the parity is a track of its own, tied to the video by RFC 5956 */
+    snprintf(sessionRtp, sizeof(sessionRtp), "%s%s", baseRtp,
+        fec ? "a=group:FEC 0 2\r\n" : "");
+    snprintf(tracksRtp, sizeof(tracksRtp), "\r\n%s%s%s%s%s",
+        nackRtp,
+        fec ? "a=mid:0\r\n" : "",
+        audioRtp,
+        fec && audioRtp[0] ? "a=mid:1\r\n" : "",
+        fec ? "m=video 0 RTP/AVP 127\r\n"
+              "a=control:track=2\r\n"
+              "a=rtpmap:127 ulpfec/90000\r\n"
+              "a=mid:2\r\n" : "");
+
+    mime_encoded_delete(m->sprop_vps_b64);
+    mime_encoded_delete(m->sprop_sps_b64);
+    mime_encoded_delete(m->sprop_sps_b16);
+    mime_encoded_delete(m->sprop_pps_b64);
+    m->sprop_vps_b64 = m->sprop_sps_b64 = m->sprop_sps_b16 = m->sprop_pps_b64 = NULL;
+
+    if (ps->isH265 == m->isH265 && nal_paramset_complete(ps)) {
+        if (ps->isH265)
+            m->sprop_vps_b64 = mime_base64_create(ps->vps.data, ps->vps.length);
+        m->sprop_sps_b64 = mime_base64_create(ps->sps.data, ps->sps.length);
+        m->sprop_sps_b16 = mime_base16_create(&ps->sps.data[1], 3);
+        m->sprop_pps_b64 = mime_base64_create(ps->pps.data, ps->pps.length);
+    }
 
-        snprintf(sdp, __RTSP_TCP_BUF_SIZE- 1,
+    if (m->isJpeg) {
+        /* a static payload type, the frames describe themselves */
+        snprintf(m->sdp, sizeof(m->sdp),
+                "%sm=video 0 RTP/AVP %d\r\n"
+                "a=control:track=0\r\n"
+                "a=rtpmap:%d JPEG/90000%s",
+                sessionRtp, pt, pt, tracksRtp);
+    } else if (m->isH265 && 
+        m->sprop_vps_b64 && m->sprop_sps_b64 && m->sprop_sps_b16 && m->sprop_pps_b64) {
+        DBG("VPS BASE64:%s\n", m->sprop_vps_b64->result);
+        DBG("SPS BASE64:%s\n", m->sprop_sps_b64->result);
+        DBG("SPS BASE16:%s\n", m->sprop_sps_b16->result);
+        DBG("PPS BASE64:%s\n", m->sprop_pps_b64->result);
+
+        snprintf(m->sdp, sizeof(m->sdp),
                 "%sm=video 0 RTP/AVP 96\r\n"
                 "a=control:track=0\r\n"
                 "a=rtpmap:96 H265/90000\r\n"
                 "a=fmtp:96 profile-level-id=%s;"
                 " packetization-mode=1;"
                 " sprop-parameter-sets=%s,%s,%s;%s",
-                baseRtp,
-                h->sprop_sps_b16->result,
-                h->sprop_vps_b64->result,
-                h->sprop_sps_b64->result,
-                h->sprop_pps_b64->result,
-                audioRtp);
-    } else if (!h->isH265 && 
-        h->sprop_sps_b64 && h->sprop_sps_b16 && h->sprop_pps_b64) {
-        DASSERT(h->sprop_sps_b64->result, return);
-        DASSERT(h->sprop_sps_b16->result, return);
-        DASSERT(h->sprop_pps_b64->result, return);
-
-        DBG("SPS BASE64:%s\n", h->sprop_sps_b64->result);
-        DBG("SPS BASE16:%s\n", h->sprop_sps_b16->result);
-        DBG("PPS BASE64:%s\n", h->sprop_pps_b64->result);
-
-        snprintf(sdp, __RTSP_TCP_BUF_SIZE - 1,
+                sessionRtp,
+                m->sprop_sps_b16->result,
+                m->sprop_vps_b64->result,
+                m->sprop_sps_b64->result,
+                m->sprop_pps_b64->result,
+                tracksRtp);
+    } else if (!m->isH265 && 
+        m->sprop_sps_b64 && m->sprop_sps_b16 && m->sprop_pps_b64) {
+        DBG("SPS BASE64:%s\n", m->sprop_sps_b64->result);
+        DBG("SPS BASE16:%s\n", m->sprop_sps_b16->result);
+        DBG("PPS BASE64:%s\n", m->sprop_pps_b64->result);
+
+        snprintf(m->sdp, sizeof(m->sdp),
                 "%sm=video 0 RTP/AVP 96\r\n"
                 "a=control:track=0\r\n"
-                "a=rtpmap:96 H265/90000\r\n"
+                "a=rtpmap:96 H264/90000\r\n"
                 "a=fmtp:96 profile-level-id=%s;"
                 " packetization-mode=1;"
                 " sprop-parameter-sets=%s,%s;%s",
-                baseRtp,
-                h->sprop_sps_b16->result,
-                h->sprop_sps_b64->result,
-                h->sprop_pps_b64->result,
-                audioRtp);
+                sessionRtp,
+                m->sprop_sps_b16->result,
+                m->sprop_sps_b64->result,
+                m->sprop_pps_b64->result,
+                tracksRtp);
     } else {
-        snprintf(sdp, __RTSP_TCP_BUF_SIZE - 1,
+        snprintf(m->sdp, sizeof(m->sdp),
                 "%sm=video 0 RTP/AVP 96\r\n"
                 "a=control:track=0\r\n"
                 "a=rtpmap:96 %s/90000\r\n"
                 "a=fmtp:96 packetization-mode=1;%s",
-                baseRtp,
-                h->isH265 ? "H265" : "H264",
-                audioRtp);
+                sessionRtp,
+                m->isH265 ? "H265" : "H264",
+                tracksRtp);
+    }
+
+    m->sdp_generation = ps->generation;
+    m->sdp_audio_pt = h->audioPt;
+    m->sdp_h265 = m->isH265;
+    m->sdp_jpeg = m->isJpeg;
+    m->sdp_fec = fec;
+    m->sdp_nack = nack;
+}
+
+static void __method_describe(struct connection_item_t *p, rtsp_handle h)
+{
+    struct __rtsp_mount_t *m = p->mount;
+
+    if (!m) {
+        __method_notfound(p, h);
+        return;
     }
 
-    fprintf(p->fp_tcp_write, "RTSP/1.0 200 OK\r\n"
+    /* the description only changes with the parameter sets or the tracks */
+    if (!m->sdp[0] || m->sdp_generation != m->params.generation ||
+        m->sdp_audio_pt != h->audioPt || m->sdp_h265 != m->isH265 ||
+        m->sdp_jpeg != m->isJpeg ||
+        m->sdp_fec != (__atomic_load_n(&h->fec_group, __ATOMIC_RELAXED) != 0) ||
+        m->sdp_nack != (__atomic_load_n(&h->nack_budget, __ATOMIC_RELAXED) != 0))
+        __sdp_build(h, m);
+
+    __con_printf(p, "RTSP/1.0 200 OK\r\n"
             "CSeq: %d\r\n"
             "Content-Type: application/sdp\r\n"
             "Content-Length: %d\r\n"
             "\r\n"
-            "%s", p->cseq, strlen(sdp), sdp);
+            "%s", p->cseq, strlen(m->sdp), m->sdp);
 }
 
 static void __method_setup(struct connection_item_t *p, rtsp_handle h)
 {
+    if (!p->mount) {
+        p->trans[p->track_id].transport = __TRANSPORT_NONE;
+        __method_notfound(p, h);
+        return;
+    }
+
+    /* parity on a group or inside a TCP stream is of no use to anyone */
+    if ((p->trans[p->track_id].transport == __TRANSPORT_MULTICAST && !p->mount->mcast) ||
+        (p->track_id == __RTSP_TRACK_FEC && p->trans[p->track_id].transport != __TRANSPORT_NONE)) {
+        p->trans[p->track_id].transport = __TRANSPORT_NONE;
+        __con_printf(p, "RTSP/1.0 " __RESPONCE_STR_TRANSUNSUPPORTED "\r\n"
+            "CSeq: %d\r\n"
+            "\r\n", p->cseq);
+        return;
+    }
+
     /* make randomized session id */
-	if (!p->session_id) {
+	if (!p->session_id)
     	p->session_id = __get_random_llu(&h->ctx);
-    	p->ssrc = (unsigned int)(__get_random_llu(&h->ctx));
-	}
+
+    /* reset connections come back with a session id but no SSRC, and
+       receiver reports are matched against it */
+    while (!p->ssrc)
+        p->ssrc = (unsigned int)rand_r(&h->ctx) << 16 ^ (unsigned int)rand_r(&h->ctx);
 
     DBG("created session id %llx\n", p->session_id);
-    p->trans[p->track_id].server_port_rtp = SERVER_RTP_PORT + p->track_id;
-    p->trans[p->track_id].server_port_rtcp = SERVER_RTCP_PORT + p->track_id;
 
-    fprintf(p->fp_tcp_write, "RTSP/1.0 200 OK\r\n"
-        "CSeq: %d\r\n"
-        "Transport: RTP/AVP/UDP;unicast;client_port=%u-%u;server_port=%u-%u\r\n"
-        "Session: %llx\r\n"
-        "\r\n", p->cseq,
-        p->trans[p->track_id].client_port_rtp,
-        p->trans[p->track_id].client_port_rtcp,
-        p->trans[p->track_id].server_port_rtp,
-        p->trans[p->track_id].server_port_rtcp,
-        p->session_id);
+    if (p->trans[p->track_id].transport == __TRANSPORT_TCP) {
+        /* interleaved packets may pile up behind a slow reader */
+        pthread_mutex_lock(&p->out.mutex);
+        if (p->out.size < __RTSP_TCP_OUTBUF_SIZE) {
+            unsigned char *buf = realloc(p->out.buf, __RTSP_TCP_OUTBUF_SIZE);
+            if (buf) {
+                p->out.buf = buf;
+                p->out.size = __RTSP_TCP_OUTBUF_SIZE;
+            }
+        }
+        pthread_mutex_unlock(&p->out.mutex);
+
+        __con_printf(p, "RTSP/1.0 200 OK\r\n"
+            "CSeq: %d\r\n"
+            "Transport: RTP/AVP/TCP;unicast;interleaved=%u-%u\r\n"
+            "Session: %llx\r\n"
+            "\r\n", p->cseq,
+            p->trans[p->track_id].channel_rtp,
+            p->trans[p->track_id].channel_rtcp,
+            p->session_id);
+    } else if (p->trans[p->track_id].transport == __TRANSPORT_MULTICAST) {
+        char group[INET_ADDRSTRLEN];
+
+        struct connection_item_t *g = p->mount->mcast;
+
+        inet_ntop(AF_INET, &g->addr.sin_addr, group, sizeof(group));
+
+        __con_printf(p, "RTSP/1.0 200 OK\r\n"
+            "CSeq: %d\r\n"
+            "Transport: RTP/AVP;multicast;destination=%s;port=%u-%u;ttl=%u\r\n"
+            "Session: %llx\r\n"
+            "\r\n", p->cseq, group,
+            g->trans[p->track_id].client_port_rtp,
+            g->trans[p->track_id].client_port_rtcp,
+            h->mcast_ttl, p->session_id);
+    } else {
+        p->trans[p->track_id].transport = __TRANSPORT_UDP;
+        p->trans[p->track_id].server_port_rtp = SERVER_RTP_PORT + p->track_id;
+        p->trans[p->track_id].server_port_rtcp = SERVER_RTCP_PORT + p->track_id;
+
+        __con_printf(p, "RTSP/1.0 200 OK\r\n"
+            "CSeq: %d\r\n"
+            "Transport: RTP/AVP/UDP;unicast;client_port=%u-%u;server_port=%u-%u\r\n"
+            "Session: %llx\r\n"
+            "\r\n", p->cseq,
+            p->trans[p->track_id].client_port_rtp,
+            p->trans[p->track_id].client_port_rtcp,
+            p->trans[p->track_id].server_port_rtp,
+            p->trans[p->track_id].server_port_rtcp,
+            p->session_id);
+    }
 
-    p->con_state = __CON_S_READY;
+    __con_set_state(p, __CON_S_READY);
 }
 
 static void __method_pause(struct connection_item_t *p, rtsp_handle h)
 {
-    fprintf(p->fp_tcp_write, 
+    __con_printf(p, 
         "RTSP/1.0 "__RESPONCE_STR_METHODNOTALLOWED "\r\n");
 }
 
 static void __method_record(struct connection_item_t *p, rtsp_handle h)
 {
-    fprintf(p->fp_tcp_write,
+    __con_printf(p,
         "RTSP/1.0 " __RESPONCE_STR_METHODNOTALLOWED "\r\n");
 }
 
 static void __method_error(struct connection_item_t *p, rtsp_handle h)
 {
-    fprintf(p->fp_tcp_write,
+    __con_printf(p,
         "RTSP/1.0 " __RESPONCE_STR_SERVERERROR "\r\n");
 }
 
+static void __method_notfound(struct connection_item_t *p, rtsp_handle h)
+{
+    __con_printf(p, "RTSP/1.0 " __RESPONCE_STR_NOTFOUND "\r\n"
+        "CSeq: %d\r\n"
+        "\r\n", p->cseq);
+}
+
+/* whether the mount's ring still holds its newest IDR and all after it */
+static inline int __gop_cached(rtsp_handle h, struct __rtsp_mount_t *m)
+{
+    struct __rtp_pace_t *p;
+    unsigned int head, key;
+
+    if (!h->gop_ms || !m || !(p = __atomic_load_n(&m->pace, __ATOMIC_ACQUIRE)))
+        return FALSE;
+
+    head = __atomic_load_n(&p->head, __ATOMIC_ACQUIRE);
+    key = __atomic_load_n(&p->key, __ATOMIC_RELAXED);
+
+    return __atomic_load_n(&p->keyed, __ATOMIC_RELAXED) &&
+        (int)(head - key) > 0 && head - key <= p->size;
+}
+
 static void __method_play(struct connection_item_t *p, rtsp_handle h)
 {
-    fprintf(p->fp_tcp_write,
+    __con_printf(p,
         "RTSP/1.0 200 OK\r\n"
         "CSeq: %d\r\n"
         "Range: npt=now-\r\n"
         "\r\n" , p->cseq);
 
     for (int i = 0; i < sizeof(p->trans) / sizeof(*p->trans); i++) {
-        if (!p->trans[i].server_port_rtp) continue;
+        if (p->trans[i].transport == __TRANSPORT_NONE) continue;
         p->track_id = i;
 
-        ASSERT(__bind_rtcp(p) == SUCCESS, return);
-        ASSERT(__bind_rtp(p) == SUCCESS, return);
+        /* the group is opened by its first viewer and then left running */
+        if (p->trans[i].transport == __TRANSPORT_MULTICAST) {
+            if (!p->mount->mcast->trans[i].server_rtp_fd) {
+                ASSERT(__bind_mcast(h, p->mount, i) == SUCCESS, return);
+                ASSERT(__rtcp_send_sr(p->mount->mcast, i) == SUCCESS, return);
+            }
+            continue;
+        }
+
+        if (p->trans[i].transport == __TRANSPORT_UDP) {
+            if (!h->rtp_fd[i])
+                ASSERT(__bind_udp(h, i) == SUCCESS, return);
+            p->trans[i].server_rtp_fd = h->rtp_fd[i];
+            p->trans[i].server_rtcp_fd = h->rtcp_fd[i];
+        }
+        p->trans[p->track_id].wait_key = 0;
         p->trans[p->track_id].rtp_timestamp = (millis() * 90) & UINT32_MAX;
         p->trans[p->track_id].rtp_seq = rand_r(&h->ctx);
         p->trans[p->track_id].rtcp_octet = 0; 
         p->trans[p->track_id].rtcp_packet_cnt = 0; 
         p->trans[p->track_id].rtcp_tick_org = 150; // TODO: must be variant
         p->trans[p->track_id].rtcp_tick = p->trans[p->track_id].rtcp_tick_org;
-    }
-
-    p->con_state = __CON_S_PLAYING;
+        memset(&p->trans[p->track_id].stat, 0, sizeof(p->trans[p->track_id].stat));
+        p->trans[p->track_id].stat.rtt_ms = -1;
 
-    ASSERT(__rtcp_send_sr(p) == SUCCESS, return);
+        ASSERT(__rtcp_send_sr(p, i) == SUCCESS, return);
+    }
 
-    request_idr();
+    /* the video sender starts its parity groups afresh */
+    memset(&p->fec, 0, sizeof(p->fec));
+    if (p->trans[__RTSP_TRACK_FEC].transport == __TRANSPORT_UDP)
+        p->fec.group = __atomic_load_n(&h->fec_group, __ATOMIC_RELAXED);
+
+    /* and an empty history, which is not answered from over TCP */
+    memset(&p->nack, 0, sizeof(p->nack));
+    if (p->trans[0].transport == __TRANSPORT_UDP)
+        p->nack.budget = __atomic_load_n(&h->nack_budget, __ATOMIC_RELAXED);
+    p->nack.refill_us = __rtp_now();
+
+    /* a viewer of its own starts from the GOP cache, only a group or an
+       empty cache needs the encoder to cut an IDR */
+    p->trans[0].prime = (p->trans[0].transport == __TRANSPORT_UDP ||
+        p->trans[0].transport == __TRANSPORT_TCP) && __gop_cached(h, p->mount);
+
+    __con_set_state(p, __CON_S_PLAYING);
+
+    /* paced, the cache is the pacer's to send, and it need not wait for
+       the next frame to start on it */
+    if (p->trans[0].prime && p->trans[0].transport == __TRANSPORT_UDP &&
+        __atomic_load_n(&h->pace_burst, __ATOMIC_RELAXED) &&
+        __atomic_exchange_n(&h->pace_idle, 0, __ATOMIC_SEQ_CST))
+        sem_post(&h->pace_sem);
+
+    if (!p->trans[0].prime)
+        request_idr();
 }
 
 static int __method_teardown(struct connection_item_t *p, rtsp_handle h)
 {
-    fprintf(p->fp_tcp_write,
+    __con_printf(p,
         "RTSP/1.0 200 OK\r\n"
         "CSeq: %d\r\n"
         "\r\n", p->cseq);
 
-    p->con_state = __CON_S_INIT;
+    __con_set_state(p, __CON_S_INIT);
 
     return SUCCESS;
 }
@@ -331,111 +543,270 @@ static int __method_teardown(struct connection_item_t *p, rtsp_handle h)
 /******************************************************************************
  *              METHOD IMPLEMENTATIONS
  ******************************************************************************/
+/* pull whatever the socket holds, as the control socket is edge triggered.
+   returns FAILURE once the peer is gone, with what came before it kept */
+static int __con_in_fill(struct connection_item_t *p)
+{
+    ssize_t n;
+
+    if (p->in.off) {
+        memmove(p->in.buf, p->in.buf + p->in.off, p->in.len - p->in.off);
+        p->in.len -= p->in.off;
+        p->in.off = 0;
+    }
+
+    while (p->in.len < sizeof(p->in.buf)) {
+        n = recv(p->client_fd, p->in.buf + p->in.len, sizeof(p->in.buf) - p->in.len, MSG_DONTWAIT);
+        if (n > 0) {
+            p->in.len += n;
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return SUCCESS;
+        } else {
+            return FAILURE;
+        }
+    }
 
-static int __message_proc_sock(struct list_t *e, void *p)
+    return SUCCESS;
+}
+
+/* consume the '$'-framed packets in front of the next request. returns
+   FAILURE when there is no request left to parse in the buffer */
+static int __interleaved_proc_sock(struct connection_item_t *p)
 {
-    struct connection_item_t *con;
-    struct sock_select_t *socks = p;
-    char buf[__RTSP_TCP_BUF_SIZE];
-    rtsp_handle h = NULL;
+    unsigned char *s;
+    size_t avail, len;
+
+    for (;;) {
+        s = p->in.buf + p->in.off;
+        avail = p->in.len - p->in.off;
+
+        if (p->in.skip) {
+            len = min(p->in.skip, avail);
+            p->in.skip -= len;
+            p->in.off += len;
+            if (p->in.skip) return FAILURE;
+            continue;
+        }
 
-    DASSERT(socks, return FAILURE);
-    MUST(h = socks->h_rtsp, return FAILURE);
+        if (!avail) return FAILURE;
+        if (s[0] != '$') return SUCCESS;
+        if (avail < 4) return FAILURE;
+
+        len = s[2] << 8 | s[3];
+        if (4 + len > avail) {
+            /* nothing we care for is ever this large */
+            if (4 + len > sizeof(p->in.buf))
+                p->in.skip = 4 + len;
+            else
+                return FAILURE;
+            continue;
+        }
 
-    list_upcast(con, e);
+        /* receiver reports come back on the odd channel of a track */
+        for (int i = 0; i < sizeof(p->trans) / sizeof(*p->trans); i++)
+            if (p->trans[i].transport == __TRANSPORT_TCP &&
+                p->trans[i].channel_rtcp == s[1])
+                __rtcp_recv(p, i, s + 4, len);
+
+        p->in.off += 4 + len;
+    }
+}
+
+static int __message_proc_sock(struct connection_item_t *con, rtsp_handle h, unsigned int events)
+{
+    int gone, full;
 
     if (con->con_state == __CON_S_DISCONNECTED) {
-        ERR("zombie connection detected: report to author\n");
+        DBG("event on a connection being torn down\n");
         return SUCCESS;
     }
 
-    if (FD_ISSET(con->client_fd, &(socks->rfds))) {
-        con->parser_state = __PARSER_S_INIT;
-        con->method = __METHOD_NONE;
-
-        char header = 0, isAuthValid = 0, *tok, *last;
-        unsigned long long session_id;
-        /* parse line by line. hereafter parser is switched according to the finite state machine */
-        while (__read_line(con, buf)) {
-            if (header < 1) {
-                con->track_id = 0;
-                if (SCMP(__STR_OPTIONS, buf))            { con->method = __METHOD_OPTIONS;
-                } else if (SCMP(__STR_DESCRIBE, buf))    { con->method = __METHOD_DESCRIBE;
-                } else if (SCMP(__STR_SETUP, buf))       { con->method = __METHOD_SETUP;
-                    STR_KEY_NUM(buf, "track=", con->track_id);
-                } else if (SCMP(__STR_PLAY, buf))        { con->method = __METHOD_PLAY;
-                } else if (SCMP(__STR_RECORDING, buf))   { con->method = __METHOD_RECORDING;
-                } else if (SCMP(__STR_PAUSE, buf))       { con->method = __METHOD_PAUSE;
-                } else if (SCMP(__STR_TEARDOWN, buf))    { con->method = __METHOD_TEARDOWN;
-                } header++;
-            }
+    if (events & EPOLLOUT) {
+        pthread_mutex_lock(&con->out.mutex);
+        __con_out_flush(con);
+        pthread_mutex_unlock(&con->out.mutex);
+    }
+
+    if (!(events & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+        return SUCCESS;
+
+    do {
+        gone = __con_in_fill(con) != SUCCESS;
+        full = con->in.len == sizeof(con->in.buf);
+
+        /* interleaved clients send their RTCP over this socket too */
+        while (__interleaved_proc_sock(con) == SUCCESS && __request_ready(con)) {
+            ASSERT(__request_proc_sock(con, h) == SUCCESS, return FAILURE);
+            if (con->con_state == __CON_S_DISCONNECTED)
+                return SUCCESS;
+        }
 
-            if (SCMP(__STR_AUTH, buf) && h->isAuthOn) {
-                    char cred[66], valid[256];
-                    sprintf(cred, "%s:%s", h->user, h->pass);
-                    strcpy(valid, "Basic ");
-                    base64_encode(valid + 6, cred, strlen(cred));
-                    isAuthValid = !strncmp(buf + strlen(__STR_AUTH) + 2, valid, strlen(valid));
-             } else if (SCMP(__STR_CSEQ, buf)) {
-                ASSERT(tok = strtok_r(buf, ": ", &last), goto error); 
-                ASSERT(tok = strtok_r(NULL, ": ", &last), goto error);
-                ASSERT((con->cseq = atoi(tok)) > 0, goto error);
-                con->parser_state = __PARSER_S_CSEQ;
-            } else if (SCMP(__STR_RANGE, buf)) {
-                con->parser_state = __PARSER_S_RANGE;
-            } else if (SCMP(__STR_SESSION, buf)) {
-                ASSERT(tok = strtok_r(buf, ": ", &last), goto error);
-                ASSERT(tok = strtok_r(NULL, ": ", &last), goto error);
-                ASSERT(sscanf(tok, "%llx", &session_id) > 0, goto error);
-                con->given_session_id = session_id;
-                con->parser_state = __PARSER_S_SESSION;
-            } else if (SCMP(__STR_TRANSPORT, buf)) {
-                for (tok = strtok_r(buf, "; ", &last); tok != NULL; tok = strtok_r(NULL, "; ", &last)) {
-                    if (SCMP(__STR_CLIENTPORT, tok)) {
-                        ASSERT(sscanf(tok, __STR_CLIENTPORT "=%u-%u", 
-                            &con->trans[con->track_id].client_port_rtp,
-                            &con->trans[con->track_id].client_port_rtcp) > 0,
-                                goto error);
-
-                        con->parser_state = __PARSER_S_TRANSPORT;
-                        break;
-                    }
+        /* a request that cannot fit is not going to be served */
+        if (full && !con->in.off && !con->in.skip) {
+            ERR("request too large\n");
+            gone = 1;
+        }
+    } while (full && !gone);
+
+    if (gone) {
+        DBG("disconnected\n");
+        __con_set_state(con, __CON_S_DISCONNECTED);
+        ASSERT(bufpool_detach(con->pool, con) == SUCCESS, ERR("connection detach failed\n"));
+    }
+
+    return SUCCESS;
+}
+
+/* one complete request sits at the parser cursor */
+static int __request_proc_sock(struct connection_item_t *con, rtsp_handle h)
+{
+    char buf[__RTSP_TCP_BUF_SIZE];
+
+    con->parser_state = __PARSER_S_INIT;
+    con->method = __METHOD_NONE;
+
+    char header = 0, isAuthValid = 0, unknown = 0, *tok, *last;
+    unsigned long long session_id;
+    struct __rtsp_mount_t *mount = con->mount;
+    /* parse line by line. hereafter parser is switched according to the finite state machine */
+    while (__read_line(con, buf)) {
+        if (header < 1) {
+            con->track_id = 0;
+            if (SCMP(__STR_OPTIONS, buf))            { con->method = __METHOD_OPTIONS;
+            } else if (SCMP(__STR_DESCRIBE, buf))    { con->method = __METHOD_DESCRIBE;
+                mount = __mount_find(h, buf);
+            } else if (SCMP(__STR_SETUP, buf))       { con->method = __METHOD_SETUP;
+                mount = __mount_find(h, buf);
+                STR_KEY_NUM(buf, "track=", con->track_id);
+                /* nothing past the tracks we describe has a transport slot */
+                if ((unsigned int)con->track_id >= __RTSP_TRACKS ||
+                    (con->track_id == __RTSP_TRACK_FEC && !h->fec_group)) {
+                    con->track_id = 0;
+                    unknown = 1;
                 }
-            }
-            continue;
-error:
-            __PARSE_ERROR(con);
+            } else if (SCMP(__STR_PLAY, buf))        { con->method = __METHOD_PLAY;
+            } else if (SCMP(__STR_RECORDING, buf))   { con->method = __METHOD_RECORDING;
+            } else if (SCMP(__STR_PAUSE, buf))       { con->method = __METHOD_PAUSE;
+            } else if (SCMP(__STR_TEARDOWN, buf))    { con->method = __METHOD_TEARDOWN;
+            } header++;
         }
 
-        if (con->parser_state == __PARSER_S_ERROR) {
-            __method_error(con, h);
-        } else {
-            if (con->method != __METHOD_NONE && h->isAuthOn && !isAuthValid)
-                con->method = __METHOD_AUTH;
-            switch (con->method) {
-                case __METHOD_AUTH: __method_auth(con, h); break;
-                case __METHOD_OPTIONS: __method_options(con, h); break;
-                case __METHOD_DESCRIBE: __method_describe(con, h); break;
-                case __METHOD_SETUP: __method_setup(con, h); break;
-                case __METHOD_PLAY: __method_play(con, h); break;
-                case __METHOD_PAUSE: __method_pause(con, h); break;
-                case __METHOD_RECORDING: __method_record(con, h); break;
-                case __METHOD_TEARDOWN: __method_teardown(con, h); break;
-                case __METHOD_NONE: 
-                    /* state DISCONNECTED connections should be garbage collected immediately.
-                       but sending thread might watches the connection right now.
-                       so the connection might live at here */
-                    ASSERT(con->con_state == __CON_S_DISCONNECTED, return FAILURE); 
-                    break;
-                default: ERR("unexpected method state\n"); return FAILURE;
+        if (SCMP(__STR_AUTH, buf) && h->isAuthOn) {
+                char cred[66], valid[256];
+                sprintf(cred, "%s:%s", h->user, h->pass);
+                strcpy(valid, "Basic ");
+                base64_encode(valid + 6, cred, strlen(cred));
+                isAuthValid = !strncmp(buf + strlen(__STR_AUTH) + 2, valid, strlen(valid));
+         } else if (SCMP(__STR_CSEQ, buf)) {
+            ASSERT(tok = strtok_r(buf, ": ", &last), goto error); 
+            ASSERT(tok = strtok_r(NULL, ": ", &last), goto error);
+            ASSERT((con->cseq = atoi(tok)) > 0, goto error);
+            con->parser_state = __PARSER_S_CSEQ;
+        } else if (SCMP(__STR_RANGE, buf)) {
+            con->parser_state = __PARSER_S_RANGE;
+        } else if (SCMP(__STR_SESSION, buf)) {
+            ASSERT(tok = strtok_r(buf, ": ", &last), goto error);
+            ASSERT(tok = strtok_r(NULL, ": ", &last), goto error);
+            ASSERT(sscanf(tok, "%llx", &session_id) > 0, goto error);
+            con->given_session_id = session_id;
+            con->parser_state = __PARSER_S_SESSION;
+        } else if (SCMP(__STR_TRANSPORT, buf) && !unknown) {
+            con->trans[con->track_id].transport = __TRANSPORT_NONE;
+            for (tok = strtok_r(buf, "; ", &last); tok != NULL; tok = strtok_r(NULL, "; ", &last)) {
+                if (SCMP(__STR_TRANSPORT_TCP, tok)) {
+                    con->trans[con->track_id].transport = __TRANSPORT_TCP;
+                    con->trans[con->track_id].channel_rtp = con->track_id * 2;
+                    con->trans[con->track_id].channel_rtcp = con->track_id * 2 + 1;
+                } else if (SCMP(__STR_MULTICAST, tok)) {
+                    con->trans[con->track_id].transport = __TRANSPORT_MULTICAST;
+                } else if (SCMP(__STR_INTERLEAVED, tok)) {
+                    unsigned int ch_rtp, ch_rtcp;
+                    int n;
+
+                    ASSERT((n = sscanf(tok, __STR_INTERLEAVED "=%u-%u",
+                        &ch_rtp, &ch_rtcp)) > 0 && ch_rtp < 255, goto error);
+
+                    con->trans[con->track_id].channel_rtp = ch_rtp;
+                    con->trans[con->track_id].channel_rtcp = n > 1 ? ch_rtcp : ch_rtp + 1;
+                } else if (SCMP(__STR_CLIENTPORT, tok)) {
+                    ASSERT(sscanf(tok, __STR_CLIENTPORT "=%u-%u", 
+                        &con->trans[con->track_id].client_port_rtp,
+                        &con->trans[con->track_id].client_port_rtcp) > 0,
+                            goto error);
+                }
             }
+            con->parser_state = __PARSER_S_TRANSPORT;
         }
+        continue;
+error:
+        __PARSE_ERROR(con);
+    }
+
+    /* a session moving over while it plays leaves its old mount */
+    if (mount != con->mount) {
+        if (con->mount && con->con_state == __CON_S_PLAYING)
+            con->mount->subs_dirty = 1;
+        con->mount = mount;
+    }
 
-        fflush(con->fp_tcp_write);
-    } 
+    if (con->parser_state == __PARSER_S_ERROR) {
+        __method_error(con, h);
+    } else {
+        if (con->method != __METHOD_NONE && h->isAuthOn && !isAuthValid)
+            con->method = __METHOD_AUTH;
+        switch (con->method) {
+            case __METHOD_AUTH: __method_auth(con, h); break;
+            case __METHOD_OPTIONS: __method_options(con, h); break;
+            case __METHOD_DESCRIBE: __method_describe(con, h); break;
+            case __METHOD_SETUP:
+                if (unknown) __method_notfound(con, h);
+                else __method_setup(con, h);
+                break;
+            case __METHOD_PLAY: __method_play(con, h); break;
+            case __METHOD_PAUSE: __method_pause(con, h); break;
+            case __METHOD_RECORDING: __method_record(con, h); break;
+            case __METHOD_TEARDOWN: __method_teardown(con, h); break;
+            case __METHOD_NONE:
+                /* keepalives such as GET_PARAMETER end up here */
+                __con_printf(con, "RTSP/1.0 " __RESPONCE_STR_METHODNOTALLOWED "\r\n"
+                    "CSeq: %d\r\n"
+                    "\r\n", con->cseq);
+                break;
+            default: ERR("unexpected method state\n"); return FAILURE;
+        }
+    }
     return SUCCESS;
 }
 
+/* reports from every unicast receiver of a track land on one socket, and
+   go to the session whose client port they come from */
+static void __rtcp_proc_sock(rtsp_handle h, int track_id)
+{
+    unsigned char rtcp[__RTSP_TCP_BUF_SIZE];
+    struct connection_item_t *con;
+    struct sockaddr_in from;
+    socklen_t fromlen = sizeof(from);
+    struct list_t *e;
+    ssize_t len;
+
+    while ((len = recvfrom(h->rtcp_fd[track_id], rtcp, sizeof(rtcp), MSG_DONTWAIT,
+        (struct sockaddr *)&from, &fromlen)) > 0) {
+        for (e = h->con_list.list; e; e = e->next) {
+            list_upcast(con, e);
+            if (con->con_state != __CON_S_DISCONNECTED &&
+                con->trans[track_id].transport == __TRANSPORT_UDP &&
+                con->addr.sin_addr.s_addr == from.sin_addr.s_addr &&
+                con->trans[track_id].client_port_rtcp == ntohs(from.sin_port)) {
+                __rtcp_recv(con, track_id, rtcp, len);
+                break;
+            }
+        }
+        fromlen = sizeof(from);
+    }
+}
+
 
 /******************************************************************************
  *              NETWORK FUNCTIONS
@@ -450,27 +821,36 @@ static int __connection_reset(void *v)
         DBG("force connection to close\n");
     }
 
-    FCLOSE(p->fp_tcp_read);
-    FCLOSE(p->fp_tcp_write);
     CLOSE(p->client_fd);
+    p->in.off = 0;
+    p->in.len = 0;
+    p->in.skip = 0;
+
+    pthread_mutex_lock(&p->out.mutex);
+    if (p->out.size > __RTSP_TCP_BUF_SIZE) {
+        FREE(p->out.buf);
+        p->out.size = 0;
+    }
+    p->out.off = 0;
+    p->out.len = 0;
+    pthread_mutex_unlock(&p->out.mutex);
 
     p->client_fd = 0;
     p->con_state = __CON_S_DISCONNECTED;
+    p->mount = NULL;
 
+    /* the UDP sockets belong to the handle */
     for (int i = 0; i < sizeof(p->trans) / sizeof(*p->trans); i++) {
-        if (p->trans[i].server_rtcp_fd != 0) {
-            CLOSE(p->trans[i].server_rtcp_fd);
-            p->trans[i].server_rtcp_fd = 0;
-        }
-
-        if (p->trans[i].server_rtp_fd != 0) {
-            CLOSE(p->trans[i].server_rtp_fd);
-            p->trans[i].server_rtp_fd = 0;
-        }
+        p->trans[i].server_rtcp_fd = 0;
+        p->trans[i].server_rtp_fd = 0;
+        p->trans[i].transport = __TRANSPORT_NONE;
+        p->trans[i].server_port_rtp = 0;
+        p->trans[i].server_port_rtcp = 0;
     }
 
     p->given_session_id = 0;
     p->cseq = 0;
+    p->ssrc = 0;
 
     ctx = p->trans[0].rtp_timestamp;
 
@@ -480,15 +860,25 @@ static int __connection_reset(void *v)
     return SUCCESS;
 }
 
+/* takes over 'fd', which is closed when no session can be had */
     static inline int
-__connection_list_add(bufpool_handle con_pool, struct list_head_t *head, int fd, struct sockaddr_in addr)
+__connection_list_add(rtsp_handle h, int fd, struct sockaddr_in addr)
 {
-    DASSERT(head, return FAILURE);
     DASSERT(fd > 0, return FAILURE);
 
     struct connection_item_t *p = NULL;
 
-    ASSERT(bufpool_get_free(con_pool, &p) == SUCCESS, return FAILURE);
+    /* grow by a chunk when full */
+    if (!bufpool_has_free(h->con_pool) &&
+        bufpool_grow(h->con_pool, __RTSP_POOL_CHUNK) != SUCCESS) {
+        ERR("all of the %d sessions are taken\n", h->max_con);
+        close(fd);
+        return FAILURE;
+    }
+
+    ASSERT(bufpool_get_free(h->con_pool, &p) == SUCCESS, ({
+        close(fd);
+        return FAILURE;}));
 
     DASSERT(p, return FAILURE);
 
@@ -497,41 +887,25 @@ __connection_list_add(bufpool_handle con_pool, struct list_head_t *head, int fd,
     p->addr=addr;
     p->client_fd=fd;
 
-    ASSERT((p->fp_tcp_read = fdopen(fd, "r")), goto error);
-    ASSERT((p->fp_tcp_write = fdopen(fd, "w")), goto error);
+    /* edge triggered, so a backlog left by the senders is flushed as soon
+       as the socket drains */
+    ASSERT(__watch(h, fd, EPOLLIN | EPOLLOUT | EPOLLET, &p->watch) == SUCCESS, goto error);
 
     p->con_state = __CON_S_INIT;
 
-    return list_add(head, &(p->list_entry));
+    return list_add(&h->con_list, &(p->list_entry));
 error:
-    __connection_reset(&p->list_entry);
+    ASSERT(bufpool_detach(h->con_pool, p) == SUCCESS, ERR("connection detach failed\n"));
     return FAILURE;
 }
 
-static inline int __find_fd_max(struct list_head_t *head)
-{
-    struct list_t *p;
-    struct connection_item_t *c;
-    int m = -1;
-    p = head->list;
-    while (p) {
-        list_upcast(c,p);
-        if (c->con_state != __CON_S_DISCONNECTED) {
-            m = max(c->client_fd, m);
-        }
-        p = p->next;
-    }
-    return m;
-}
-
-static inline int __set_select_sock(struct list_t *p, void *param)
+static inline int __watch(rtsp_handle h, int fd, unsigned int events, struct __watch_t *w)
 {
-    struct connection_item_t *c;
-    struct sock_select_t *socks = param;
+    struct epoll_event ev = { .events = events, .data.ptr = w };
 
-    list_upcast(c, p);
-
-    FD_SET(c->client_fd, &(socks->rfds));
+    ASSERT(epoll_ctl(h->epfd, EPOLL_CTL_ADD, fd, &ev) == 0, ({
+                ERR("epoll_ctl:%s\n", strerror(errno));
+                return FAILURE;}));
 
     return SUCCESS;
 }
@@ -570,113 +944,150 @@ error:
     return FAILURE;
 }
 
-static inline int __bind_rtp(struct connection_item_t *con )
+/* one pair of sockets per track carries every unicast UDP session: RTP is
+   sent addressed and RTCP matched back to its session by source */
+static inline int __bind_udp(rtsp_handle h, int track_id)
 {
-    int server_fd = -1;
+    int rtp_fd = -1, rtcp_fd = -1;
     struct sockaddr_in addr = {};
     int tmp;
 
-    /* reset socket */
-    if (con->trans[con->track_id].server_rtp_fd != 0) {
-        CLOSE(con->trans[con->track_id].server_rtp_fd);
-        con->trans[con->track_id].server_rtp_fd = 0;
-    }
-    /* setup serve rsocket */
-    ASSERT((server_fd = socket(AF_INET, SOCK_DGRAM, 0)) > 0, ({
+    ASSERT((rtp_fd = socket(AF_INET, SOCK_DGRAM, 0)) > 0, ({
                 ERR("socket:%s\n", strerror(errno));
                 goto error;}));
 
-    addr.sin_port = htons(con->trans[con->track_id].server_port_rtp);
+    addr.sin_port = htons(SERVER_RTP_PORT + track_id);
     addr.sin_addr.s_addr = htonl(INADDR_ANY);
     addr.sin_family = AF_INET;
-    
+
     tmp = 1;
-    setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &tmp, sizeof(tmp));
+    setsockopt(rtp_fd, SOL_SOCKET, SO_REUSEADDR, &tmp, sizeof(tmp));
 
-    ASSERT(bind(server_fd, (struct sockaddr *)&addr, sizeof(addr)) == 0, ({
+    ASSERT(bind(rtp_fd, (struct sockaddr *)&addr, sizeof(addr)) == 0, ({
                 ERR("bind:%s\n", strerror(errno));
                 goto error;}));
 
-    addr = con->addr;
-    addr.sin_port=htons(con->trans[con->track_id].client_port_rtp);
-
-    ASSERT(connect(server_fd, (struct sockaddr *)&addr, sizeof(addr)) == 0, ({
-                ERR("connect:%s\n", strerror(errno));
-                goto error;}));
+    /* past the sysctl limit when allowed to */
+    tmp = __RTSP_UDP_SNDBUF;
+    if (setsockopt(rtp_fd, SOL_SOCKET, SO_SNDBUFFORCE, &tmp, sizeof(tmp)))
+        setsockopt(rtp_fd, SOL_SOCKET, SO_SNDBUF, &tmp, sizeof(tmp));
 
     /* set the socket to non-blocking */
     tmp = 1;
-    ASSERT(ioctl(server_fd, FIONBIO, &tmp) != -1, ({
+    ASSERT(ioctl(rtp_fd, FIONBIO, &tmp) != -1, ({
                 ERR("ioctl:%s\n", strerror(errno));
                 goto error;}));
 
-    con->trans[con->track_id].server_rtp_fd = server_fd;
+    ASSERT((rtcp_fd = socket(AF_INET, SOCK_DGRAM, 0)) > 0, ({
+                ERR("socket:%s\n", strerror(errno));
+                goto error;}));
+
+    addr.sin_port = htons(SERVER_RTCP_PORT + track_id);
+
+    tmp = 1;
+    setsockopt(rtcp_fd, SOL_SOCKET, SO_REUSEADDR, &tmp, sizeof(tmp));
+
+    ASSERT(bind(rtcp_fd, (struct sockaddr *)&addr, sizeof(addr)) == 0, ({
+                ERR("bind:%s\n", strerror(errno));
+                goto error;}));
+
+    h->rtcp_watch[track_id].kind = __WATCH_RTCP;
+    h->rtcp_watch[track_id].track_id = track_id;
+    ASSERT(__watch(h, rtcp_fd, EPOLLIN, &h->rtcp_watch[track_id]) == SUCCESS, goto error);
+
+    h->rtcp_fd[track_id] = rtcp_fd;
+    h->rtp_fd[track_id] = rtp_fd;
 
     return SUCCESS;
 error:
-    if (server_fd > 0) close(server_fd);
+    if (rtp_fd > 0) close(rtp_fd);
+    if (rtcp_fd > 0) close(rtcp_fd);
     return FAILURE;
 }
 
-static inline int __bind_rtcp(struct connection_item_t *con )
+/* RTP goes out connected to the group, while the RTCP socket joins it to
+   hear the receivers' reports */
+static inline int __bind_mcast(rtsp_handle h, struct __rtsp_mount_t *m, int track_id)
 {
-    int server_fd = -1;
+    struct connection_item_t *g = m->mcast;
+    int rtp_fd = -1, rtcp_fd = -1;
     struct sockaddr_in addr = {};
+    struct ip_mreq mreq = {};
+    unsigned char ttl = h->mcast_ttl;
     int tmp;
 
-    /* reset socket */
-    if (con->trans[con->track_id].server_rtcp_fd != 0) {
-        CLOSE(con->trans[con->track_id].server_rtcp_fd);
-        con->trans[con->track_id].server_rtcp_fd = 0;
-    }
+    ASSERT((rtp_fd = socket(AF_INET, SOCK_DGRAM, 0)) > 0, ({
+                ERR("socket:%s\n", strerror(errno));
+                goto error;}));
 
-    /* setup serve rsocket */
-    ASSERT((server_fd = socket(AF_INET, SOCK_DGRAM, 0)) > 0, ({
+    setsockopt(rtp_fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+
+    addr = g->addr;
+    addr.sin_port = htons(g->trans[track_id].client_port_rtp);
+
+    ASSERT(connect(rtp_fd, (struct sockaddr *)&addr, sizeof(addr)) == 0, ({
+                ERR("connect:%s\n", strerror(errno));
+                goto error;}));
+
+    tmp = 1;
+    ASSERT(ioctl(rtp_fd, FIONBIO, &tmp) != -1, ({
+                ERR("ioctl:%s\n", strerror(errno));
+                goto error;}));
+
+    ASSERT((rtcp_fd = socket(AF_INET, SOCK_DGRAM, 0)) > 0, ({
                 ERR("socket:%s\n", strerror(errno));
                 goto error;}));
 
-    addr.sin_port = htons(con->trans[con->track_id].server_port_rtcp);
+    tmp = 1;
+    setsockopt(rtcp_fd, SOL_SOCKET, SO_REUSEADDR, &tmp, sizeof(tmp));
+    setsockopt(rtcp_fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_port = htons(g->trans[track_id].client_port_rtcp);
     addr.sin_addr.s_addr = htonl(INADDR_ANY);
     addr.sin_family = AF_INET;
 
-    tmp = 1;
-    setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &tmp, sizeof(tmp));
-
-    ASSERT(bind(server_fd, (struct sockaddr *)&addr, sizeof(addr)) == 0, ({
+    ASSERT(bind(rtcp_fd, (struct sockaddr *)&addr, sizeof(addr)) == 0, ({
                 ERR("bind:%s\n", strerror(errno));
                 goto error;}));
 
-    addr = con->addr;
-    addr.sin_port = htons(con->trans[con->track_id].client_port_rtcp);
-
-    ASSERT(connect(server_fd, (struct sockaddr *)&addr, sizeof(addr)) == 0, ({
-                ERR("connect:%s\n", strerror(errno));
+    mreq.imr_multiaddr = g->addr.sin_addr;
+    mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+    ASSERT(setsockopt(rtcp_fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) == 0, ({
+                ERR("membership:%s\n", strerror(errno));
                 goto error;}));
 
-    con->trans[con->track_id].server_rtcp_fd = server_fd;
+    m->mcast_watch[track_id].kind = __WATCH_GROUP;
+    m->mcast_watch[track_id].track_id = track_id;
+    m->mcast_watch[track_id].mount = m;
+    ASSERT(__watch(h, rtcp_fd, EPOLLIN, &m->mcast_watch[track_id]) == SUCCESS, goto error);
+
+    g->trans[track_id].server_rtcp_fd = rtcp_fd;
+    g->trans[track_id].server_rtp_fd = rtp_fd;
 
     return SUCCESS;
 error:
-    if (server_fd > 0) close(server_fd);
+    if (rtp_fd > 0) close(rtp_fd);
+    if (rtcp_fd > 0) close(rtcp_fd);
     return FAILURE;
 }
 
-static inline int __accept_proc_sock(rtsp_handle h, int server_fd, struct sock_select_t *p_socks)
+static inline int __accept_proc_sock(rtsp_handle h, int server_fd)
 {
     unsigned int len;
     int fd;
     struct sockaddr_in from_addr;
 
-    if (FD_ISSET(server_fd, &p_socks->rfds) != 0) {
+    for (;;) {
         /* accept new connection */
         len = sizeof(from_addr);
 
         fd = accept(server_fd, (struct sockaddr *)&from_addr,
                 &len);
 
-        /* we have selected this fd, but still EAGAIN may occur */
         if (fd < 0){
-            ASSERT(errno == EAGAIN, ({
+            ASSERT(errno == EAGAIN || errno == EWOULDBLOCK || errno == ECONNABORTED ||
+                errno == EMFILE || errno == ENFILE, ({
                         ERR("accept:%s\n",strerror(errno));
                         return FAILURE;}));
             return SUCCESS;
@@ -685,10 +1096,31 @@ static inline int __accept_proc_sock(rtsp_handle h, int server_fd, struct sock_s
         /* set server fd to non-blocking */
         fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
 
-        /* update connection-list exclusively */
-        ASSERT(__connection_list_add(h->con_pool, &h->con_list, fd, from_addr) == SUCCESS,
-                return FAILURE);
+        /* a refused client does not stop the others */
+        __connection_list_add(h, fd, from_addr);
     }
+}
+
+static int __rtcp_timeout_sock(struct list_t *e, void *v)
+{
+    struct connection_item_t *con;
+    unsigned int now = *(unsigned int *)v;
+    unsigned int silence = UINT32_MAX;
+
+    list_upcast(con, e);
+
+    if (con->con_state != __CON_S_PLAYING) return SUCCESS;
+
+    /* clients that never send RTCP are left alone */
+    for (int i = 0; i < sizeof(con->trans) / sizeof(*con->trans); i++)
+        if (con->trans[i].stat.heard_ms)
+            silence = min(silence, now - con->trans[i].stat.heard_ms);
+
+    if (silence == UINT32_MAX || silence < __RTCP_TIMEOUT_MS) return SUCCESS;
+
+    DBG("no receiver report for %u ms, disconnecting\n", silence);
+    __con_set_state(con, __CON_S_DISCONNECTED);
+    ASSERT(bufpool_detach(con->pool, con) == SUCCESS, ERR("connection detach failed\n"));
 
     return SUCCESS;
 }
@@ -702,6 +1134,153 @@ static int __connection_is_dead(struct list_t *l)
     return c->con_state == __CON_S_DISCONNECTED;
 }
 
+/* the mount whose path leads the URL of a request line, the longest one
+   if several do, and the first mount for anything else */
+static struct __rtsp_mount_t *__mount_find(rtsp_handle h, const char *line)
+{
+    struct __rtsp_mount_t *best = NULL;
+    const char *uri, *path, *end;
+    size_t len, best_len = 0;
+
+    if (!h->mount_num) return NULL;
+
+    /* METHOD rtsp://host[:port]/path RTSP/1.0 */
+    if (!(uri = strchr(line, ' '))) return h->mount[0];
+    uri++;
+    end = uri + strcspn(uri, " \r\n");
+
+    path = uri;
+    if (!strncasecmp(uri, "rtsp://", 7))
+        for (path = uri + 7; path < end && *path != '/'; path++);
+
+    for (int i = 0; i < h->mount_num; i++) {
+        len = strlen(h->mount[i]->path);
+        if (len > end - path || strncmp(path, h->mount[i]->path, len)) continue;
+        /* "/stream=1" does not lead "/stream=10" */
+        if (path + len != end && path[len] != '/' && path[len] != '?') continue;
+        if (!best || len > best_len) {
+            best = h->mount[i];
+            best_len = len;
+        }
+    }
+
+    return best ? best : h->mount[0];
+}
+
+/* the group session of a mount, under the handle lock. video goes to the
+   configured port and audio to the next pair, every mount four ports on */
+static struct connection_item_t *__mcast_create(rtsp_handle h, struct __rtsp_mount_t *m)
+{
+    struct connection_item_t *g;
+    unsigned short port = h->mcast_port + m->id * 4;
+
+    TALLOC(g, return NULL);
+
+    g->addr.sin_family = AF_INET;
+    g->addr.sin_addr = h->mcast_addr;
+    g->mount = m;
+
+    while (!g->ssrc)
+        g->ssrc = (unsigned int)rand_r(&h->ctx) << 16 ^ (unsigned int)rand_r(&h->ctx);
+
+    /* four ports per mount, the parity is never sent to a group */
+    for (int i = 0; i < __RTSP_TRACK_FEC; i++) {
+        g->trans[i].transport = __TRANSPORT_MULTICAST;
+        g->trans[i].client_port_rtp = port + i * 2;
+        g->trans[i].client_port_rtcp = port + i * 2 + 1;
+        g->trans[i].rtp_seq = rand_r(&h->ctx);
+        g->trans[i].rtcp_tick_org = 150;
+        g->trans[i].rtcp_tick = g->trans[i].rtcp_tick_org;
+        g->trans[i].stat.rtt_ms = -1;
+    }
+    g->con_state = __CON_S_PLAYING;
+
+    return g;
+}
+
+/* once the server thread is gone */
+static void __mount_delete(struct __rtsp_mount_t *m)
+{
+    if (m->mcast) {
+        for (int i = 0; i < sizeof(m->mcast->trans) / sizeof(*m->mcast->trans); i++) {
+            CLOSE(m->mcast->trans[i].server_rtcp_fd);
+            CLOSE(m->mcast->trans[i].server_rtp_fd);
+        }
+        FREE(m->mcast);
+    }
+
+    mime_encoded_delete(m->sprop_vps_b64);
+    mime_encoded_delete(m->sprop_sps_b64);
+    mime_encoded_delete(m->sprop_sps_b16);
+    mime_encoded_delete(m->sprop_pps_b64);
+
+    __rtp_batch_delete(m->batch);
+    FREE(m->pace);
+
+    /* the connection pool has gone already, with every session in it */
+    FREE(m->subs[0].con);
+    FREE(m->subs[1].con);
+
+    FREE(m);
+}
+
+/* publish the sessions of a mount that play now into the spare set. the
+   one it replaces is retired, to be reclaimed once no sender is inside */
+static void __subs_publish(rtsp_handle h, struct __rtsp_mount_t *m)
+{
+    int next = !m->subs_cur;
+    struct __rtsp_subs_t *s = &m->subs[next];
+    struct connection_item_t *con;
+    struct list_t *e;
+    char unicast;
+
+    m->subs_dirty = 0;
+
+    for (e = h->con_list.list; e; e = e->next) {
+        list_upcast(con, e);
+        if (con->mount != m || con->con_state != __CON_S_PLAYING) continue;
+
+        unicast = 0;
+        for (int i = 0; i < sizeof(con->trans) / sizeof(*con->trans); i++) {
+            if (con->trans[i].transport == __TRANSPORT_MULTICAST)
+                s->mcast[i] = 1;
+            else if (con->trans[i].transport != __TRANSPORT_NONE)
+                unicast = 1;
+            if (con->trans[i].transport == __TRANSPORT_UDP)
+                s->udp[i] = 1;
+        }
+
+        /* held until the set is reclaimed, the socket cannot go before */
+        if (unicast && s->count < h->max_con &&
+            bufpool_attach(con->pool, con) == SUCCESS)
+            s->con[s->count++] = con;
+    }
+
+    __atomic_store_n(&m->subs_cur, next, __ATOMIC_SEQ_CST);
+    m->subs_retired = 1;
+    m->subs_generation++;
+    DBG("%s: %d sessions, generation %u\n", m->path, s->count, m->subs_generation);
+}
+
+/* senders hold a set for one frame at most, so this is seldom refused */
+static int __subs_reclaim(struct __rtsp_mount_t *m)
+{
+    struct __rtsp_subs_t *s = &m->subs[!m->subs_cur];
+
+    if (__atomic_load_n(&m->subs_busy[!m->subs_cur], __ATOMIC_SEQ_CST))
+        return FAILURE;
+
+    for (int i = 0; i < s->count; i++)
+        ASSERT(bufpool_detach(s->con[i]->pool, s->con[i]) == SUCCESS,
+            ERR("connection detach failed\n"));
+    s->count = 0;
+    memset(s->mcast, 0, sizeof(s->mcast));
+    memset(s->udp, 0, sizeof(s->udp));
+    m->subs_retired = 0;
+
+    return SUCCESS;
+}
+
 /******************************************************************************
  *                  THREAD CALLBACKS
  ******************************************************************************/
@@ -710,50 +1289,91 @@ static void *rtspThrFxn(void *v)
     thread_handle           h = v;
     rtsp_handle             rh = h->sharedp->param_shared;
     void                    *status = THREAD_FAILURE;
-    struct sock_select_t    socks = {};
+    struct epoll_event      ev[__RTSP_EPOLL_EVENTS];
+    struct __watch_t        listen_watch = { .kind = __WATCH_LISTEN };
 
-    int     ret_select;
+    int     n;
     int     server_fd = -1;
+    char    pending = 0;
+    unsigned int now;
 
     DASSERT(thread_check_isoleted_job(h) == SUCCESS, goto error);
 
     /* open tcp connection */
     ASSERT((server_fd = __bind_tcp(rh->port)) > 0, goto error);
-
-    socks.nfds = server_fd + 1;
-    socks.h_rtsp = rh;
+    ASSERT(__watch(rh, server_fd, EPOLLIN, &listen_watch) == SUCCESS, goto error);
 
     thread_sync_init(h);
 
     while (!gbl_get_quit(h->sharedp->gbl)) {
-        FD_ZERO(&(socks.rfds));
-        FD_SET(server_fd, &(socks.rfds));
-        socks.timeout.tv_sec = 1;
-        socks.timeout.tv_usec = 0;
+        n = epoll_wait(rh->epfd, ev, __RTSP_EPOLL_EVENTS, pending ? 1 : 1000);
+        ASSERT(n >= 0 || errno == EINTR, ({
+                    ERR("epoll_wait:%s\n", strerror(errno));
+                    goto error;}));
 
-        ASSERT(list_map_inline(&rh->con_list, (__set_select_sock), &socks) == SUCCESS, goto error);
+        /* lock while tcp layer is done */
+        rtsp_lock(rh);
 
-        ASSERT((ret_select = select(socks.nfds, &(socks.rfds), NULL, NULL, &(socks.timeout))) >= 0, ({
-                    ERR("select:%s\n", strerror(errno));
-                    goto error;}));
+        for (int i = 0; i < n; i++) {
+            struct __watch_t *w = ev[i].data.ptr;
+            struct connection_item_t *con;
+
+            switch (w->kind) {
+                case __WATCH_LISTEN:
+                    ASSERT(__accept_proc_sock(rh, server_fd) == SUCCESS,
+                        ({ rtsp_unlock(rh); goto error;}));
+                    break;
+                case __WATCH_CLIENT:
+                    con = container_of(struct connection_item_t, w, watch);
+                    ASSERT(__message_proc_sock(con, rh, ev[i].events) == SUCCESS,
+                        ({ rtsp_unlock(rh); goto error;}));
+                    break;
+                case __WATCH_RTCP:
+                    __rtcp_proc_sock(rh, w->track_id);
+                    break;
+                case __WATCH_GROUP: {
+                    /* every receiver on the group reports to it */
+                    struct connection_item_t *g = w->mount->mcast;
+                    unsigned char rtcp[__RTSP_TCP_BUF_SIZE];
+                    ssize_t len;
+
+                    while ((len = recv(g->trans[w->track_id].server_rtcp_fd,
+                        rtcp, sizeof(rtcp), MSG_DONTWAIT)) > 0)
+                        __rtcp_recv(g, w->track_id, rtcp, len);
+                    break;
+                }
+                default: ERR("unexpected watch\n"); break;
+            }
+        }
 
-        if (ret_select > 0){
-            /* lock while tcp layer is done */
-            rtsp_lock(rh);
+        /* silent receivers are reaped even when nothing else happens */
+        now = millis();
+        ASSERT(list_map_inline(&rh->con_list, __rtcp_timeout_sock, &now) == SUCCESS, 
+                ({ rtsp_unlock(rh); goto error;}));
 
-            ASSERT(__accept_proc_sock(rh, server_fd, &socks) == SUCCESS, 
-                    ({ rtsp_unlock(rh); goto error;}));
+        /* senders see who plays from here on. a set still being read
+           holds the next change back, and the loop comes back for it soon */
+        pending = 0;
+        for (int i = 0; i < rh->mount_num; i++) {
+            struct __rtsp_mount_t *m = rh->mount[i];
 
-            ASSERT(list_map_inline(&rh->con_list, __message_proc_sock, &socks) == SUCCESS, 
-                    ({ rtsp_unlock(rh); goto error;}));
+            if (m->subs_retired && __subs_reclaim(m) != SUCCESS) {
+                pending = 1;
+                continue;
+            }
+            if (!m->subs_dirty) continue;
 
-            MUST(list_sweep(&rh->con_list, __connection_is_dead) == SUCCESS, 
-                    ({ rtsp_unlock(rh); goto error;}));
+            __subs_publish(rh, m);
+            if (__subs_reclaim(m) != SUCCESS)
+                pending = 1;
+        }
 
-            socks.nfds = max(server_fd, __find_fd_max(&rh->con_list)) + 1;
+        /* a dead connection's socket closes once its last user lets go,
+           which takes it out of the epoll set */
+        MUST(list_sweep(&rh->con_list, __connection_is_dead) == SUCCESS, 
+                ({ rtsp_unlock(rh); goto error;}));
 
-            rtsp_unlock(rh);
-        } 
+        rtsp_unlock(rh);
         //bufpool_statistics(rh->con_pool);
     }
 
@@ -771,6 +1391,79 @@ error:
 /******************************************************************************
  *              PUBLIC FUNCTIONS
  ******************************************************************************/
+int rtsp_get_stats(rtsp_handle h, struct rtsp_stat_t *stat, int max)
+{
+    struct connection_item_t *con;
+    struct list_t *e;
+    unsigned int now = millis();
+    int n = 0;
+
+    DASSERT(h, return 0);
+
+    rtsp_lock(h);
+    for (e = h->con_list.list; e && n < max; e = e->next) {
+        list_upcast(con, e);
+        if (con->con_state != __CON_S_PLAYING) continue;
+
+        for (int i = 0; i < sizeof(con->trans) / sizeof(*con->trans) && n < max; i++) {
+            if (con->trans[i].transport == __TRANSPORT_NONE) continue;
+
+            /* group viewers all share the figures of the one session */
+            struct connection_item_t *src =
+                con->trans[i].transport == __TRANSPORT_MULTICAST ? con->mount->mcast : con;
+
+            /* the telephony codecs run on their sampling clock, everything
+               else on 90 kHz */
+            unsigned int rate = i == 1 && (h->audioPt == 0 || h->audioPt == 8 ||
+                h->audioPt == 18) ? 8 : 90;
+
+            memset(&stat[n], 0, sizeof(stat[n]));
+            inet_ntop(AF_INET, &con->addr.sin_addr, stat[n].addr, sizeof(stat[n].addr));
+            if (con->mount)
+                strncpy(stat[n].mount, con->mount->path[0] ? con->mount->path : "/",
+                    sizeof(stat[n].mount) - 1);
+            stat[n].track = i;
+            stat[n].tcp = con->trans[i].transport == __TRANSPORT_TCP;
+            stat[n].multicast = con->trans[i].transport == __TRANSPORT_MULTICAST;
+            stat[n].fraction_lost = src->trans[i].stat.fraction * 100 / 256;
+            stat[n].lost = src->trans[i].stat.lost;
+            stat[n].jitter_ms = src->trans[i].stat.jitter / rate;
+            stat[n].rtt_ms = src->trans[i].stat.rtt_ms;
+            stat[n].kbps = src->trans[i].stat.kbps;
+            stat[n].packets = src->trans[i].stat.packets + src->trans[i].rtcp_packet_cnt;
+            stat[n].octets = src->trans[i].stat.octets + src->trans[i].rtcp_octet;
+            stat[n].resent = src->trans[i].stat.resent;
+            stat[n].dropped = src->trans[i].stat.dropped;
+            stat[n].silent_ms = src->trans[i].stat.heard_ms ?
+                (int)(now - src->trans[i].stat.heard_ms) : -1;
+            n++;
+        }
+    }
+    rtsp_unlock(h);
+
+    return n;
+}
+
+void rtsp_set_params(rtsp_mount_handle m, const struct NalParamSets *ps)
+{
+    DASSERT(m, return);
+
+    /* only the encoder thread writes these, so the unlocked check is safe */
+    if (ps->generation == m->params.generation && ps->isH265 == m->params.isH265)
+        return;
+
+    rtsp_lock(m->h);
+    memcpy(&m->params, ps, sizeof(m->params));
+    rtsp_unlock(m->h);
+}
+
+void rtsp_set_bitrate(rtsp_mount_handle m, unsigned int kbps)
+{
+    DASSERT(m, return);
+
+    __atomic_store_n(&m->kbps, kbps, __ATOMIC_RELAXED);
+}
+
 void rtsp_finish(rtsp_handle h)
 {
     /* close every connections in the handle */
@@ -783,17 +1476,22 @@ void rtsp_finish(rtsp_handle h)
             ASSERT(threadpool_join(h->pool) == SUCCESS, ERR("thread join with error\n"));
 
             bufpool_delete(h->con_pool);
-            bufpool_delete(h->transfer_pool);
-
-            mime_encoded_delete(h->sprop_vps_b64);
-            mime_encoded_delete(h->sprop_sps_b64);
-            mime_encoded_delete(h->sprop_sps_b16);
-            mime_encoded_delete(h->sprop_pps_b64);
+            __connectionpool_free();
 
             threadpool_delete(h->pool);
         }
 
+        for (int i = 0; i < sizeof(h->rtp_fd) / sizeof(*h->rtp_fd); i++) {
+            CLOSE(h->rtcp_fd[i]);
+            CLOSE(h->rtp_fd[i]);
+        }
+        CLOSE(h->epfd);
+
+        for (int i = 0; i < h->mount_num; i++)
+            __mount_delete(h->mount[i]);
+
         pthread_mutex_destroy(&h->mutex);
+        sem_destroy(&h->pace_sem);
 
         FREE(h);
     }
@@ -801,11 +1499,11 @@ void rtsp_finish(rtsp_handle h)
     return;
 }
 
-rtsp_handle rtsp_create(unsigned char max_con, unsigned int port, int priority)
+rtsp_handle rtsp_create(int max_con, unsigned int port, int priority)
 {
     rtsp_handle       nh = NULL;
 
-    ASSERT(max_con <= RTSP_MAXIMUM_CONNECTIONS,
+    ASSERT(max_con > 0 && max_con <= RTSP_MAXIMUM_CONNECTIONS,
             ({ERR("maximum number of connections should be within %d\n", RTSP_MAXIMUM_CONNECTIONS);
              return NULL;}));
 
@@ -815,15 +1513,24 @@ rtsp_handle rtsp_create(unsigned char max_con, unsigned int port, int priority)
     nh->max_con = max_con;
     nh->port = port;
     nh->priority = priority;
+    /* session ids, SSRCs and sequence numbers all come from this seed */
+    nh->ctx = (unsigned)time(NULL) ^ (unsigned)getpid() << 16;
 
     pthread_mutex_init(&nh->mutex,NULL);
+    sem_init(&nh->pace_sem, 0, 0);
 
     ASSERT(nh->pool = threadpool_create(nh), goto error);
-    ASSERT(nh->con_pool =  __connectionpool_create(max_con), goto error);
-    ASSERT(nh->transfer_pool =  __transpool_create(max_con), goto error);
+    /* sessions are only paid for once they are used */
+    ASSERT((nh->epfd = epoll_create(__RTSP_EPOLL_EVENTS)) > 0, goto error);
+    ASSERT(nh->con_pool =  __connectionpool_create(
+        min(max_con, __RTSP_POOL_CHUNK), max_con), goto error);
 
     /* create tcp thread */
-    ASSERT(CREATE_THREAD(nh->pool, rtspThrFxn, priority--, NULL),
+    ASSERT(CREATE_THREAD(nh->pool, rtspThrFxn, priority, NULL),
+            goto error);
+
+    /* the pacer keeps time for every UDP receiver, so it runs as high */
+    ASSERT(CREATE_THREAD(nh->pool, rtpThrFxn, priority, NULL),
             goto error);
 
     ASSERT(threadpool_start(nh->pool) == SUCCESS,
@@ -849,6 +1556,140 @@ void rtsp_configure_auth(rtsp_handle h, const char *user, const char *pass)
     }
 }
 
+int rtsp_configure_multicast(rtsp_handle h, const char *group,
+    unsigned short port, unsigned char ttl)
+{
+    struct in_addr addr;
+    int ret = SUCCESS;
+
+    DASSERT(h, return FAILURE);
+    ASSERT(!h->mcast_addr.s_addr, return FAILURE);
+
+    ASSERT(inet_pton(AF_INET, group, &addr) == 1 &&
+        IN_MULTICAST(ntohl(addr.s_addr)), ({
+            ERR("%s is not a multicast group\n", group);
+            return FAILURE;}));
+
+    rtsp_lock(h);
+    h->mcast_addr = addr;
+    h->mcast_port = port;
+    h->mcast_ttl = ttl;
+
+    /* mounts added from now on get theirs as they come */
+    for (int i = 0; i < h->mount_num; i++)
+        if (!(h->mount[i]->mcast = __mcast_create(h, h->mount[i])))
+            ret = FAILURE;
+    rtsp_unlock(h);
+
+    return ret;
+}
+
+int rtsp_configure_pacing(rtsp_handle h, unsigned int burst_pct)
+{
+    DASSERT(h, return FAILURE);
+
+    /* once paced, the encoder threads no longer send to UDP receivers at
+       all, so there is no turning it off again */
+    ASSERT(burst_pct >= 100, ({
+        ERR("a pace below the target bitrate would never catch up\n");
+        return FAILURE;}));
+
+    __atomic_store_n(&h->pace_burst, burst_pct, __ATOMIC_RELAXED);
+
+    return SUCCESS;
+}
+
+int rtsp_configure_fec(rtsp_handle h, unsigned int ratio_pct)
+{
+    DASSERT(h, return FAILURE);
+
+    ASSERT(ratio_pct <= 100, ({
+        ERR("more parity than video is not supported\n");
+        return FAILURE;}));
+
+    /* sessions already playing keep the group size they started with */
+    __atomic_store_n(&h->fec_group, ratio_pct ?
+        min(max(100 / ratio_pct, 1U), (unsigned int)__RTP_FEC_GROUP_MAX) : 0,
+        __ATOMIC_RELAXED);
+
+    return SUCCESS;
+}
+
+int rtsp_configure_nack(rtsp_handle h, unsigned int history_ms, unsigned int budget_pct)
+{
+    DASSERT(h, return FAILURE);
+
+    ASSERT(budget_pct <= 100, ({
+        ERR("resending more than the stream itself only feeds congestion\n");
+        return FAILURE;}));
+
+    /* rings are sized once, on the first frame of their mount */
+    h->nack_ms = history_ms;
+    __atomic_store_n(&h->nack_budget, budget_pct, __ATOMIC_RELAXED);
+
+    return SUCCESS;
+}
+
+int rtsp_configure_gop_cache(rtsp_handle h, unsigned int window_ms)
+{
+    DASSERT(h, return FAILURE);
+
+    /* as for NACKs, the rings are sized on their first frame */
+    __atomic_store_n(&h->gop_ms, window_ms, __ATOMIC_RELAXED);
+
+    return SUCCESS;
+}
+
+rtsp_mount_handle rtsp_add_mount(rtsp_handle h, const char *path)
+{
+    struct __rtsp_mount_t *m = NULL;
+    size_t len;
+
+    DASSERT(h, return NULL);
+    ASSERT(path && path[0] == '/' && (len = strlen(path)) < sizeof(m->path), ({
+        ERR("invalid mount path\n");
+        return NULL;}));
+
+    /* "/stream=1/" and "/stream=1" are the same mount, and "/" is just
+       the default one */
+    while (len && path[len - 1] == '/') len--;
+
+    rtsp_lock(h);
+
+    for (int i = 0; i < h->mount_num; i++)
+        if (strlen(h->mount[i]->path) == len && !strncmp(h->mount[i]->path, path, len)) {
+            m = h->mount[i];
+            goto unlock;
+        }
+
+    ASSERT(h->mount_num < RTSP_MAXIMUM_MOUNTS, ({
+        ERR("no more than %d mounts\n", RTSP_MAXIMUM_MOUNTS);
+        goto unlock;}));
+
+    TALLOC(m, goto unlock);
+    ASSERT((m->batch = calloc(1, sizeof(*m->batch))) &&
+        (m->subs[0].con = calloc(h->max_con, sizeof(*m->subs[0].con))) &&
+        (m->subs[1].con = calloc(h->max_con, sizeof(*m->subs[1].con))), ({
+            __mount_delete(m);
+            m = NULL;
+            goto unlock;}));
+
+    m->h = h;
+    m->id = h->mount_num;
+    memcpy(m->path, path, len);
+
+    if (h->mcast_addr.s_addr)
+        ASSERT(m->mcast = __mcast_create(h, m), ERR("%s has no group\n", path));
+
+    h->mount[h->mount_num] = m;
+    __atomic_store_n(&h->mount_num, h->mount_num + 1, __ATOMIC_RELEASE);
+
+unlock:
+    rtsp_unlock(h);
+
+    return m;
+}
+
 int rtsp_tick(rtsp_handle h)
 {
     ASSERT(h, return FAILURE);
@@ -3,22 +3,39 @@
 
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <arpa/inet.h>
+#include <errno.h>
+#include <semaphore.h>
 
 #include "rtsp_server.h"
 
 #include "common.h"
 #include "rfc.h"
+#include "rtp.h"
 #include "list.h"
 #include "thread.h"
 #include "bufpool.h"
 #include "mime.h"
+#include "../fmt/nal.h"
 
 /******************************************************************************
  *              DEFINITIONS
  ******************************************************************************/
 #define __RTSP_TCP_BUF_SIZE 4096
+/* per-connection backlog for interleaved RTP, roughly one 4K IDR */
+#define __RTSP_TCP_OUTBUF_SIZE (1024 * 1024)
 #define __CONNECTION_QUEUE_SIZE 16
+/* sessions are added this many at a time, up to the maximum */
+#define __RTSP_POOL_CHUNK 16
+#define __RTSP_EPOLL_EVENTS 32
+/* one socket now carries the bursts of every unicast viewer of a track */
+#define __RTSP_UDP_SNDBUF (1024 * 1024)
+/* a receiver that reported once and then went quiet this long is gone */
+#define __RTCP_TIMEOUT_MS 30000
+/* video, audio, then the parity of the video, see rtsp_configure_fec() */
+#define __RTSP_TRACKS 3
+#define __RTSP_TRACK_FEC 2
 
 #define __TERM  "\r\n"
 #define SCMP(id,s) (strncasecmp(id,s,strlen(id)) == 0)
@@ -50,6 +67,14 @@ enum __parser_state_e {
     __PARSER_S_COUNT
 };
 
+enum __transport_e {
+    __TRANSPORT_NONE = 0,
+    __TRANSPORT_UDP,
+    __TRANSPORT_TCP,
+    __TRANSPORT_MULTICAST,
+    __TRANSPORT_COUNT
+};
+
 enum __method_e {
     __METHOD_OPTIONS,
     __METHOD_DESCRIBE,
@@ -63,9 +88,24 @@ enum __method_e {
     __METHOD_COUNT
 };
 
+enum __watch_e {
+    __WATCH_LISTEN = 0,
+    __WATCH_CLIENT,
+    __WATCH_RTCP,
+    __WATCH_GROUP,
+    __WATCH_COUNT
+};
+
 /******************************************************************************
  *              DATA STRUCTURES
  ******************************************************************************/
+/* what an epoll event points back to */
+struct __watch_t {
+    enum __watch_e kind;
+    int track_id;
+    struct __rtsp_mount_t *mount; /* for a group */
+};
+
 struct __time_stat_t {
     struct timeval prev_tv;
     unsigned long long avg;
@@ -77,13 +117,18 @@ struct __time_stat_t {
 
 struct connection_item_t {
     struct sockaddr_in addr;
-    FILE *fp_tcp_read;
-    FILE *fp_tcp_write;
+    struct __watch_t watch;
+    struct __rtsp_mount_t *mount; /* picked by the URL of DESCRIBE and SETUP */
     int client_fd;
     int track_id;
     int cseq;
 
     struct {
+        enum __transport_e transport;
+        unsigned char channel_rtp;
+        unsigned char channel_rtcp;
+        char wait_key;
+        char prime;             /* owed the cached GOP ahead of the live video */
         int server_rtcp_fd;
         int server_rtp_fd;
         unsigned int client_port_rtp;
@@ -98,7 +143,54 @@ struct connection_item_t {
         int rtcp_tick_org;
         unsigned short rtp_seq;
         unsigned int rtp_timestamp;
-    } trans[2];
+        /* token bucket of a paced track, pacer thread only past 'live' */
+        struct {
+            char live;              /* cleared to start over from the newest packet */
+            unsigned int next;      /* ring position of the next packet */
+            unsigned int frames;    /* access units accounted for */
+            unsigned int rate;      /* bytes per second */
+            int tokens;             /* bytes that may go out right now */
+            unsigned long long refill_us;
+        } pace;
+
+        /* receiver feedback and our own send figures, see rtsp_get_stats() */
+        struct {
+            unsigned int lsr;       /* middle 32 bits of the last SR's NTP time */
+            unsigned int sr_ms;     /* millis() when that SR went out */
+            unsigned int heard_ms;  /* millis() of the last RTCP packet, 0 for none */
+            unsigned char fraction;
+            int lost;
+            unsigned int jitter;
+            int rtt_ms;
+            unsigned int kbps;
+            unsigned long long packets;
+            unsigned long long octets;
+            unsigned int resent;    /* packets sent again on a NACK */
+            unsigned int dropped;   /* packets given up on a full socket */
+        } stat;
+    } trans[__RTSP_TRACKS];
+
+    struct __rtp_fec_t fec; /* for trans[__RTSP_TRACK_FEC], by the video sender */
+    struct __rtp_nack_t nack; /* of the video, answered by the control thread */
+
+    /* requests and interleaved packets as they come off the control socket,
+       parsed from 'off' once a whole request is in */
+    struct {
+        unsigned char buf[__RTSP_TCP_BUF_SIZE];
+        size_t off;
+        size_t len;
+        size_t skip; /* rest of an interleaved frame too large to keep */
+    } in;
+
+    /* everything written to the control socket goes through here, so that
+       responses and interleaved packets never get torn apart */
+    struct {
+        pthread_mutex_t mutex;
+        unsigned char *buf;
+        size_t size;
+        size_t off;
+        size_t len;
+    } out;
 
     enum __connection_state_e con_state;
     enum __parser_state_e parser_state;
@@ -110,10 +202,58 @@ struct connection_item_t {
     struct list_t list_entry;
 };
 
-struct transfer_item_t {
-    struct list_t list_entry;
-    struct connection_item_t *con;
-    bufpool_handle pool;
+struct __rtp_batch_t;
+struct __rtp_pace_t;
+
+/* the sessions a mount sends to. the control thread fills the spare one of
+   two whenever a session starts or stops playing, and the senders read the
+   published one without locking, see __subs_enter() */
+struct __rtsp_subs_t {
+    int count;
+    char mcast[__RTSP_TRACKS];      /* some viewer of the track is on the group */
+    char udp[__RTSP_TRACKS];        /* some unicast one is on UDP */
+    struct connection_item_t **con; /* unicast and interleaved viewers, attached */
+};
+
+/* everything that belongs to one stream rather than to the server */
+struct __rtsp_mount_t {
+    struct __rtsp_obj_t *h;
+    int id;
+    char path[32];                  /* without a trailing slash */
+    char isH265;
+    char isJpeg;                    /* RFC 2435 rather than either of those */
+    mime_encoded_handle sprop_vps_b64;
+    mime_encoded_handle sprop_sps_b64;
+    mime_encoded_handle sprop_pps_b64;
+    mime_encoded_handle sprop_sps_b16;
+    struct NalParamSets params;     /* latest parameter sets, under mutex */
+    struct NalParamSets raw_params; /* collected by rtp_send_h26x */
+    char sdp[__RTSP_TCP_BUF_SIZE];  /* cached DESCRIBE body */
+    unsigned int sdp_generation;
+    unsigned char sdp_audio_pt;
+    char sdp_h265;
+    char sdp_jpeg;
+    char sdp_fec;
+    char sdp_nack;
+    struct __rtp_batch_t *batch; /* video packets, owned by the encoder thread */
+    /* the tables and the start of the scan, the first packet of a JPEG frame */
+    unsigned char jpeg_first[__RTP_MAXPAYLOADSIZE];
+    /* video waiting for the pacer and kept for NACKs, allocated by the
+       encoder thread on the first frame either needs it */
+    struct __rtp_pace_t *pace;
+    unsigned int kbps;              /* target bitrate, see rtsp_set_bitrate() */
+    unsigned long long frame_us;    /* timestamp of the last access unit */
+    unsigned int interval_us;       /* since the one before it */
+    /* the one session every multicast viewer of the mount joins, with the
+       group as its address; NULL unless rtsp_configure_multicast() was called */
+    struct connection_item_t *mcast;
+    struct __watch_t mcast_watch[2];
+    struct __rtsp_subs_t subs[2];
+    int subs_cur;       /* the published one */
+    int subs_busy[2];   /* senders inside each */
+    char subs_dirty;    /* a session changed, under mutex */
+    char subs_retired;  /* the other one still holds its sessions */
+    unsigned int subs_generation;
 };
 
 struct __rtsp_obj_t {
@@ -121,40 +261,55 @@ struct __rtsp_obj_t {
     struct list_head_t con_list;
     threadpool_handle pool;
     bufpool_handle con_pool;
-    bufpool_handle transfer_pool;
     unsigned short port;
     struct __time_stat_t stat;
-    char isH265;
     unsigned char audioPt;
-    mime_encoded_handle sprop_vps_b64;
-    mime_encoded_handle sprop_sps_b64;
-    mime_encoded_handle sprop_pps_b64;
-    mime_encoded_handle sprop_sps_b16;
+    /* only ever appended to, under mutex; the pacer reads mount_num
+       without it */
+    struct __rtsp_mount_t *mount[RTSP_MAXIMUM_MOUNTS];
+    int mount_num;
+    /* where the mounts' groups go, zero until configured */
+    struct in_addr mcast_addr;
+    unsigned short mcast_port;
+    unsigned char mcast_ttl;
+    /* how much faster than its target a session may catch up, in percent,
+       zero while unpaced; see rtsp_configure_pacing() */
+    unsigned int pace_burst;
+    sem_t pace_sem;   /* wakes an idle pacer */
+    int pace_idle;
+    unsigned int fec_group; /* given to each session that plays, 0 for no FEC */
+    unsigned int nack_budget; /* likewise, 0 for no retransmission */
+    unsigned int nack_ms;     /* the ring keeps at least this much then */
+    unsigned int gop_ms;      /* likewise for the GOP cache, 0 for none */
+    /* shared by every unicast UDP session, per track */
+    int rtp_fd[__RTSP_TRACKS];
+    int rtcp_fd[__RTSP_TRACKS];
+    struct __watch_t rtcp_watch[__RTSP_TRACKS];
+    int epfd;
     unsigned ctx; /* for rand_r */
     int con_num;
-    unsigned char max_con;
+    int max_con;
     int priority;
     char isAuthOn;
     char user[32];
     char pass[32];
 };
 
-struct sock_select_t {
-    struct timeval timeout;
-    fd_set rfds;
-    fd_set wfds;
-    fd_set efds;
-    int nfds;
-    rtsp_handle h_rtsp;
-};
-
 /******************************************************************************
  *              FUNCTION DECLARATIONS
  ******************************************************************************/
+void *rtpThrFxn(void *v);
+
 static inline void rtsp_lock(rtsp_handle h);
 static inline void rtsp_unlock(rtsp_handle h);
 static inline int __read_line(struct connection_item_t *p, char *buf);
-static inline int __transfer_item_cleaner(struct list_t *e);
+static inline int __request_ready(struct connection_item_t *p);
+static inline void __con_set_state(struct connection_item_t *p, enum __connection_state_e state);
+static inline struct __rtsp_subs_t *__subs_enter(struct __rtsp_mount_t *m, int *slot);
+static inline void __subs_leave(struct __rtsp_mount_t *m, int slot);
+static inline void __con_out_flush(struct connection_item_t *p);
+static inline int __con_out_write(struct connection_item_t *p,
+    const struct iovec *iov, int iovcnt, char droppable);
 
 /******************************************************************************
  *              INLINE FUNCTIONS
@@ -169,24 +324,19 @@ static inline void rtsp_unlock(rtsp_handle h)
     pthread_mutex_unlock(&h->mutex);
 }
 
+/* next line of the buffered request, FALSE at the empty one ending it */
 static inline int __read_line(struct connection_item_t *p, char *buf)
 {
-    /* we set the socket to non-blocking */
-    if (fgets(buf, __RTSP_TCP_BUF_SIZE, p->fp_tcp_read) == NULL) 
-	{
-        /* unexpected end. we do not expect it */
-        if (p->parser_state == __PARSER_S_INIT) {
-            /* when this selected sd is EOF at first glance, it's dead */
-            DBG("disconnected\n"); 
-        } else {
-            /* corrupted message. nothing to be done */
-            ERR("message end before delimiter\n");
-        }
+    unsigned char *s = p->in.buf + p->in.off, *e;
+    size_t n;
 
-        p->con_state = __CON_S_DISCONNECTED;
-        ASSERT(bufpool_detach(p->pool, p) == SUCCESS, ERR("connection detach failed\n"));
-        return FALSE;
-    }
+    /* parsing only starts once the whole request is in */
+    ASSERT(e = memchr(s, '\n', p->in.len - p->in.off), return FALSE);
+
+    n = min((size_t)(e - s) + 1, (size_t)__RTSP_TCP_BUF_SIZE - 1);
+    memcpy(buf, s, n);
+    buf[n] = 0;
+    p->in.off += e - s + 1;
 
     DBG(">%s", buf);
 
@@ -194,6 +344,110 @@ static inline int __read_line(struct connection_item_t *p, char *buf)
     return !(SCMP(__TERM, buf));
 }
 
+/* whether a complete request sits at the parser cursor */
+static inline int __request_ready(struct connection_item_t *p)
+{
+    const unsigned char *s = p->in.buf + p->in.off;
+    size_t n = p->in.len - p->in.off;
+
+    for (size_t i = 3; i < n; i++)
+        if (s[i] == '\n' && s[i - 1] == '\r' && s[i - 2] == '\n' && s[i - 3] == '\r')
+            return TRUE;
+
+    return FALSE;
+}
+
+/* caller holds p->out.mutex */
+static inline void __con_out_flush(struct connection_item_t *p)
+{
+    ssize_t n;
+
+    while (p->out.len) {
+        n = send(p->client_fd, p->out.buf + p->out.off, p->out.len,
+            MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+                return;
+            /* peer is gone, the control thread will reap the connection */
+            p->out.len = 0;
+            break;
+        }
+        p->out.off += n;
+        p->out.len -= n;
+    }
+
+    p->out.off = 0;
+}
+
+/* send iov on the control socket without ever blocking. whatever the
+   socket does not take is queued; droppable writes are refused instead when
+   the backlog is full, but a write that went out partially is always queued
+   so the stream stays framed */
+static inline int __con_out_write(struct connection_item_t *p,
+    const struct iovec *iov, int iovcnt, char droppable)
+{
+    size_t total = 0, sent = 0, need;
+    int ret = SUCCESS;
+    ssize_t n;
+
+    for (int i = 0; i < iovcnt; i++)
+        total += iov[i].iov_len;
+
+    pthread_mutex_lock(&p->out.mutex);
+
+    if (p->out.len)
+        __con_out_flush(p);
+
+    if (!p->out.len) {
+        struct msghdr msg = { .msg_iov = (struct iovec *)iov, .msg_iovlen = iovcnt };
+
+        n = sendmsg(p->client_fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                goto unlock;
+            n = 0;
+        }
+        sent = n;
+    }
+
+    if (sent == total)
+        goto unlock;
+
+    need = p->out.len + total - sent;
+    if (!sent && droppable && need > p->out.size) {
+        ret = FAILURE;
+        goto unlock;
+    }
+
+    if (p->out.off + need > p->out.size) {
+        if (p->out.len && p->out.off)
+            memmove(p->out.buf, p->out.buf + p->out.off, p->out.len);
+        p->out.off = 0;
+    }
+
+    if (need > p->out.size) {
+        unsigned char *buf = realloc(p->out.buf, max(need, p->out.size * 2));
+        ASSERT(buf, ({ ret = FAILURE; goto unlock; }));
+        p->out.buf = buf;
+        p->out.size = max(need, p->out.size * 2);
+    }
+
+    /* queue what is left, skipping the bytes the socket already took */
+    for (int i = 0; i < iovcnt; i++) {
+        size_t skip = min(sent, iov[i].iov_len);
+
+        memcpy(p->out.buf + p->out.off + p->out.len,
+            (const unsigned char *)iov[i].iov_base + skip, iov[i].iov_len - skip);
+        p->out.len += iov[i].iov_len - skip;
+        sent -= skip;
+    }
+
+unlock:
+    pthread_mutex_unlock(&p->out.mutex);
+
+    return ret;
+}
+
 static inline unsigned long long __get_random_byte(unsigned *ctx)
 {
     return (unsigned long long)(((int)(random())*(*ctx)) % 256);
@@ -212,21 +466,38 @@ static inline unsigned long long __get_random_llu(unsigned *ctx)
         | (__get_random_byte(ctx)) << 56;
 }
 
-static inline int __transfer_item_cleaner(struct list_t *e)
+/* control thread only. starting or stopping to play changes who the
+   mount sends to */
+static inline void __con_set_state(struct connection_item_t *p, enum __connection_state_e state)
 {
-    struct transfer_item_t *p;
-    list_upcast(p,e);
+    if (p->mount && (p->con_state == __CON_S_PLAYING) != (state == __CON_S_PLAYING))
+        p->mount->subs_dirty = 1;
 
-    if (p->con) {
-        ASSERT(bufpool_detach(p->con->pool,p->con) == SUCCESS,
-            return FAILURE);
-        p->con = NULL;
-    }
+    /* a session that plays again picks up from the live edge */
+    if (state == __CON_S_PLAYING && p->con_state != __CON_S_PLAYING)
+        for (int i = 0; i < sizeof(p->trans) / sizeof(*p->trans); i++)
+            __atomic_store_n(&p->trans[i].pace.live, 0, __ATOMIC_RELEASE);
 
-    ASSERT(bufpool_detach(p->pool, p) == SUCCESS,
-        return FAILURE);
+    p->con_state = state;
+}
 
-    return SUCCESS;
+/* pin the published viewer set until __subs_leave(). a set that got
+   replaced in between is let go for the newer one, so the control thread
+   never waits on a sender that has not started reading yet */
+static inline struct __rtsp_subs_t *__subs_enter(struct __rtsp_mount_t *m, int *slot)
+{
+    for (;;) {
+        *slot = __atomic_load_n(&m->subs_cur, __ATOMIC_SEQ_CST);
+        __atomic_add_fetch(&m->subs_busy[*slot], 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&m->subs_cur, __ATOMIC_SEQ_CST) == *slot)
+            return &m->subs[*slot];
+        __atomic_sub_fetch(&m->subs_busy[*slot], 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+static inline void __subs_leave(struct __rtsp_mount_t *m, int slot)
+{
+    __atomic_sub_fetch(&m->subs_busy[slot], 1, __ATOMIC_RELEASE);
 }
 
 static inline int __get_timestamp_offset(struct __time_stat_t *p_stat, struct timeval *p_tv)
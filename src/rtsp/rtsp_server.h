@@ -13,12 +13,44 @@ extern "C" {
 #define SERVER_RTP_PORT 5004
 #define SERVER_RTCP_PORT 5025
 #define RTSP_MAXIMUM_FRAMERATE 60
-#define RTSP_MAXIMUM_CONNECTIONS 16
+#define RTSP_MAXIMUM_CONNECTIONS 256
+#define RTP_MAXIMUM_NALS 64
+#define RTSP_MAXIMUM_MOUNTS 8
 
 #define STR_RTSP_VERSION "RTSP/1.0"
 
 /* __rtsp_obj_t is private. you will not see it */
 typedef struct __rtsp_obj_t *rtsp_handle;
+/* one stream of the server and the URL it answers on */
+typedef struct __rtsp_mount_t *rtsp_mount_handle;
+
+struct NalParamSets;
+
+/* one playing track of a session, as reported back through RTCP */
+struct rtsp_stat_t {
+    char addr[16];
+    char mount[32];             /* path of the stream being played */
+    char track;                 /* 0 for video, 1 for audio, 2 for FEC */
+    char tcp;                   /* interleaved on the RTSP connection */
+    char multicast;             /* figures are the group's, shared by its viewers */
+    unsigned char fraction_lost;/* percent, over the last report interval */
+    int lost;                   /* cumulative packets lost */
+    unsigned int jitter_ms;
+    int rtt_ms;                 /* -1 until the receiver echoes a report */
+    unsigned int kbps;          /* sent over the last report interval */
+    unsigned long long packets;
+    unsigned long long octets;
+    int silent_ms;              /* since the last receiver report, -1 for none */
+    unsigned int resent;        /* packets sent again on a NACK */
+    unsigned int dropped;       /* packets given up on a full socket */
+};
+
+/* one NALU as reported by the encoder, start code excluded */
+struct rtp_nal_t {
+    unsigned char *data;
+    size_t size;
+    int type;
+};
 
 /******************************************************************************
  *              LIBRARY FUNCTIONS
@@ -27,15 +59,82 @@ typedef struct __rtsp_obj_t *rtsp_handle;
    SPS and PPS parameters are automatically collected during execution. */
 
 void rtp_disable_audio(rtsp_handle h);
-int rtp_send_h26x(rtsp_handle h, unsigned char *buf, size_t len, char isH265);
-int rtp_send_mp3(rtsp_handle h, unsigned char *buf, size_t len);
+int rtp_send_h26x(rtsp_mount_handle m, unsigned char *buf, size_t len, char isH265);
+/* same, for an access unit the encoder has already split: nothing is scanned.
+   parameter sets are not collected here, see rtsp_set_params().
+   'timestamp' is the presentation time of the access unit in microseconds,
+   the raw variant above uses the arrival time instead */
+int rtp_send_h26x_nals(rtsp_mount_handle m, const struct rtp_nal_t *nal, int count, char isH265,
+    unsigned long long timestamp);
+/* one baseline JPEG frame as the encoder gave it, SOI to EOI, sent as
+   RFC 2435 with its quantization tables in-band. the Huffman tables must
+   be the standard ones, and neither side may be over 2040 pixels */
+int rtp_send_jpeg(rtsp_mount_handle m, const unsigned char *buf, size_t len,
+    unsigned long long timestamp);
+/* one MPEG audio frame, 'timestamp' in microseconds as above */
+int rtp_send_mp3(rtsp_mount_handle m, unsigned char *buf, size_t len, unsigned long long timestamp);
+
+/* 'len' G.711 samples, A-law or else u-law, sent as PCMA or PCMU at 8 kHz
+   in packets of 20 ms. 'timestamp' is that of the first sample as above */
+int rtp_send_g711(rtsp_mount_handle m, unsigned char *buf, size_t len, char alaw,
+    unsigned long long timestamp);
+
+/* hand over the channel's parameter sets; the SDP is rebuilt on the next
+   DESCRIBE only if their generation moved */
+void rtsp_set_params(rtsp_mount_handle m, const struct NalParamSets *ps);
+/* the encoder's target for the stream in kbit/s, which paced receivers
+   are fed at, see rtsp_configure_pacing() */
+void rtsp_set_bitrate(rtsp_mount_handle m, unsigned int kbps);
 
 extern void rtsp_finish(rtsp_handle h);
 
-extern rtsp_handle rtsp_create(unsigned char max_con, unsigned int port, int priority);
+extern rtsp_handle rtsp_create(int max_con, unsigned int port, int priority);
 
 extern void rtsp_configure_auth(rtsp_handle h, const char *user, const char *pass);
 
+/* serve a stream on 'path', such as "/stream=1", and on anything below it.
+   the first mount added also answers every path no other one matches.
+   adding a path twice gives back the mount it already has */
+extern rtsp_mount_handle rtsp_add_mount(rtsp_handle h, const char *path);
+
+/* serve 'Transport: RTP/AVP;multicast' viewers from one shared session on
+   'group' per mount, video on port/port+1 and audio on port+2/port+3 for
+   the first mount and four ports further on for each one after it */
+extern int rtsp_configure_multicast(rtsp_handle h, const char *group,
+    unsigned short port, unsigned char ttl);
+
+/* spread video to UDP and multicast receivers over each frame interval
+   from a thread of its own instead of sending it as it comes. a receiver
+   is fed at 'burst_pct' percent of the target bitrate at least, faster only
+   as far as a frame would otherwise not be out before the next one.
+   pacing cannot be turned off again once on */
+extern int rtsp_configure_pacing(rtsp_handle h, unsigned int burst_pct);
+
+/* offer UDP receivers RFC 5109 parity of the video as track 2, one packet
+   for every 100 / 'ratio_pct' video ones (at most 16) and twice as many
+   for IDR frames, so that any single loss in a group can be repaired.
+   0 takes the track out of the SDP again */
+extern int rtsp_configure_fec(rtsp_handle h, unsigned int ratio_pct);
+
+/* answer RFC 4585 generic NACKs from UDP receivers of the video by sending
+   the packets again as they were, out of a ring of each stream's last
+   'history_ms' at its target bitrate (one second at least, and never more
+   than 2048 packets or the 512 last ones of a session). a session may
+   resend up to 'budget_pct' percent of the target bitrate, 0 turns it off.
+   call before streaming starts for the history to apply */
+extern int rtsp_configure_nack(rtsp_handle h, unsigned int history_ms,
+    unsigned int budget_pct);
+
+/* keep each stream's video since its last IDR in the same ring, sized for
+   'window_ms' at the target bitrate (at most 2048 packets), and start new
+   unicast viewers from there at once instead of asking the encoder for an
+   IDR. multicast viewers and a GOP longer than the ring still get one.
+   0 turns it off, call before streaming starts for the size to apply */
+extern int rtsp_configure_gop_cache(rtsp_handle h, unsigned int window_ms);
+
+/* fills up to 'max' entries, returns how many were written */
+extern int rtsp_get_stats(rtsp_handle h, struct rtsp_stat_t *stat, int max);
+
 #if defined (__cplusplus)
 }
 #endif
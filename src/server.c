@@ -2,6 +2,12 @@
 
 #define MAX_CLIENTS 50
 #define REQSIZE 512 * 1024
+// Bound of the raw stream kept since its last SPS for new clients
+#define H26X_GOP_MAX 1024 * 1024
+// A new client not caught up with the cache after this many passes, or
+// this many seconds blocked on one, waits for the next keyframe instead
+#define H26X_GOP_ROUNDS 8
+#define H26X_GOP_TIMEOUT 2
 
 IMPORT_STR(.rodata, "../res/index.html", indexhtml);
 extern const char indexhtml[];
@@ -9,6 +15,7 @@ IMPORT_STR(.rodata, "../res/onvif/badauth.xml", badauthxml);
 extern const char badauthxml[];
 
 enum StreamType {
+    STREAM_G711,
     STREAM_H26X,
     STREAM_JPEG,
     STREAM_MJPEG,
@@ -28,8 +35,16 @@ struct {
     enum StreamType type;
     struct Mp4State mp4;
     unsigned int nalCnt;
+    char shifted, priming;
+    unsigned int shiftDelay, shiftSeq, shiftCredit;
 } client_fds[MAX_CLIENTS];
 
+// The raw stream since its last SPS, chunked as sent, allocated with the
+// first client and only valid while the whole GOP fit
+static char *h26xGop;
+static unsigned int h26xGopLen, h26xGopNals, h26xGopGen;
+static char h26xGopValid;
+
 typedef struct {
     char *name, *value;
 } http_header_t;
@@ -66,6 +81,27 @@ void free_client(int i) {
     client_fds[i].sockFd = -1;
 }
 
+// Deepest unsent backlog among the video clients, the senders hold the
+// client lock while blocked so the last reading stands in during a stall
+unsigned int server_queue_peak(void) {
+    static unsigned int peak = 0;
+    int queued;
+
+    if (pthread_mutex_trylock(&client_fds_mutex))
+        return peak;
+    peak = 0;
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        if (client_fds[i].sockFd < 0) continue;
+        if (client_fds[i].type != STREAM_H26X &&
+            client_fds[i].type != STREAM_MP4) continue;
+        if (!ioctl(client_fds[i].sockFd, SIOCOUTQ, &queued) && queued > peak)
+            peak = queued;
+    }
+    pthread_mutex_unlock(&client_fds_mutex);
+
+    return peak;
+}
+
 int send_to_fd(int fd, char *buf, ssize_t size) {
     ssize_t sent = 0, len = 0;
     if (fd < 0) return -1;
@@ -131,6 +167,26 @@ void send_h26x_to_client(char index, hal_vidstream *stream) {
         unsigned char *pack_data = pack->data + pack->offset;
 
         pthread_mutex_lock(&client_fds_mutex);
+        for (char j = 0; h26xGop && j < pack->naluCnt; j++) {
+            if (pack->nalu[j].type == NalUnitType_SPS ||
+                pack->nalu[j].type == NalUnitType_SPS_HEVC) {
+                h26xGopLen = h26xGopNals = 0;
+                h26xGopValid = 1;
+                h26xGopGen++;
+            }
+            if (!h26xGopValid) continue;
+            if (h26xGopLen + pack->nalu[j].length + 16 > H26X_GOP_MAX) {
+                h26xGopValid = 0;
+                continue;
+            }
+            h26xGopLen += sprintf(h26xGop + h26xGopLen, "%zX\r\n", pack->nalu[j].length);
+            memcpy(h26xGop + h26xGopLen, pack_data + pack->nalu[j].offset, pack->nalu[j].length);
+            h26xGopLen += pack->nalu[j].length;
+            memcpy(h26xGop + h26xGopLen, "\r\n", 2);
+            h26xGopLen += 2;
+            h26xGopNals++;
+        }
+
         for (unsigned int i = 0; i < MAX_CLIENTS; ++i) {
             if (client_fds[i].sockFd < 0) continue;
             if (client_fds[i].type != STREAM_H26X) continue;
@@ -167,39 +223,117 @@ void send_h26x_to_client(char index, hal_vidstream *stream) {
     }
 }
 
+static int send_chunk_to_client(int i, char *buf, ssize_t size) {
+    static char len_buf[50];
+    ssize_t len_size = sprintf(len_buf, "%zX\r\n", size);
+    if (send_to_client(i, len_buf, len_size) < 0)
+        return EXIT_FAILURE; // send <SIZE>\r\n
+    if (send_to_client(i, buf, size) < 0)
+        return EXIT_FAILURE; // send <DATA>
+    if (send_to_client(i, "\r\n", 2) < 0)
+        return EXIT_FAILURE; // send \r\n
+
+    return EXIT_SUCCESS;
+}
+
+static void send_shifted_mp4_to_client(int i) {
+    struct BitBuf header_buf, moof_buf, mdat_buf;
+    struct MoofPos moof_pos;
+
+    if (client_fds[i].shiftDelay) {
+        if (timeshift_seek(client_fds[i].shiftDelay, &client_fds[i].shiftSeq))
+            return;
+        client_fds[i].shiftDelay = 0;
+        client_fds[i].shiftCredit = 0;
+    }
+
+    if (!client_fds[i].mp4.header_sent) {
+        mp4_get_header(&header_buf);
+        if (!header_buf.offset) return;
+        if (send_chunk_to_client(i, header_buf.buf, header_buf.offset))
+            return;
+
+        client_fds[i].mp4.sequence_number = 0;
+        client_fds[i].mp4.base_data_offset = header_buf.offset;
+        client_fds[i].mp4.base_media_decode_time = 0;
+        client_fds[i].mp4.header_sent = true;
+        client_fds[i].mp4.nals_count = 0;
+        client_fds[i].mp4.default_sample_duration =
+            default_sample_size;
+    }
+
+    // Replaying more than one fragment per live one lets the client
+    // catch up with the encoder, at which point it joins the live path,
+    // and one that joined live is given the buffered GOP all at once.
+    // Samples are shortened in the same proportion while catching up,
+    // or the player would merely buffer ahead and keep its delay
+    unsigned int duration = client_fds[i].priming ?
+        client_fds[i].mp4.default_sample_duration :
+        MAX(client_fds[i].mp4.default_sample_duration * 100 /
+            app_config.mp4_timeshift_catchup, 1);
+    client_fds[i].shiftCredit += app_config.mp4_timeshift_catchup;
+    while (client_fds[i].priming || client_fds[i].shiftCredit >= 100) {
+        if (!client_fds[i].priming)
+            client_fds[i].shiftCredit -= 100;
+        if (timeshift_read(&client_fds[i].shiftSeq, &moof_buf, &mdat_buf, &moof_pos))
+            break;
+        if (mp4_set_state_paced(&client_fds[i].mp4, &moof_buf, &moof_pos,
+            mdat_buf.offset, duration))
+            break;
+        if (send_chunk_to_client(i, moof_buf.buf, moof_buf.offset))
+            return;
+        if (send_chunk_to_client(i, mdat_buf.buf, mdat_buf.offset))
+            return;
+    }
+
+    if (timeshift_is_live(client_fds[i].shiftSeq))
+        client_fds[i].shifted = client_fds[i].priming = 0;
+}
+
 void send_mp4_to_client(char index, hal_vidstream *stream, char isH265) {
 
     for (unsigned int i = 0; i < stream->count; ++i) {
         hal_vidpack *pack = &stream->pack[i];
         unsigned int pack_len = pack->length - pack->offset;
         unsigned char *pack_data = pack->data + pack->offset;
+        char has_slice = 0, is_idr = 0;
 
         for (char j = 0; j < pack->naluCnt; j++) {
 #ifdef DEBUG_VIDEO
             printf("NAL: %s received in packet %d\n", nal_type_to_str(pack->nalu[j].type), i);
             printf("     starts at %p, ends at %p\n", pack_data + pack->nalu[j].offset, pack_data + pack->nalu[j].offset + pack->nalu[j].length);
 #endif
-            if ((pack->nalu[j].type == NalUnitType_SPS || pack->nalu[j].type == NalUnitType_SPS_HEVC) 
-                && pack->nalu[j].length >= 4 && pack->nalu[j].length <= UINT16_MAX)
-                mp4_set_sps(pack_data + pack->nalu[j].offset + 4, pack->nalu[j].length - 4, isH265);
-            else if ((pack->nalu[j].type == NalUnitType_PPS || pack->nalu[j].type == NalUnitType_PPS_HEVC)
-                && pack->nalu[j].length <= UINT16_MAX)
-                mp4_set_pps(pack_data + pack->nalu[j].offset + 4, pack->nalu[j].length - 4, isH265);
-            else if (pack->nalu[j].type == NalUnitType_VPS_HEVC && pack->nalu[j].length <= UINT16_MAX)
-                mp4_set_vps(pack_data + pack->nalu[j].offset + 4, pack->nalu[j].length - 4);
-            else if (pack->nalu[j].type == NalUnitType_CodedSliceIdr || pack->nalu[j].type == NalUnitType_CodedSliceAux)
+            if (pack->nalu[j].type == NalUnitType_CodedSliceIdr || pack->nalu[j].type == NalUnitType_CodedSliceAux) {
                 mp4_set_slice(pack_data + pack->nalu[j].offset + 4, pack->nalu[j].length - 4, 1);
-            else if (pack->nalu[j].type == NalUnitType_CodedSliceNonIdr)
+                has_slice = is_idr = 1;
+            } else if (pack->nalu[j].type == NalUnitType_CodedSliceNonIdr) {
                 mp4_set_slice(pack_data + pack->nalu[j].offset + 4, pack->nalu[j].length - 4, 0);
+                has_slice = 1;
+                is_idr = 0;
+            }
         }
 
         static enum BufError err;
         static char len_buf[50];
+        if (has_slice && app_config.mp4_timeshift_size) {
+            struct BitBuf moof_buf, mdat_buf;
+            struct MoofPos moof_pos;
+            mp4_get_moof(&moof_buf);
+            mp4_get_mdat(&mdat_buf);
+            mp4_get_moof_pos(&moof_pos);
+            timeshift_push(&moof_buf, &mdat_buf, &moof_pos, is_idr);
+        }
+
         pthread_mutex_lock(&client_fds_mutex);
         for (unsigned int i = 0; i < MAX_CLIENTS; ++i) {
             if (client_fds[i].sockFd < 0) continue;
             if (client_fds[i].type != STREAM_MP4) continue;
 
+            if (client_fds[i].shifted) {
+                if (has_slice) send_shifted_mp4_to_client(i);
+                continue;
+            }
+
             if (!client_fds[i].mp4.header_sent) {
                 struct BitBuf header_buf;
                 err = mp4_get_header(&header_buf);
@@ -287,6 +421,24 @@ void send_pcm_to_client(hal_audframe *frame) {
     pthread_mutex_unlock(&client_fds_mutex);
 }
 
+void send_g711_to_client(unsigned char *buf, ssize_t size) {
+    pthread_mutex_lock(&client_fds_mutex);
+    for (unsigned int i = 0; i < MAX_CLIENTS; ++i) {
+        if (client_fds[i].sockFd < 0) continue;
+        if (client_fds[i].type != STREAM_G711) continue;
+
+        static char len_buf[50];
+        ssize_t len_size = sprintf(len_buf, "%zX\r\n", size);
+        if (send_to_client(i, len_buf, len_size) < 0)
+            continue; // send <SIZE>\r\n
+        if (send_to_client(i, buf, size) < 0)
+            continue; // send <DATA>
+        if (send_to_client(i, "\r\n", 2) < 0)
+            continue; // send \r\n
+    }
+    pthread_mutex_unlock(&client_fds_mutex);
+}
+
 void send_mjpeg_to_client(char index, char *buf, ssize_t size) {
     static char prefix_buf[128];
     ssize_t prefix_size = sprintf(prefix_buf,
@@ -334,6 +486,26 @@ void send_jpeg_to_client(char index, char *buf, ssize_t size) {
     pthread_mutex_unlock(&client_fds_mutex);
 }
 
+struct cliptask {
+    int client_fd;
+    time_t from, to;
+};
+
+void *send_clip_thread(void *vargp) {
+    struct cliptask task = *((struct cliptask *)vargp);
+    free(vargp);
+    HAL_INFO("server", "Extracting a clip from %lld to %lld...\n",
+        (long long)task.from, (long long)task.to);
+    if (record_send_clip(task.client_fd, task.from, task.to)) {
+        HAL_DANGER("server", "No recording covers the requested range!\n");
+        send_http_error(task.client_fd, 404);
+        return NULL;
+    }
+    close_socket_fd(task.client_fd);
+    HAL_INFO("server", "Clip has been sent!\n");
+    return NULL;
+}
+
 struct jpegtask {
     int client_fd;
     uint16_t width;
@@ -641,7 +813,8 @@ void respond_request(http_request_t *req) {
         return;
     }
 
-    if (app_config.audio_enable && EQUALS(req->uri, "/audio.mp3")) {
+    if (app_config.audio_enable && app_config.audio_codec == HAL_AUDCODEC_MP3 &&
+        EQUALS(req->uri, "/audio.mp3")) {
         respLen = sprintf(response,
             "HTTP/1.1 200 OK\r\n"
             "Content-Type: audio/mpeg\r\n"
@@ -659,6 +832,28 @@ void respond_request(http_request_t *req) {
         return;
     }
 
+    if (app_config.audio_enable &&
+        ((app_config.audio_codec == HAL_AUDCODEC_G711U && EQUALS(req->uri, "/audio.ulaw")) ||
+        (app_config.audio_codec == HAL_AUDCODEC_G711A && EQUALS(req->uri, "/audio.alaw")))) {
+        int respLen = sprintf(response,
+            "HTTP/1.1 200 OK\r\n"
+            "Content-Type: %s\r\n"
+            "Transfer-Encoding: chunked\r\n"
+            "Connection: keep-alive\r\n\r\n",
+            app_config.audio_codec == HAL_AUDCODEC_G711A ?
+                "audio/x-alaw-basic" : "audio/basic");
+        send_to_fd(req->clntFd, response, respLen);
+        pthread_mutex_lock(&client_fds_mutex);
+        for (uint32_t i = 0; i < MAX_CLIENTS; ++i)
+            if (client_fds[i].sockFd < 0) {
+                client_fds[i].sockFd = req->clntFd;
+                client_fds[i].type = STREAM_G711;
+                break;
+            }
+        pthread_mutex_unlock(&client_fds_mutex);
+        return;
+    }
+
     if (app_config.audio_enable && EQUALS(req->uri, "/audio.pcm")) {
         int respLen = sprintf(response,
             "HTTP/1.1 200 OK\r\n"
@@ -679,7 +874,6 @@ void respond_request(http_request_t *req) {
 
     if ((!app_config.mp4_codecH265 && EQUALS(req->uri, "/video.264")) ||
         (app_config.mp4_codecH265 && EQUALS(req->uri, "/video.265"))) {
-        request_idr();
         int respLen = sprintf(response,
             "HTTP/1.1 200 OK\r\n"
             "Content-Type: application/octet-stream\r\n"
@@ -687,19 +881,81 @@ void respond_request(http_request_t *req) {
             "Connection: keep-alive\r\n\r\n");
         send_to_fd(req->clntFd, response, respLen);
         pthread_mutex_lock(&client_fds_mutex);
+        if (!h26xGop && !(h26xGop = malloc(H26X_GOP_MAX)))
+            HAL_DANGER("server", "Can't allocate the raw stream GOP cache!\n");
+        // New clients start on the cached GOP when there is one, the
+        // encoder is only asked for a keyframe otherwise. It is copied out
+        // and sent unlocked so a slow client holds back no other, then what
+        // was added meanwhile the same way until the client has caught up
+        char primed = 0, *gop = NULL;
+        unsigned int gen = 0, done = 0, len;
+        struct timeval timeout = { .tv_sec = H26X_GOP_TIMEOUT };
+        setsockopt(req->clntFd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        for (int round = 0; h26xGopValid && h26xGopNals; round++) {
+            if (round && gen == h26xGopGen && done == h26xGopLen) {
+                primed = 1;
+                break;
+            }
+            if (round == H26X_GOP_ROUNDS ||
+                (!gop && !(gop = malloc(H26X_GOP_MAX)))) break;
+            // A newer GOP is a fresh start, sent from its SPS on
+            if (!round || gen != h26xGopGen) {
+                gen = h26xGopGen;
+                done = 0;
+            }
+            len = h26xGopLen - done;
+            memcpy(gop, h26xGop + done, len);
+            pthread_mutex_unlock(&client_fds_mutex);
+            int ret = send_to_fd(req->clntFd, gop, len);
+            pthread_mutex_lock(&client_fds_mutex);
+            if (ret) break;
+            done += len;
+        }
+        free(gop);
+        timeout.tv_sec = 0;
+        setsockopt(req->clntFd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
         for (uint32_t i = 0; i < MAX_CLIENTS; ++i)
             if (client_fds[i].sockFd < 0) {
                 client_fds[i].sockFd = req->clntFd;
                 client_fds[i].type = STREAM_H26X;
-                client_fds[i].nalCnt = 0;
+                client_fds[i].nalCnt = primed ? h26xGopNals : 0;
                 break;
             }
         pthread_mutex_unlock(&client_fds_mutex);
+        if (!primed) request_idr();
         return;
     }
 
     if (app_config.mp4_enable && EQUALS(req->uri, "/video.mp4")) {
-        request_idr();
+        int offset = 0;
+        if (!EMPTY(req->query)) {
+            char *remain;
+            while (req->query) {
+                char *value = split(&req->query, "&");
+                if (!value || !*value) continue;
+                unescape_uri(value);
+                char *key = split(&value, "=");
+                if (!key || !*key || !value || !*value) continue;
+                if (EQUALS(key, "offset")) {
+                    long result = strtol(value, &remain, 10);
+                    if (remain != value)
+                        offset = (int)MIN(labs(MAX(result, -86400L)), 86400L);
+                }
+            }
+        }
+        // Going further back than the buffer holds would only land on
+        // its oldest keyframe anyway
+        if (!app_config.mp4_timeshift_size)
+            offset = 0;
+        else if (offset)
+            offset = MAX(MIN(offset, (int)(timeshift_span() / 1000)), 1);
+
+        // The timeshift buffer doubles as a GOP cache, a live client is
+        // started from its newest keyframe rather than asking for one
+        unsigned int seq;
+        char priming = !offset && app_config.mp4_timeshift_size &&
+            !timeshift_seek(0, &seq);
+        if (!offset && !priming) request_idr();
         int respLen = sprintf(response,
             "HTTP/1.1 200 OK\r\n"
             "Content-Type: video/mp4\r\n"
@@ -712,6 +968,9 @@ void respond_request(http_request_t *req) {
                 client_fds[i].sockFd = req->clntFd;
                 client_fds[i].type = STREAM_MP4;
                 client_fds[i].mp4.header_sent = false;
+                client_fds[i].shifted = offset || priming ? 1 : 0;
+                client_fds[i].priming = priming;
+                client_fds[i].shiftDelay = priming ? 1 : offset * 1000;
                 break;
             }
         pthread_mutex_unlock(&client_fds_mutex);
@@ -807,6 +1066,13 @@ void respond_request(http_request_t *req) {
                     short result = strtol(value, &remain, 10);
                     if (remain != value)
                         app_config.audio_bitrate = result;
+                } else if (EQUALS(key, "codec")) {
+                    if (EQUALS_CASE(value, "mp3"))
+                        app_config.audio_codec = HAL_AUDCODEC_MP3;
+                    else if (EQUALS_CASE(value, "ulaw") || EQUALS_CASE(value, "pcmu"))
+                        app_config.audio_codec = HAL_AUDCODEC_G711U;
+                    else if (EQUALS_CASE(value, "alaw") || EQUALS_CASE(value, "pcma"))
+                        app_config.audio_codec = HAL_AUDCODEC_G711A;
                 } else if (EQUALS(key, "enable")) {
                     if (EQUALS_CASE(value, "true") || EQUALS(value, "1"))
                         app_config.audio_enable = 1;
@@ -832,8 +1098,10 @@ void respond_request(http_request_t *req) {
             "Content-Type: application/json;charset=UTF-8\r\n"
             "Connection: close\r\n"
             "\r\n"
-            "{\"enable\":%s,\"bitrate\":%d,\"gain\":%d,\"srate\":%d}",
+            "{\"enable\":%s,\"codec\":\"%s\",\"bitrate\":%d,\"gain\":%d,\"srate\":%d}",
             app_config.audio_enable ? "true" : "false",
+            app_config.audio_codec == HAL_AUDCODEC_G711A ? "alaw" :
+                app_config.audio_codec == HAL_AUDCODEC_G711U ? "ulaw" : "mp3",
             app_config.audio_bitrate, app_config.audio_gain, app_config.audio_srate);
         send_and_close(req->clntFd, response, respLen);
         return;
@@ -1052,10 +1320,11 @@ void respond_request(http_request_t *req) {
             "Connection: close\r\n"
             "\r\n"
             "{\"enable\":%s,\"width\":%d,\"height\":%d,\"fps\":%d,"
-            "\"h265\":%s,\"mode\":\"%s\",\"profile\":\"%s\",\"bitrate\":%d}",
+            "\"h265\":%s,\"mode\":\"%s\",\"profile\":\"%s\",\"bitrate\":%d,"
+            "\"abr_bitrate\":%u}",
             app_config.mp4_enable ? "true" : "false",
             app_config.mp4_width, app_config.mp4_height, app_config.mp4_fps, h265, mode,
-            profile, app_config.mp4_bitrate);
+            profile, app_config.mp4_bitrate, abr_bitrate());
         send_and_close(req->clntFd, response, respLen);
         return;
     }
@@ -1138,6 +1407,60 @@ void respond_request(http_request_t *req) {
         return;
     }
 
+    if (EQUALS(req->uri, "/api/motion")) {
+        if (!EMPTY(req->query)) {
+            char *remain;
+            while (req->query) {
+                char *value = split(&req->query, "&");
+                if (!value || !*value) continue;
+                unescape_uri(value);
+                char *key = split(&value, "=");
+                if (!key || !*key || !value || !*value) continue;
+                if (EQUALS(key, "enable")) {
+                    if (EQUALS_CASE(value, "true") || EQUALS(value, "1"))
+                        app_config.motion_enable = 1;
+                    else if (EQUALS_CASE(value, "false") || EQUALS(value, "0")) {
+                        app_config.motion_enable = 0;
+                        motion_reset();
+                    }
+                } else if (EQUALS(key, "sensitivity")) {
+                    short result = strtol(value, &remain, 10);
+                    if (remain != value && result >= 1 && result <= 10)
+                        app_config.motion_sensitivity = result;
+                } else if (EQUALS(key, "hold")) {
+                    short result = strtol(value, &remain, 10);
+                    if (remain != value && result >= 0)
+                        app_config.motion_hold = result;
+                } else if (EQUALS(key, "record")) {
+                    if (EQUALS_CASE(value, "true") || EQUALS(value, "1"))
+                        app_config.motion_record = 1;
+                    else if (EQUALS_CASE(value, "false") || EQUALS(value, "0"))
+                        app_config.motion_record = 0;
+                }
+            }
+        }
+        motion_status status;
+        motion_get_status(&status);
+        char last_event[64] = "";
+        if (status.lastEvent) {
+            struct tm *tm_info = localtime(&status.lastEvent);
+            strftime(last_event, sizeof(last_event), "%Y-%m-%dT%H:%M:%SZ", tm_info);
+        }
+        int respLen = sprintf(response,
+            "HTTP/1.1 200 OK\r\n"
+            "Content-Type: application/json;charset=UTF-8\r\n"
+            "Connection: close\r\n"
+            "\r\n"
+            "{\"enable\":%s,\"sensitivity\":%d,\"hold\":%d,\"record\":%s,"
+            "\"active\":%s,\"score\":%u,\"baseline\":%u,\"events\":%u,\"last_event\":\"%s\"}",
+            app_config.motion_enable ? "true" : "false", app_config.motion_sensitivity,
+            app_config.motion_hold, app_config.motion_record ? "true" : "false",
+            status.active ? "true" : "false", status.score, status.baseline,
+            status.events, last_event);
+        send_and_close(req->clntFd, response, respLen);
+        return;
+    }
+
     if (app_config.osd_enable && STARTS_WITH(req->uri, "/api/osd/")) {
         char *remain;
         int respLen;
@@ -1263,6 +1586,60 @@ void respond_request(http_request_t *req) {
         return;
     }
 
+    if (EQUALS(req->uri, "/api/record/clip")) {
+        struct cliptask task = { .client_fd = req->clntFd };
+        if (!EMPTY(req->query)) {
+            char *remain;
+            while (req->query) {
+                char *value = split(&req->query, "&");
+                if (!value || !*value) continue;
+                unescape_uri(value);
+                char *key = split(&value, "=");
+                if (!key || !*key || !value || !*value) continue;
+                if (EQUALS(key, "from")) {
+                    long long result = strtoll(value, &remain, 10);
+                    if (remain != value)
+                        task.from = result;
+                }
+                else if (EQUALS(key, "to")) {
+                    long long result = strtoll(value, &remain, 10);
+                    if (remain != value)
+                        task.to = result;
+                }
+            }
+        }
+        if (task.from <= 0 || task.to <= task.from) {
+            send_http_error(req->clntFd, 400);
+            return;
+        }
+
+        struct cliptask *heap_task = malloc(sizeof(task));
+        if (!heap_task) {
+            send_http_error(req->clntFd, 500);
+            return;
+        }
+        *heap_task = task;
+
+        pthread_t thread_id;
+        pthread_attr_t thread_attr;
+        pthread_attr_init(&thread_attr);
+        pthread_attr_setdetachstate(&thread_attr, PTHREAD_CREATE_DETACHED);
+        size_t stacksize;
+        pthread_attr_getstacksize(&thread_attr, &stacksize);
+        size_t new_stacksize = 32 * 1024;
+        if (pthread_attr_setstacksize(&thread_attr, new_stacksize))
+            HAL_DANGER("record", "Can't set stack size %zu\n", new_stacksize);
+        if (pthread_create(
+            &thread_id, &thread_attr, send_clip_thread, heap_task)) {
+            free(heap_task);
+            send_http_error(req->clntFd, 500);
+        }
+        if (pthread_attr_setstacksize(&thread_attr, stacksize))
+            HAL_DANGER("record", "Can't set stack size %zu\n", stacksize);
+        pthread_attr_destroy(&thread_attr);
+        return;
+    }
+
     if (EQUALS(req->uri, "/api/record")) {
         if (!EMPTY(req->query)) {
             char *remain;
@@ -1294,17 +1671,27 @@ void respond_request(http_request_t *req) {
                         app_config.record_segment_duration = result;
                 }
                 else if (EQUALS(key, "segment_size")) {
-                    short result = strtol(value, &remain, 10);
+                    int result = strtol(value, &remain, 10);
                     if (remain != value)
                         app_config.record_segment_size = result;
                 }
+                else if (EQUALS(key, "prealloc")) {
+                    if (EQUALS_CASE(value, "true") || EQUALS(value, "1"))
+                        app_config.record_prealloc = 1;
+                    else if (EQUALS_CASE(value, "false") || EQUALS(value, "0"))
+                        app_config.record_prealloc = 0;
+                }
 
                 if (!app_config.record_enable) continue;
                 if (app_config.record_continuous) continue;
-                if (EQUALS(key, "start"))
+                // Whatever the operator does, motion no longer owns it
+                if (EQUALS(key, "start")) {
                     record_start();
-                else if (EQUALS(key, "stop"))
+                    motionRecord = 0;
+                } else if (EQUALS(key, "stop")) {
                     record_stop();
+                    motionRecord = 0;
+                }
             }
         }
         struct tm *start = localtime(&recordStartTime);
@@ -1317,10 +1704,38 @@ void respond_request(http_request_t *req) {
             "Connection: close\r\n"
             "\r\n"
             "{\"recording\":%s,\"start_time\":\"%s\",\"continuous\":\"%s\",\"path\":\"%s\","
-            "\"filename\":\"%s\",\"segment_duration\":%d,\"segment_size\":%d}",
-                recordOn ? "true" : "false", recordStartTime, app_config.record_continuous ? "true" : "false",
+            "\"filename\":\"%s\",\"segment_duration\":%d,\"segment_size\":%d,\"prealloc\":%s}",
+                recordOn ? "true" : "false", start_time, app_config.record_continuous ? "true" : "false",
                 app_config.record_path, app_config.record_filename, 
-                app_config.record_segment_duration, app_config.record_segment_size);
+                app_config.record_segment_duration, app_config.record_segment_size,
+                app_config.record_prealloc ? "true" : "false");
+        send_and_close(req->clntFd, response, respLen);
+        return;
+    }
+
+    if (EQUALS(req->uri, "/api/rtsp")) {
+        // The response cannot hold more entries than this anyway
+        struct rtsp_stat_t stat[64];
+        int count = app_config.rtsp_enable ?
+            rtsp_get_stats(rtspHandle, stat, sizeof(stat) / sizeof(*stat)) : 0;
+
+        int respLen = sprintf(response,
+            "HTTP/1.1 200 OK\r\n"
+            "Content-Type: application/json;charset=UTF-8\r\n"
+            "Connection: close\r\n"
+            "\r\n"
+            "{\"sessions\":[");
+        for (int i = 0; i < count && respLen < sizeof(response) - 256; i++)
+            respLen += snprintf(response + respLen, sizeof(response) - respLen,
+                "%s{\"addr\":\"%s\",\"mount\":\"%s\",\"track\":\"%s\",\"tcp\":%s,\"multicast\":%s,\"fraction_lost\":%d,"
+                "\"lost\":%d,\"jitter_ms\":%u,\"rtt_ms\":%d,\"kbps\":%u,\"packets\":%llu,"
+                "\"octets\":%llu,\"silent_ms\":%d,\"resent\":%u,\"dropped\":%u}",
+                i ? "," : "", stat[i].addr, stat[i].mount, stat[i].track == 2 ? "fec" : stat[i].track ? "audio" : "video",
+                stat[i].tcp ? "true" : "false", stat[i].multicast ? "true" : "false",
+                stat[i].fraction_lost, stat[i].lost,
+                stat[i].jitter_ms, stat[i].rtt_ms, stat[i].kbps, stat[i].packets,
+                stat[i].octets, stat[i].silent_ms, stat[i].resent, stat[i].dropped);
+        respLen += snprintf(response + respLen, sizeof(response) - respLen, "]}");
         send_and_close(req->clntFd, response, respLen);
         return;
     }
@@ -2,6 +2,7 @@
 
 #include <arpa/inet.h>
 #include <errno.h>
+#include <linux/sockios.h>
 #include <netinet/in.h>
 #include <pthread.h>
 #include <regex.h>
@@ -10,10 +11,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <time.h>
 #include <unistd.h>
 
+#include "abr.h"
 #include "app_config.h"
 #include "fmt/mp4.h"
 #include "fmt/nal.h"
@@ -24,6 +27,7 @@
 #include "night.h"
 #include "record.h"
 #include "region.h"
+#include "timeshift.h"
 #include "watchdog.h"
 
 extern char graceful, keepRunning, recordOn;
@@ -32,9 +36,12 @@ extern time_t recordStartTime;
 int start_server();
 int stop_server();
 
+unsigned int server_queue_peak(void);
+
 void send_jpeg_to_client(char index, char *buf, ssize_t size);
 void send_mjpeg_to_client(char index, char *buf, ssize_t size);
 void send_h26x_to_client(char index, hal_vidstream *stream);
 void send_mp3_to_client(char *buf, ssize_t size);
 void send_mp4_to_client(char index, hal_vidstream *stream, char isH265);
-void send_pcm_to_client(hal_audframe *frame);
\ No newline at end of file
+void send_pcm_to_client(hal_audframe *frame);
+void send_g711_to_client(unsigned char *buf, ssize_t size);
\ No newline at end of file
@@ -4,6 +4,7 @@ static struct udp_stream_ctx *g_udp_ctx = NULL;
 
 static unsigned long long get_timestamp_us();
 static void *udp_client_manager_thread(void *data);
+static void *udp_sender_thread(void *data);
 static int add_rtp_header(unsigned char *packet, int pay_size,
     unsigned short seq, unsigned int tstamp,
     unsigned int ssrc, int marker, int pay_type);
@@ -25,6 +26,7 @@ int udp_stream_init(unsigned short port, const char *mcast_addr) {
     g_udp_ctx->running = 0;
     g_udp_ctx->client_count = 0;
     g_udp_ctx->is_mcast = 0;
+    g_udp_ctx->gso = 1;
 
     if (pthread_mutex_init(&g_udp_ctx->mutex, NULL)) {
         free(g_udp_ctx);
@@ -32,6 +34,13 @@ int udp_stream_init(unsigned short port, const char *mcast_addr) {
         HAL_ERROR("stream", "Failed to initialize mutex!\n");
     }
 
+    if (sem_init(&g_udp_ctx->wake, 0, 0)) {
+        pthread_mutex_destroy(&g_udp_ctx->mutex);
+        free(g_udp_ctx);
+        g_udp_ctx = NULL;
+        HAL_ERROR("stream", "Failed to initialize semaphore!\n");
+    }
+
     if ((g_udp_ctx->socket_fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
         HAL_DANGER("stream", "Failed to create UDP socket: %s\n", strerror(errno));
         goto error;
@@ -72,6 +81,14 @@ int udp_stream_init(unsigned short port, const char *mcast_addr) {
         goto error;
     }
 
+    if (pthread_create(&g_udp_ctx->sender, NULL,
+                      udp_sender_thread, g_udp_ctx) != 0) {
+        HAL_DANGER("stream", "Failed to create UDP sender thread!\n");
+        g_udp_ctx->running = 0;
+        pthread_join(g_udp_ctx->thread, NULL);
+        goto error;
+    }
+
     HAL_INFO("stream", "UDP streaming initialized on port %d\n", g_udp_ctx->port);
     if (g_udp_ctx->is_mcast) {
         char ip_str[INET_ADDRSTRLEN];
@@ -86,6 +103,7 @@ int udp_stream_init(unsigned short port, const char *mcast_addr) {
 error:
     if (g_udp_ctx) {
         if (g_udp_ctx->socket_fd >= 0) close(g_udp_ctx->socket_fd);
+        sem_destroy(&g_udp_ctx->wake);
         pthread_mutex_destroy(&g_udp_ctx->mutex);
         free(g_udp_ctx);
         g_udp_ctx = NULL;
@@ -101,12 +119,16 @@ void udp_stream_close() {
     if (!g_udp_ctx) return;
 
     g_udp_ctx->running = 0;
+    sem_post(&g_udp_ctx->wake);
+    pthread_join(g_udp_ctx->sender, NULL);
     pthread_join(g_udp_ctx->thread, NULL);
 
     close(g_udp_ctx->socket_fd);
 
+    sem_destroy(&g_udp_ctx->wake);
     pthread_mutex_destroy(&g_udp_ctx->mutex);
 
+    free(g_udp_ctx->ring);
     free(g_udp_ctx);
     g_udp_ctx = NULL;
 
@@ -157,7 +179,8 @@ int udp_stream_add_client(const char *host, unsigned short port) {
             .last_act = time(NULL)
         };
 
-        g_udp_ctx->client_count++;
+        __atomic_store_n(&g_udp_ctx->client_count, g_udp_ctx->client_count + 1, __ATOMIC_RELAXED);
+        __atomic_store_n(&g_udp_ctx->generation, g_udp_ctx->generation + 1, __ATOMIC_RELEASE);
 
         HAL_INFO("stream", "Added UDP client %s:%d (ID %d)\n",
             host, port, i);
@@ -188,7 +211,8 @@ void udp_stream_remove_client(int client_id) {
 
         inet_ntop(AF_INET, &addr->sin_addr, ip_str, INET_ADDRSTRLEN);
         g_udp_ctx->clients[client_id].active = 0;
-        g_udp_ctx->client_count--;
+        __atomic_store_n(&g_udp_ctx->client_count, g_udp_ctx->client_count - 1, __ATOMIC_RELAXED);
+        __atomic_store_n(&g_udp_ctx->generation, g_udp_ctx->generation + 1, __ATOMIC_RELEASE);
 
         HAL_INFO("stream", "Removed UDP client %s:%d (ID %d)\n",
             ip_str, port, client_id);
@@ -198,151 +222,153 @@ void udp_stream_remove_client(int client_id) {
 }
 
 /**
- * Send a RTP-encapsulated NAL unit to all clients
- * @param nal_data NAL unit data
- * @param nal_size Size of the NAL unit
- * @param is_keyframe Indicates if the NAL unit is a keyframe
- * @param is_h265 Indicates if the NAL unit is using the H.265 codec
- * @return EXIT_SUCCESS or EXIT_FAILURE
+ * Sets the bitrate the destinations are paced after
+ * @param kbps Target bitrate of the video in kbps
  */
-int udp_stream_send_nal(const char *nal_data, int nal_size,
-    int is_keyframe, int is_h265) {
-    if (!g_udp_ctx || !nal_data || nal_size <= 0) return EXIT_FAILURE;
-
-    static unsigned char packet[MAX_UDP_PACKET_SIZE + RTP_HEADER_SIZE];
-    int payload_type = 96;
-    int total_clients = 0;
-
-    pthread_mutex_lock(&g_udp_ctx->mutex);
-    total_clients = g_udp_ctx->client_count;
-    pthread_mutex_unlock(&g_udp_ctx->mutex);
+void udp_stream_set_bitrate(unsigned int kbps) {
+    if (!g_udp_ctx) return;
 
-    if (total_clients == 0 && !g_udp_ctx->is_mcast) return EXIT_SUCCESS;
+    __atomic_store_n(&g_udp_ctx->kbps, kbps, __ATOMIC_RELAXED);
+}
 
-    if (nal_size + RTP_HEADER_SIZE <= MAX_UDP_PACKET_SIZE) {
-        pthread_mutex_lock(&g_udp_ctx->mutex);
+/**
+ * Allocates enough slots for about a second of the stream
+ */
+static udp_slot_t *udp_ring_create(unsigned int kbps, unsigned int *size) {
+    unsigned long long want = kbps ?
+        (unsigned long long)kbps * 125 / MAX_UDP_PACKET_SIZE : UDP_RING_MAX;
 
-        if (g_udp_ctx->is_mcast) {
-            struct sockaddr_in mcast_addr;
-            memset(&mcast_addr, 0, sizeof(mcast_addr));
-            mcast_addr.sin_family = AF_INET;
-            mcast_addr.sin_addr.s_addr = g_udp_ctx->mcast_addr;
-            mcast_addr.sin_port = htons(g_udp_ctx->port);
+    *size = UDP_RING_MIN;
+    while (*size < want && *size < UDP_RING_MAX)
+        *size *= 2;
 
-            int packet_size = add_rtp_header(packet, nal_size, 0, 0, 0,
-                                          is_keyframe, payload_type);
+    return (udp_slot_t *)calloc(*size, sizeof(udp_slot_t));
+}
 
-            memcpy(packet + RTP_HEADER_SIZE, nal_data, nal_size);
-            packet_size += nal_size;
+/**
+ * Tells whether a decoder can start from a NAL unit of the given type
+ */
+static int udp_nal_is_key(const unsigned char *nal, int is_h265) {
+    if (is_h265) {
+        unsigned char type = (nal[0] >> 1) & 0x3F;
+        return (type >= 16 && type <= 21) || (type >= 32 && type <= 34);
+    }
 
-            sendto(g_udp_ctx->socket_fd, packet, packet_size, 0,
-                 (struct sockaddr*)&mcast_addr, sizeof(mcast_addr));
-        } else {
-            for (int i = 0; i < UDP_MAX_CLIENTS; i++) {
-                if (!g_udp_ctx->clients[i].active) continue;
+    unsigned char type = nal[0] & 0x1F;
+    return type == 5 || type == 7 || type == 8;
+}
 
-                int packet_size = add_rtp_header(packet, nal_size,
-                    g_udp_ctx->clients[i].seq++, g_udp_ctx->clients[i].tstamp,
-                    g_udp_ctx->clients[i].ssrc, is_keyframe, payload_type);
+/**
+ * Counts the packets a NAL unit makes, fragmented if need be
+ */
+static unsigned int udp_nal_packets(size_t size, int is_h265) {
+    int hdr = is_h265 ? 2 : 1, fu = is_h265 ? 3 : 2;
 
-                memcpy(packet + RTP_HEADER_SIZE, nal_data, nal_size);
-                packet_size += nal_size;
+    if (size <= MAX_UDP_PACKET_SIZE) return 1;
+    return (size - hdr + MAX_UDP_PACKET_SIZE - fu - 1) / (MAX_UDP_PACKET_SIZE - fu);
+}
 
-                sendto(g_udp_ctx->socket_fd, packet, packet_size, 0,
-                    (struct sockaddr*)&g_udp_ctx->clients[i].addr,
-                    sizeof(struct sockaddr_in));
-            }
+/**
+ * Packetizes an access unit for the sender thread to deliver to all clients,
+ * never waiting on the network
+ * @param nal NAL units of the access unit, start codes excluded
+ * @param count Number of NAL units
+ * @param is_h265 Indicates if the NAL units are using the H.265 codec
+ * @param timestamp Presentation time of the access unit in microseconds
+ * @return EXIT_SUCCESS or EXIT_FAILURE
+ */
+int udp_stream_send_nals(const struct rtp_nal_t *nal, int count, int is_h265,
+    unsigned long long timestamp) {
+    struct udp_stream_ctx *ctx = g_udp_ctx;
+    unsigned int head, total = 0, pos, tstamp;
+    udp_slot_t *slot;
+
+    if (!ctx || !nal || count <= 0) return EXIT_FAILURE;
+    if (!__atomic_load_n(&ctx->client_count, __ATOMIC_RELAXED)) return EXIT_SUCCESS;
+
+    if (!ctx->ring) {
+        unsigned int size;
+        udp_slot_t *ring = udp_ring_create(
+            __atomic_load_n(&ctx->kbps, __ATOMIC_RELAXED), &size);
+
+        if (!ring) {
+            HAL_DANGER("stream", "Failed to allocate the UDP send ring!\n");
+            return EXIT_FAILURE;
         }
+        ctx->ring_size = size;
+        __atomic_store_n(&ctx->ring, ring, __ATOMIC_RELEASE);
+    }
 
-        pthread_mutex_unlock(&g_udp_ctx->mutex);
-    } else {
-        int nal_header_size = is_h265 ? 2 : 1;
-        unsigned char nal_type;
-
-        if (is_h265) {
-            nal_type = nal_data[0] & 0x3F;
-        } else {
-            nal_type = nal_data[0] & 0x1F;
+    if (!timestamp) timestamp = get_timestamp_us();
+    if (ctx->frame_us && timestamp > ctx->frame_us && timestamp - ctx->frame_us <= 1000000)
+        __atomic_store_n(&ctx->interval_us, (unsigned int)(timestamp - ctx->frame_us),
+            __ATOMIC_RELAXED);
+    ctx->frame_us = timestamp;
+    tstamp = (unsigned int)((timestamp / 1000000) * 90000 + (timestamp % 1000000) * 9 / 100);
+
+    for (int i = 0; i < count; i++)
+        if (nal[i].size > (size_t)(is_h265 ? 2 : 1))
+            total += udp_nal_packets(nal[i].size, is_h265);
+    if (!total) return EXIT_SUCCESS;
+    if (total > ctx->ring_size) return EXIT_FAILURE;
+
+    // Slots about to be overwritten are no longer valid for the sender
+    head = ctx->head;
+    __atomic_store_n(&ctx->wr, head + total, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    pos = head;
+    for (int i = 0; i < count; i++) {
+        const unsigned char *data = nal[i].data;
+        size_t size = nal[i].size;
+        int hdr = is_h265 ? 2 : 1, fu = is_h265 ? 3 : 2;
+        char key;
+
+        if (size <= (size_t)hdr) continue;
+        key = udp_nal_is_key(data, is_h265);
+
+        if (size <= MAX_UDP_PACKET_SIZE) {
+            slot = &ctx->ring[pos++ & (ctx->ring_size - 1)];
+            memcpy(slot->data, data, size);
+            slot->len = size;
+            slot->marker = pos == head + total;
+            slot->keyframe = key;
+            slot->tstamp = tstamp;
+            continue;
         }
 
-        int fragments = (nal_size - nal_header_size + MAX_UDP_PACKET_SIZE - 1) /
-                        (MAX_UDP_PACKET_SIZE - 2);
-        int bytes_left = nal_size - nal_header_size;
-        const char *data_ptr = nal_data + nal_header_size;
-
-        pthread_mutex_lock(&g_udp_ctx->mutex);
-
-        for (int i = 0; i < UDP_MAX_CLIENTS || g_udp_ctx->is_mcast; i++) {
-            if (g_udp_ctx->is_mcast || g_udp_ctx->clients[i].active) {
-                unsigned char fu_indicator, fu_header;
-                int is_first = 1;
-                int remaining = bytes_left;
-                const char *frag_ptr = data_ptr;
-                unsigned short seq = g_udp_ctx->is_mcast ? 0 : g_udp_ctx->clients[i].seq;
-                unsigned int ssrc = g_udp_ctx->is_mcast ? 0 : g_udp_ctx->clients[i].ssrc;
-                unsigned int tstamp = g_udp_ctx->is_mcast ? 0 : g_udp_ctx->clients[i].tstamp;
-
-                for (int frag = 0; frag < fragments; frag++) {
-                    int is_last = (frag == fragments - 1);
-                    int payload_size = (is_last) ? remaining : (MAX_UDP_PACKET_SIZE - 2);
-
-                    if (is_h265) {
-                        fu_indicator = (nal_data[0] & 0x81) | (49 << 1); // FU type=49
-                        fu_header = (is_first ? 0x80 : 0) | (is_last ? 0x40 : 0) | nal_type;
-                    } else {
-                        fu_indicator = (nal_data[0] & 0xE0) | 28; // FU-A type=28
-                        fu_header = (is_first ? 0x80 : 0) | (is_last ? 0x40 : 0) | nal_type;
-                    }
-
-                    int packet_size = add_rtp_header(packet, payload_size + 2, seq++,
-                                                  tstamp, ssrc,
-                                                  is_keyframe && is_last, payload_type);
-
-                    packet[RTP_HEADER_SIZE] = fu_indicator;
-                    packet[RTP_HEADER_SIZE + 1] = fu_header;
-
-                    memcpy(packet + RTP_HEADER_SIZE + 2, frag_ptr, payload_size);
-                    packet_size += payload_size + 2;
-
-                    frag_ptr += payload_size;
-                    remaining -= payload_size;
-                    is_first = 0;
-
-                    if (g_udp_ctx->is_mcast) {
-                        struct sockaddr_in mcast_addr;
-                        memset(&mcast_addr, 0, sizeof(mcast_addr));
-                        mcast_addr.sin_family = AF_INET;
-                        mcast_addr.sin_addr.s_addr = g_udp_ctx->mcast_addr;
-                        mcast_addr.sin_port = htons(g_udp_ctx->port);
-
-                        sendto(g_udp_ctx->socket_fd, packet, packet_size, 0,
-                             (struct sockaddr*)&mcast_addr, sizeof(mcast_addr));
-                    } else {
-                        sendto(g_udp_ctx->socket_fd, packet, packet_size, 0,
-                             (struct sockaddr*)&g_udp_ctx->clients[i].addr,
-                             sizeof(struct sockaddr_in));
-                    }
-
-                    usleep(100);
-                }
-
-                if (!g_udp_ctx->is_mcast) {
-                    g_udp_ctx->clients[i].seq = seq;
-                }
+        // FU-A (RFC 6184) or FU (RFC 7798), the NAL header being carried
+        // over into the fragment headers
+        for (size_t off = hdr; off < size; ) {
+            size_t chunk = MIN(size - off, (size_t)(MAX_UDP_PACKET_SIZE - fu));
+            unsigned char edge = (off == (size_t)hdr ? 0x80 : 0) |
+                (off + chunk == size ? 0x40 : 0);
+
+            slot = &ctx->ring[pos++ & (ctx->ring_size - 1)];
+            if (is_h265) {
+                slot->data[0] = (data[0] & 0x81) | (49 << 1);
+                slot->data[1] = data[1];
+                slot->data[2] = edge | ((data[0] >> 1) & 0x3F);
+            } else {
+                slot->data[0] = (data[0] & 0xE0) | 28;
+                slot->data[1] = edge | (data[0] & 0x1F);
             }
-
-            if (g_udp_ctx->is_mcast) break;
+            memcpy(slot->data + fu, data + off, chunk);
+            slot->len = fu + chunk;
+            slot->marker = pos == head + total;
+            slot->keyframe = key;
+            slot->tstamp = tstamp;
+            off += chunk;
         }
-
-        pthread_mutex_unlock(&g_udp_ctx->mutex);
     }
 
-    pthread_mutex_lock(&g_udp_ctx->mutex);
-    for (int i = 0; i < UDP_MAX_CLIENTS; i++) {
-        if (!g_udp_ctx->clients[i].active) continue;
-        g_udp_ctx->clients[i].tstamp += 3000;
-    }
-    pthread_mutex_unlock(&g_udp_ctx->mutex);
+    // The sender reads 'frames' first, so it never sees it ahead of 'head'
+    __atomic_store_n(&ctx->head, head + total, __ATOMIC_RELEASE);
+    __atomic_store_n(&ctx->frames, ctx->frames + 1, __ATOMIC_RELEASE);
+
+    // Only an idle sender needs waking
+    if (__atomic_exchange_n(&ctx->idle, 0, __ATOMIC_SEQ_CST))
+        sem_post(&ctx->wake);
 
     return EXIT_SUCCESS;
 }
@@ -364,9 +390,14 @@ static void *udp_client_manager_thread(void *data) {
         pthread_mutex_lock(&ctx->mutex);
         for (int i = 0; i < UDP_MAX_CLIENTS; i++) {
             if (ctx->clients[i].active) {
+                // A group never answers, it is only left on request
+                if (IN_MULTICAST(ntohl(ctx->clients[i].addr.sin_addr.s_addr)))
+                    continue;
+
                 if (difftime(now, ctx->clients[i].last_act) > 60) {
                     ctx->clients[i].active = 0;
-                    ctx->client_count--;
+                    __atomic_store_n(&ctx->client_count, ctx->client_count - 1, __ATOMIC_RELAXED);
+                    __atomic_store_n(&ctx->generation, ctx->generation + 1, __ATOMIC_RELEASE);
 
                     char ip_str[INET_ADDRSTRLEN];
                     inet_ntop(AF_INET, &ctx->clients[i].addr.sin_addr,
@@ -407,7 +438,8 @@ static void *udp_client_manager_thread(void *data) {
                     ctx->clients[i].tstamp = rand();
                     ctx->clients[i].last_act = now;
 
-                    ctx->client_count++;
+                    __atomic_store_n(&ctx->client_count, ctx->client_count + 1, __ATOMIC_RELAXED);
+                    __atomic_store_n(&ctx->generation, ctx->generation + 1, __ATOMIC_RELEASE);
 
                     char ip_str[INET_ADDRSTRLEN];
                     inet_ntop(AF_INET, &client_addr.sin_addr, ip_str, INET_ADDRSTRLEN);
@@ -426,6 +458,256 @@ static void *udp_client_manager_thread(void *data) {
     return NULL;
 }
 
+/**
+ * Sends a batch of messages at once, falling back to one call each on
+ * kernels before 3.0
+ * @return Number of messages sent, or -1 when none went out
+ */
+static int udp_sendmmsg(int fd, struct udp_mmsghdr *msg, unsigned int count) {
+#ifdef __NR_sendmmsg
+    int ret = syscall(__NR_sendmmsg, fd, msg, count, 0);
+    if (ret >= 0 || errno != ENOSYS) return ret;
+#endif
+    for (unsigned int i = 0; i < count; i++) {
+        int ret = sendmsg(fd, &msg[i].msg_hdr, 0);
+        if (ret < 0) return i ? (int)i : -1;
+        msg[i].msg_len = ret;
+    }
+
+    return count;
+}
+
+/**
+ * Picks up the changes made to the client table since the last pass
+ */
+static void udp_sync_dests(struct udp_stream_ctx *ctx, unsigned int *generation) {
+    unsigned int current = __atomic_load_n(&ctx->generation, __ATOMIC_ACQUIRE);
+
+    if (current == *generation) return;
+
+    pthread_mutex_lock(&ctx->mutex);
+    for (int i = 0; i < UDP_MAX_CLIENTS; i++) {
+        udp_client_t *c = &ctx->clients[i];
+        udp_dest_t *d = &ctx->dests[i];
+
+        if (!c->active) {
+            d->active = 0;
+            continue;
+        }
+        if (d->active && d->ssrc == c->ssrc) continue;
+
+        *d = (udp_dest_t){
+            .addr = c->addr,
+            .active = 1,
+            .ssrc = c->ssrc,
+            .seq = c->seq,
+            .tstamp = c->tstamp
+        };
+    }
+    *generation = ctx->generation;
+    pthread_mutex_unlock(&ctx->mutex);
+}
+
+/**
+ * Refills the token bucket of a destination for the time gone by and sends
+ * what it allows
+ * @return Non-zero while packets are left waiting
+ */
+static int udp_pace_dest(struct udp_stream_ctx *ctx, udp_dest_t *d,
+    udp_burst_t *w, unsigned long long now) {
+    unsigned int frames = __atomic_load_n(&ctx->frames, __ATOMIC_ACQUIRE);
+    unsigned int head = __atomic_load_n(&ctx->head, __ATOMIC_ACQUIRE);
+    unsigned int size = ctx->ring_size, pos, depth;
+    const unsigned int full = RTP_HEADER_SIZE + MAX_UDP_PACKET_SIZE;
+    unsigned long long tokens;
+    char lagging = 0;
+    int n = 0, k = 0, ret, sent;
+
+    if (!d->live) {
+        d->next = head;
+        d->frames = frames;
+        d->rate = 0;
+        d->tokens = 0;
+        d->refill_us = now;
+        d->wait_key = 1;
+        d->live = 1;
+    }
+
+    if (head - d->next > size) {
+        d->next = head;
+        d->wait_key = 1;
+    }
+
+    // Each access unit resets the rate so that whatever is queued goes out
+    // within one frame interval, and never slower than the pace factor
+    // allows above the target bitrate
+    if (frames != d->frames) {
+        unsigned long long backlog = 0, rate;
+        unsigned int interval = __atomic_load_n(&ctx->interval_us, __ATOMIC_RELAXED);
+        unsigned int kbps = __atomic_load_n(&ctx->kbps, __ATOMIC_RELAXED);
+
+        if (!interval) interval = UDP_FRAME_INTERVAL_US;
+        for (pos = d->next; pos != head; pos++)
+            backlog += RTP_HEADER_SIZE + ctx->ring[pos & (size - 1)].len;
+
+        rate = backlog * 1000000 / interval;
+        rate = MAX(rate, (unsigned long long)kbps * 125 * UDP_PACE_FACTOR / 100);
+        d->rate = MIN(rate, 0x7FFFFFFFULL);
+        d->frames = frames;
+    }
+
+    // A couple of ticks' worth, and never less than one full packet
+    depth = d->rate * UDP_PACE_TICK_US * 2 / 1000000 + full;
+    tokens = d->tokens + d->rate * (now - d->refill_us) / 1000000;
+    d->tokens = MIN(tokens, (unsigned long long)depth);
+    d->refill_us = now;
+
+    for (pos = d->next; pos != head && n < UDP_PACE_BURST; pos++) {
+        udp_slot_t *slot = &ctx->ring[pos & (size - 1)];
+        unsigned int len = MIN(slot->len, MAX_UDP_PACKET_SIZE);
+        char marker = slot->marker, keyframe = slot->keyframe;
+        unsigned int tstamp = slot->tstamp;
+
+        if (d->wait_key && !keyframe) continue;
+        if (d->tokens < RTP_HEADER_SIZE + len) break;
+
+        memcpy(w->pkt[n] + RTP_HEADER_SIZE, slot->data, len);
+
+        // The encoder may have come round to this slot while it was copied
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&ctx->wr, __ATOMIC_RELAXED) - pos > size) {
+            lagging = 1;
+            break;
+        }
+
+        d->wait_key = 0;
+        d->tokens -= RTP_HEADER_SIZE + len;
+
+        add_rtp_header(w->pkt[n], len, d->seq + n, tstamp + d->tstamp,
+            d->ssrc, marker, 96);
+        w->len[n] = RTP_HEADER_SIZE + len;
+        w->pos[n++] = pos;
+    }
+
+    // Packets lie back to back in the burst, so a run of full ones followed
+    // by at most a shorter one makes a single message for the kernel to cut
+    for (int i = 0, j; i < n; i = j, k++) {
+        size_t bytes = w->len[i];
+
+        for (j = i + 1; ctx->gso && j < n && w->len[j - 1] == full; j++)
+            bytes += w->len[j];
+
+        w->first[k] = i;
+        w->iov[k].iov_base = w->pkt[i];
+        w->iov[k].iov_len = bytes;
+        memset(&w->msg[k], 0, sizeof(w->msg[k]));
+        w->msg[k].msg_hdr.msg_iov = &w->iov[k];
+        w->msg[k].msg_hdr.msg_iovlen = 1;
+        w->msg[k].msg_hdr.msg_name = &d->addr;
+        w->msg[k].msg_hdr.msg_namelen = sizeof(d->addr);
+
+        if (j - i > 1) {
+            struct cmsghdr *cm;
+            unsigned short segment = full;
+
+            w->msg[k].msg_hdr.msg_control = w->ctl[k].buf;
+            w->msg[k].msg_hdr.msg_controllen = sizeof(w->ctl[k].buf);
+            cm = CMSG_FIRSTHDR(&w->msg[k].msg_hdr);
+            cm->cmsg_level = SOL_UDP;
+            cm->cmsg_type = UDP_SEGMENT;
+            cm->cmsg_len = CMSG_LEN(sizeof(segment));
+            memcpy(CMSG_DATA(cm), &segment, sizeof(segment));
+        }
+    }
+    w->first[k] = n;
+
+    ret = k ? udp_sendmmsg(ctx->socket_fd, w->msg, k) : 0;
+    if (ret < 0) {
+        // A kernel or an interface without segmentation offload refuses
+        // the first such message, everything goes out one by one from then
+        if (w->msg[0].msg_hdr.msg_control && (errno == EINVAL || errno == EIO ||
+            errno == ENOPROTOOPT || errno == EOPNOTSUPP)) {
+            HAL_INFO("stream", "UDP segmentation offload is unavailable, "
+                "sending datagrams one by one\n");
+            ctx->gso = 0;
+            ret = 0;
+        // A full socket is retried on the next tick, anything else is as
+        // good as lost on the way
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ||
+            errno == ENOBUFS)
+            ret = 0;
+        else
+            ret = k;
+    }
+    sent = w->first[ret];
+
+    d->seq += sent;
+
+    // What the socket did not take is paid back and tried again
+    for (int i = sent; i < n; i++)
+        d->tokens += w->len[i];
+    d->next = sent < n ? w->pos[sent] : pos;
+
+    if (lagging) {
+        d->next = head;
+        d->wait_key = 1;
+    }
+
+    return d->next != head;
+}
+
+/**
+ * Thread handler spreading each access unit over the time to the next one
+ * for every destination, so that an IDR no longer leaves as one burst of
+ * back-to-back datagrams
+ */
+static void *udp_sender_thread(void *data) {
+    struct udp_stream_ctx *ctx = (struct udp_stream_ctx *)data;
+    unsigned int generation = 0;
+    struct timespec ts;
+    udp_burst_t *w;
+    int busy;
+
+    if (!(w = (udp_burst_t *)calloc(1, sizeof(udp_burst_t)))) {
+        HAL_DANGER("stream", "Failed to allocate the UDP send buffers!\n");
+        return NULL;
+    }
+
+    while (ctx->running) {
+        busy = 0;
+
+        udp_sync_dests(ctx, &generation);
+
+        if (__atomic_load_n(&ctx->ring, __ATOMIC_ACQUIRE)) {
+            unsigned long long now = get_timestamp_us();
+
+            for (int i = 0; i < UDP_MAX_CLIENTS; i++)
+                if (ctx->dests[i].active)
+                    busy |= udp_pace_dest(ctx, &ctx->dests[i], w, now);
+        }
+
+        if (busy) {
+            usleep(UDP_PACE_TICK_US);
+            continue;
+        }
+
+        // A frame put in before the flag went up was not signalled, so one
+        // more pass is made with it up before going to sleep
+        if (!__atomic_load_n(&ctx->idle, __ATOMIC_SEQ_CST)) {
+            __atomic_store_n(&ctx->idle, 1, __ATOMIC_SEQ_CST);
+            continue;
+        }
+
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += 1;
+        while (sem_timedwait(&ctx->wake, &ts) < 0 && errno == EINTR);
+    }
+
+    free(w);
+
+    return NULL;
+}
+
 /**
  * Prefixes the RTP header to a given packet
  */
@@ -458,10 +740,10 @@ static int add_rtp_header(unsigned char *packet, int pay_size,
 }
 
 /**
- * Obtains a timestamp in microseconds
+ * Obtains a monotonic timestamp in microseconds
  */
 static unsigned long long get_timestamp_us() {
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    return (unsigned long long)tv.tv_sec * 1000000 + tv.tv_usec;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
 }
@@ -4,20 +4,54 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <netinet/in.h>
+#include <netinet/udp.h>
 #include <pthread.h>
+#include <semaphore.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <sys/syscall.h>
 #include <sys/time.h>
+#include <sys/uio.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "hal/support.h"
+#include "rtsp/rtsp_server.h"
 
 #define MAX_UDP_PACKET_SIZE 1400
 #define UDP_DEFAULT_PORT 5600
 #define RTP_HEADER_SIZE 12
 #define UDP_MAX_CLIENTS 8
+// The sender wakes this often while a destination has packets left
+#define UDP_PACE_TICK_US 1000
+// At most this many datagrams per destination and wakeup
+#define UDP_PACE_BURST 32
+// How much faster than the target bitrate a destination may catch up
+#define UDP_PACE_FACTOR 150
+// The ring keeps about a second of the stream at its target bitrate
+#define UDP_RING_MIN 128
+#define UDP_RING_MAX 2048
+// Assumed before two frames have given the actual interval
+#define UDP_FRAME_INTERVAL_US 40000
+
+// Older headers lack it, the kernel tells at the first send if it does too
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+
+// One packet of the stream as it is yet to be sent, without its RTP header
+typedef struct {
+    unsigned short len;
+    char marker;
+    char keyframe;
+    unsigned int tstamp;
+    unsigned char data[MAX_UDP_PACKET_SIZE];
+} udp_slot_t;
 
 typedef struct {
     struct sockaddr_in addr;
@@ -28,6 +62,41 @@ typedef struct {
     time_t last_act;
 } udp_client_t;
 
+// What the sender thread alone keeps of each destination, its cursor in
+// the ring and its token bucket
+typedef struct {
+    struct sockaddr_in addr;
+    int active;
+    unsigned int ssrc;
+    unsigned short seq;
+    unsigned int tstamp;
+    char live, wait_key;
+    unsigned int next, frames;
+    unsigned long long rate, tokens, refill_us;
+} udp_dest_t;
+
+// Same layout as the kernel's struct mmsghdr, which older libcs lack
+struct udp_mmsghdr {
+    struct msghdr msg_hdr;
+    unsigned int msg_len;
+};
+
+// What the sender thread stamps and hands to the socket at once, packets
+// being back to back so that a run of full ones can go out as one segment
+// offload message
+typedef struct {
+    unsigned char pkt[UDP_PACE_BURST][RTP_HEADER_SIZE + MAX_UDP_PACKET_SIZE];
+    unsigned short len[UDP_PACE_BURST];
+    unsigned int pos[UDP_PACE_BURST];
+    unsigned char first[UDP_PACE_BURST + 1];
+    struct iovec iov[UDP_PACE_BURST];
+    struct udp_mmsghdr msg[UDP_PACE_BURST];
+    union {
+        char buf[CMSG_SPACE(sizeof(unsigned short))];
+        struct cmsghdr align;
+    } ctl[UDP_PACE_BURST];
+} udp_burst_t;
+
 struct udp_stream_ctx {
     int socket_fd;
     unsigned short port;
@@ -36,12 +105,29 @@ struct udp_stream_ctx {
     pthread_mutex_t mutex;
     udp_client_t clients[UDP_MAX_CLIENTS];
     int client_count;
+    unsigned int generation;
     char is_mcast;
     unsigned int mcast_addr;
+
+    // The encoder thread packetizes each access unit into the ring once,
+    // the sender follows with one cursor per destination, and neither
+    // takes the mutex for it. Slots are reused without waiting, so the
+    // sender checks 'wr' after its copy to know whether it was still valid
+    udp_slot_t *ring;
+    unsigned int ring_size, head, wr, frames;
+    unsigned int kbps, interval_us;
+    unsigned long long frame_us;
+    pthread_t sender;
+    sem_t wake;
+    int idle;
+    char gso;
+    udp_dest_t dests[UDP_MAX_CLIENTS];
 };
 
 int udp_stream_init(unsigned short port, const char *mcast_addr);
 void udp_stream_close(void);
 int udp_stream_add_client(const char *host, unsigned short port);
 void udp_stream_remove_client(int client_id);
-int udp_stream_send_nal(const char *nal_data, int nal_size, int is_keyframe, int is_h265);
\ No newline at end of file
+void udp_stream_set_bitrate(unsigned int kbps);
+int udp_stream_send_nals(const struct rtp_nal_t *nal, int count, int is_h265,
+    unsigned long long timestamp);
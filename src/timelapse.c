@@ -0,0 +1,119 @@
+#include "timelapse.h"
+
+static FILE *timelapseFile;
+static struct BitBuf timelapseMoof, timelapseMdat;
+static unsigned int timelapseSeq;
+static unsigned long long timelapseTime;
+static time_t timelapseLast;
+static int timelapseDay = -1;
+// When a keyframe became due, and whether the encoder was asked for one
+static time_t timelapsePending;
+static char timelapseAsked;
+
+static int timelapse_open(time_t now) {
+    struct BitBuf header_buf;
+    char path[256];
+
+    mp4_get_header(&header_buf);
+    if (!header_buf.offset) return EXIT_FAILURE;
+
+    struct tm *tm_info = localtime(&now);
+    size_t dirLen = snprintf(path, sizeof(path), "%s%s", app_config.record_path,
+        app_config.record_path[strlen(app_config.record_path) - 1] == '/' ? "" : "/");
+    strftime(path + dirLen, sizeof(path) - dirLen, "timelapse_%Y%m%d_%H%M%S.mp4", tm_info);
+
+    if (!(timelapseFile = fopen(path, "wb")))
+        HAL_ERROR("timelapse", "Failed to open the destination file!\n");
+    fwrite(header_buf.buf, 1, header_buf.offset, timelapseFile);
+
+    timelapseSeq = 0;
+    timelapseTime = 0;
+    timelapseDay = tm_info->tm_yday;
+
+    HAL_INFO("timelapse", "Writing to %s\n", path);
+    return EXIT_SUCCESS;
+}
+
+void timelapse_stop(void) {
+    if (!timelapseFile) return;
+
+    fclose(timelapseFile);
+    timelapseFile = NULL;
+}
+
+void send_mp4_to_timelapse(hal_vidstream *stream) {
+    time_t now = time(NULL);
+
+    if (!timelapsePending) {
+        if (now - timelapseLast < app_config.timelapse_interval) return;
+        timelapsePending = now;
+        timelapseAsked = 0;
+    }
+
+    // The next keyframe is taken as the encoder makes it, a forced one
+    // would reach every live viewer as well; only asked for when a whole
+    // GOP went by without any
+    if (!timelapseAsked && now - timelapsePending >
+        app_config.mp4_gop / MAX(app_config.mp4_fps, 1) + 1) {
+        request_idr();
+        timelapseAsked = 1;
+    }
+
+    // A keyframe can come as several slices, all of them make up the one
+    // sample, each behind its own length prefix
+    enum BufError err;
+    unsigned int size = 0;
+    timelapseMdat.offset = 0;
+    err = put_u32_be(&timelapseMdat, 0);
+    if (err != BUF_OK) return;
+    err = put_str4(&timelapseMdat, "mdat");
+    if (err != BUF_OK) return;
+
+    for (unsigned int i = 0; i < stream->count; ++i) {
+        hal_vidpack *pack = &stream->pack[i];
+        unsigned char *pack_data = pack->data + pack->offset;
+
+        for (char j = 0; j < pack->naluCnt; j++) {
+            if (pack->nalu[j].type != NalUnitType_CodedSliceIdr &&
+                pack->nalu[j].type != NalUnitType_CodedSliceAux) continue;
+            if (pack->nalu[j].length <= 4) continue;
+
+            err = put_u32_be(&timelapseMdat, pack->nalu[j].length - 4);
+            if (err != BUF_OK) return;
+            err = put(&timelapseMdat, (char *)pack_data + pack->nalu[j].offset + 4,
+                pack->nalu[j].length - 4);
+            if (err != BUF_OK) return;
+            size += pack->nalu[j].length;
+        }
+    }
+
+    if (!size) return;
+    err = put_u32_be_to_offset(&timelapseMdat, 0, timelapseMdat.offset);
+    if (err != BUF_OK) return;
+
+    // Files are rotated daily so each one stays easy to handle
+    if (timelapseFile && localtime(&now)->tm_yday != timelapseDay)
+        timelapse_stop();
+    if (!timelapseFile && timelapse_open(now)) return;
+
+    // Keyframes are laid out at the playback rate rather than the
+    // rate they were captured at, the timescale being the live one
+    struct SampleInfo sample = {0};
+    sample.size = size;
+    sample.duration = default_sample_size *
+        app_config.mp4_fps / app_config.timelapse_fps;
+
+    timelapseMoof.offset = 0;
+    err = write_moof(&timelapseMoof, timelapseSeq, 0, timelapseTime,
+        sample.duration, &sample, 1, NULL, 0);
+    if (err != BUF_OK) return;
+
+    fwrite(timelapseMoof.buf, 1, timelapseMoof.offset, timelapseFile);
+    fwrite(timelapseMdat.buf, 1, timelapseMdat.offset, timelapseFile);
+    fflush(timelapseFile);
+
+    timelapseSeq++;
+    timelapseTime += sample.duration;
+    timelapseLast = now;
+    timelapsePending = 0;
+}
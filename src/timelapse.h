@@ -0,0 +1,12 @@
+#pragma once
+
+#include <time.h>
+
+#include "app_config.h"
+#include "fmt/mp4.h"
+#include "hal/macros.h"
+#include "hal/types.h"
+#include "media.h"
+
+void timelapse_stop(void);
+void send_mp4_to_timelapse(hal_vidstream *stream);
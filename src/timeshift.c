@@ -0,0 +1,117 @@
+#include "timeshift.h"
+
+typedef struct {
+    unsigned int pos, moofLen, mdatLen;
+    unsigned int time;
+    struct MoofPos moofPos;
+    char isIdr;
+} timeshift_frag;
+
+static char *tsBuf;
+static unsigned int tsSize, tsWritePos;
+static timeshift_frag tsFrags[TIMESHIFT_MAX_FRAGS];
+// Fragments in [tsTail, tsHead) are readable, the counters only grow
+static unsigned int tsHead, tsTail;
+
+#define FRAG(seq) (&tsFrags[(seq) % TIMESHIFT_MAX_FRAGS])
+
+int timeshift_init(unsigned int size) {
+    if (tsBuf) return EXIT_SUCCESS;
+
+    if (!(tsBuf = malloc(size)))
+        HAL_ERROR("timeshift", "Failed to allocate a %u bytes buffer!\n", size);
+    tsSize = size;
+    tsWritePos = tsHead = tsTail = 0;
+
+    HAL_INFO("timeshift", "Buffering up to %u KiB of video!\n", size >> 10);
+    return EXIT_SUCCESS;
+}
+
+void timeshift_deinit(void) {
+    free(tsBuf);
+    tsBuf = NULL;
+    tsSize = 0;
+}
+
+void timeshift_push(struct BitBuf *moof, struct BitBuf *mdat,
+    const struct MoofPos *pos, char isIdr) {
+    unsigned int len = moof->offset + mdat->offset;
+
+    if (!tsBuf || len > tsSize) return;
+
+    if (tsWritePos + len > tsSize) {
+        // The oldest fragments lie past the write position, drop them
+        // before wrapping back to the start of the buffer
+        while (tsTail != tsHead && FRAG(tsTail)->pos >= tsWritePos)
+            tsTail++;
+        tsWritePos = 0;
+    }
+
+    while (tsTail != tsHead && (tsHead - tsTail >= TIMESHIFT_MAX_FRAGS ||
+        (FRAG(tsTail)->pos < tsWritePos + len &&
+        FRAG(tsTail)->pos + FRAG(tsTail)->moofLen + FRAG(tsTail)->mdatLen > tsWritePos)))
+        tsTail++;
+
+    timeshift_frag *frag = FRAG(tsHead);
+    frag->pos = tsWritePos;
+    frag->moofLen = moof->offset;
+    frag->mdatLen = mdat->offset;
+    frag->time = millis();
+    frag->moofPos = *pos;
+    frag->isIdr = isIdr;
+
+    memcpy(tsBuf + tsWritePos, moof->buf, moof->offset);
+    memcpy(tsBuf + tsWritePos + moof->offset, mdat->buf, mdat->offset);
+    tsWritePos += len;
+    tsHead++;
+}
+
+int timeshift_seek(unsigned int delay, unsigned int *seq) {
+    unsigned int target = millis() - delay;
+    char found = 0;
+
+    // Walk back to the last keyframe preceding the requested instant,
+    // or settle for the oldest one when the history is too short
+    for (unsigned int s = tsHead; s != tsTail; s--) {
+        timeshift_frag *frag = FRAG(s - 1);
+        if (!frag->isIdr) continue;
+        *seq = s - 1;
+        found = 1;
+        if ((int)(frag->time - target) <= 0) break;
+    }
+
+    return found ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int timeshift_read(unsigned int *seq, struct BitBuf *moof, struct BitBuf *mdat,
+    struct MoofPos *pos) {
+    if (!tsBuf || *seq == tsHead) return EXIT_FAILURE;
+
+    // A reader that was overtaken resumes from the oldest keyframe left
+    if ((int)(*seq - tsTail) < 0) {
+        *seq = tsTail;
+        while (*seq != tsHead && !FRAG(*seq)->isIdr)
+            (*seq)++;
+        if (*seq == tsHead) return EXIT_FAILURE;
+    }
+
+    timeshift_frag *frag = FRAG(*seq);
+    moof->buf = tsBuf + frag->pos;
+    moof->size = moof->offset = frag->moofLen;
+    mdat->buf = tsBuf + frag->pos + frag->moofLen;
+    mdat->size = mdat->offset = frag->mdatLen;
+    *pos = frag->moofPos;
+    (*seq)++;
+
+    return EXIT_SUCCESS;
+}
+
+char timeshift_is_live(unsigned int seq) {
+    return seq == tsHead;
+}
+
+// How far back in milliseconds the oldest buffered fragment goes
+unsigned int timeshift_span(void) {
+    if (!tsBuf || tsTail == tsHead) return 0;
+    return millis() - FRAG(tsTail)->time;
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "fmt/bitbuf.h"
+#include "fmt/moof.h"
+#include "hal/macros.h"
+#include "hal/tools.h"
+
+#define TIMESHIFT_MAX_FRAGS 4096
+
+int timeshift_init(unsigned int size);
+void timeshift_deinit(void);
+
+void timeshift_push(struct BitBuf *moof, struct BitBuf *mdat,
+    const struct MoofPos *pos, char isIdr);
+int timeshift_seek(unsigned int delay, unsigned int *seq);
+int timeshift_read(unsigned int *seq, struct BitBuf *moof, struct BitBuf *mdat,
+    struct MoofPos *pos);
+char timeshift_is_live(unsigned int seq);
+unsigned int timeshift_span(void);